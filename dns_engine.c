@@ -0,0 +1,415 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "dns_engine.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#else
+#define ESP_LOGD(tag, format, ...) do { (void)(tag); } while (0)
+#endif
+
+// Header flags, in host byte order
+#define QR_FLAG (1 << 15)
+#define OPCODE_MASK (0x7800)
+#define AA_FLAG (1 << 10)
+#define TC_FLAG (1 << 9)
+#define RD_FLAG (1 << 8)
+#define RCODE_NXDOMAIN (3)
+#define RCODE_NOTIMP (4)
+
+// Header field offsets
+#define HDR_FLAGS (2)
+#define HDR_QD_COUNT (4)
+#define HDR_AN_COUNT (6)
+#define HDR_NS_COUNT (8)
+#define HDR_AR_COUNT (10)
+#define HDR_LEN (12)
+// Type and class following the name of a question
+#define QUESTION_LEN (4)
+// Name pointer, type, class, TTL and data length of a resource record
+#define RECORD_LEN (12)
+
+#define QD_TYPE_A (0x0001)
+#define QD_TYPE_SOA (0x0006)
+#define QD_TYPE_AAAA (0x001C)
+#define QD_CLASS_IN (0x0001)
+#define DNS_MAX_NAME_LEN (255)
+// Each label takes at least 2 bytes of the name
+#define DNS_MAX_LABELS ((DNS_MAX_NAME_LEN + 1) / 2)
+#define ANS_TTL_SEC (300)
+// How long clients cache negative (NODATA and NXDOMAIN) answers
+#define NEG_TTL_SEC (60)
+
+#define FNV_OFFSET_BASIS (2166136261u)
+
+static const char *TAG = "dns_engine";
+
+// Labels of a name in wire format, pointing to each label's length byte in the packet
+typedef struct {
+    int count;
+    uint32_t hash;
+    const uint8_t *label[DNS_MAX_LABELS];
+} dns_labels_t;
+
+// The packet is in network byte order, read and written byte-wise as it is not aligned
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v >> 16);
+    put_u16(p + 2, v & 0xFFFF);
+}
+
+static inline uint32_t dns_hash_update(uint32_t hash, uint8_t c)
+{
+    // FNV-1a, case-insensitive as DNS names are
+    return (hash ^ (uint8_t)tolower(c)) * 16777619u;
+}
+
+int dns_rule_index_init(dns_rule_index_t *index, const char *const names[], int num_of_names)
+{
+    memset(index, 0, sizeof(*index));
+
+    uint32_t exact_size = 2;
+    int num_of_nodes = 1;
+    for (int i = 0; i < num_of_names; ++i) {
+        if (strncmp(names[i], "*.", 2) == 0) {
+            // upper bound, one node per label
+            for (const char *c = names[i] + 1; *c; c++) {
+                num_of_nodes += (*c == '.');
+            }
+        }
+    }
+    while (exact_size < 2u * num_of_names) {
+        exact_size <<= 1;
+    }
+
+    // +1 so an empty rule set does not make malloc() return NULL
+    index->names = malloc((num_of_names + 1) * sizeof(*index->names));
+    index->exact = malloc(exact_size * sizeof(dns_exact_slot_t));
+    index->suffix = malloc(num_of_nodes * sizeof(dns_suffix_node_t));
+    if (!index->names || !index->exact || !index->suffix) {
+        dns_rule_index_free(index);
+        return -1;
+    }
+    memcpy(index->names, names, num_of_names * sizeof(*index->names));
+    index->num_of_rules = num_of_names;
+    index->exact_mask = exact_size - 1;
+    for (uint32_t i = 0; i < exact_size; ++i) {
+        index->exact[i].rule = -1;
+    }
+    index->suffix[0] = (dns_suffix_node_t) { .child = -1, .sibling = -1, .rule = -1 };
+    index->num_of_suffix_nodes = 1;
+
+    for (int i = 0; i < num_of_names; ++i) {
+        const char *name = names[i];
+        size_t name_len = strlen(name);
+
+        if (strcmp(name, "*") == 0 || strcmp(name, "*.") == 0) {
+            if (index->suffix[0].rule < 0) {
+                index->suffix[0].rule = i;
+            }
+        } else if (strncmp(name, "*.", 2) == 0) {
+            // Walk (and create) the path of the suffix labels, from the last one to the first one
+            int node = 0;
+            const char *end = name + name_len;
+            while (end > name + 1) {
+                const char *start = end;
+                while (start > name + 2 && start[-1] != '.') {
+                    start--;
+                }
+                uint8_t label_len = end - start;
+                int child = index->suffix[node].child;
+                while (child >= 0 && (index->suffix[child].label_len != label_len ||
+                                      strncasecmp(index->suffix[child].label, start, label_len) != 0)) {
+                    child = index->suffix[child].sibling;
+                }
+                if (child < 0) {
+                    child = index->num_of_suffix_nodes++;
+                    index->suffix[child] = (dns_suffix_node_t) {
+                        .label = start, .label_len = label_len,
+                        .child = -1, .sibling = index->suffix[node].child, .rule = -1 };
+                    index->suffix[node].child = child;
+                }
+                node = child;
+                end = start - 1;
+            }
+            if (index->suffix[node].rule < 0) {
+                index->suffix[node].rule = i;
+            }
+        } else {
+            uint32_t hash = FNV_OFFSET_BASIS;
+            for (size_t c = 0; c < name_len; ++c) {
+                hash = dns_hash_update(hash, name[c]);
+            }
+            uint32_t slot = hash & index->exact_mask;
+            while (index->exact[slot].rule >= 0 &&
+                   !(index->exact[slot].hash == hash && strcasecmp(names[index->exact[slot].rule], name) == 0)) {
+                slot = (slot + 1) & index->exact_mask;
+            }
+            if (index->exact[slot].rule < 0) {
+                index->exact[slot] = (dns_exact_slot_t) { .hash = hash, .rule = i };
+            }
+        }
+    }
+    return 0;
+}
+
+void dns_rule_index_free(dns_rule_index_t *index)
+{
+    free(index->names);
+    free(index->exact);
+    free(index->suffix);
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+    Collects the labels of the name at `ptr` in the packet (ending at `packet_end`) and hashes them like
+    the .-separated name. `labels` may be NULL to only skip the name.
+    Returns the pointer to the next part of the packet, NULL if the name is malformed, compressed
+    or does not fit in the packet
+*/
+static const uint8_t *parse_dns_labels(const uint8_t *ptr, const uint8_t *packet_end, dns_labels_t *labels)
+{
+    size_t name_len = 0;
+    int count = 0;
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    while (ptr < packet_end && *ptr != 0) {
+        uint8_t label_len = *ptr;
+        // Compression pointers are not expected in questions
+        if (label_len & 0xC0) {
+            return NULL;
+        }
+        name_len += label_len + 1;
+        if (name_len > DNS_MAX_NAME_LEN || ptr + 1 + label_len >= packet_end) {
+            return NULL;
+        }
+        if (labels) {
+            if (count > 0) {
+                hash = dns_hash_update(hash, '.');
+            }
+            for (int c = 1; c <= label_len; ++c) {
+                hash = dns_hash_update(hash, ptr[c]);
+            }
+            labels->label[count] = ptr;
+        }
+        count++;
+        ptr += label_len + 1;
+    }
+    if (ptr >= packet_end) {
+        return NULL;
+    }
+    if (labels) {
+        labels->count = count;
+        labels->hash = hash;
+    }
+    return ptr + 1;
+}
+
+// Compares a .-separated name with the labels of a name in wire format, ignoring case
+static bool dns_name_equals(const char *name, const dns_labels_t *labels)
+{
+    for (int i = 0; i < labels->count; ++i) {
+        const uint8_t *label = labels->label[i];
+        if (i > 0 && *name++ != '.') {
+            return false;
+        }
+        if (strncasecmp(name, (const char *)label + 1, label[0]) != 0 || strnlen(name, label[0]) != label[0]) {
+            return false;
+        }
+        name += label[0];
+    }
+    return *name == '\0';
+}
+
+/*
+    Finds the rule answering the name: an exact match first, then the longest matching "*.<suffix>",
+    then the match-all "*" rule.
+    Returns the index of the rule, -1 if no rule applies
+*/
+static int match_dns_rule(const dns_rule_index_t *index, const dns_labels_t *labels)
+{
+    for (uint32_t slot = labels->hash & index->exact_mask; index->exact[slot].rule >= 0; slot = (slot + 1) & index->exact_mask) {
+        if (index->exact[slot].hash == labels->hash && dns_name_equals(index->names[index->exact[slot].rule], labels)) {
+            return index->exact[slot].rule;
+        }
+    }
+
+    int rule = index->suffix[0].rule;
+    int node = 0;
+    // The first label is left for the '*', a wildcard does not match its bare suffix
+    for (int i = labels->count - 1; i > 0; --i) {
+        const uint8_t *label = labels->label[i];
+        int child = index->suffix[node].child;
+        while (child >= 0 && (index->suffix[child].label_len != label[0] ||
+                              strncasecmp(index->suffix[child].label, (const char *)label + 1, label[0]) != 0)) {
+            child = index->suffix[child].sibling;
+        }
+        if (child < 0) {
+            break;
+        }
+        node = child;
+        if (index->suffix[node].rule >= 0) {
+            rule = index->suffix[node].rule;
+        }
+    }
+    return rule;
+}
+
+/*
+    Appends a resource record of class IN, named by a pointer to `name_offset`, at `*ptr`
+    Returns false, leaving `*ptr` untouched, if the record does not fit before `end`
+*/
+static bool append_dns_record(uint8_t **ptr, const uint8_t *end, uint16_t name_offset, uint16_t type, uint32_t ttl,
+                              const void *rdata, uint16_t rdata_len)
+{
+    if (end - *ptr < RECORD_LEN + rdata_len) {
+        return false;
+    }
+    uint8_t *record = *ptr;
+    put_u16(record, 0xC000 | name_offset);
+    put_u16(record + 2, type);
+    put_u16(record + 4, QD_CLASS_IN);
+    put_u32(record + 6, ttl);
+    put_u16(record + 10, rdata_len);
+    memcpy(record + RECORD_LEN, rdata, rdata_len);
+    *ptr += RECORD_LEN + rdata_len;
+    return true;
+}
+
+int dns_engine_build_reply(uint8_t *buf, size_t req_len, size_t buf_len, const dns_rule_index_t *index,
+                           const dns_answer_source_t *answers, dns_reply_info_t *info)
+{
+    if (info) {
+        *info = (dns_reply_info_t) { 0 };
+    }
+    if (req_len < HDR_LEN || req_len > buf_len) {
+        return -1;
+    }
+
+    uint16_t flags = get_u16(buf + HDR_FLAGS);
+    uint16_t qd_count = get_u16(buf + HDR_QD_COUNT);
+    ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d", get_u16(buf), flags, qd_count);
+
+    // Never reply to a response
+    if (flags & QR_FLAG) {
+        return 0;
+    }
+    // Not a standard query, reply with just the header
+    if (flags & OPCODE_MASK) {
+        if (info) {
+            info->not_implemented = true;
+        }
+        put_u16(buf + HDR_FLAGS, (flags & (OPCODE_MASK | RD_FLAG)) | QR_FLAG | RCODE_NOTIMP);
+        memset(buf + HDR_QD_COUNT, 0, HDR_LEN - HDR_QD_COUNT);
+        return HDR_LEN;
+    }
+
+    const uint8_t *req_end = buf + req_len;
+
+    // Find the end of the question section, the answers are appended right after it
+    const uint8_t *cur_qd_ptr = buf + HDR_LEN;
+    for (int qd_i = 0; qd_i < qd_count; qd_i++) {
+        const uint8_t *name_end_ptr = parse_dns_labels(cur_qd_ptr, req_end, NULL);
+        if (name_end_ptr == NULL || req_end - name_end_ptr < QUESTION_LEN) {
+            ESP_LOGD(TAG, "Malformed DNS question %d", qd_i);
+            return -1;
+        }
+        cur_qd_ptr = name_end_ptr + QUESTION_LEN;
+    }
+
+    // Pointer to current answer and question
+    uint8_t *cur_ans_ptr = (uint8_t *)cur_qd_ptr;
+    const uint8_t *buf_end = buf + buf_len;
+    uint16_t an_count = 0;
+    bool name_matched = false;
+    bool truncated = false;
+    dns_labels_t labels;
+    cur_qd_ptr = buf + HDR_LEN;
+
+    // Respond to all questions based on configured rules
+    for (int qd_i = 0; qd_i < qd_count && !truncated; qd_i++) {
+        uint16_t qd_name_offset = cur_qd_ptr - buf;
+        const uint8_t *name_end_ptr = parse_dns_labels(cur_qd_ptr, req_end, &labels);
+        uint16_t qd_type = get_u16(name_end_ptr);
+        uint16_t qd_class = get_u16(name_end_ptr + 2);
+        cur_qd_ptr = name_end_ptr + QUESTION_LEN;
+
+        ESP_LOGD(TAG, "Received type: %d | Class: %d | Labels: %d", qd_type, qd_class, labels.count);
+
+        // Check the configured rules to decide whether to answer this question or not
+        int rule = match_dns_rule(index, &labels);
+        if (rule < 0) {    // no rule applies, continue with another question
+            continue;
+        }
+        name_matched = true;
+        if (qd_class != QD_CLASS_IN) {
+            continue;
+        }
+
+        if (qd_type == QD_TYPE_A) {
+            uint32_t addr = atomic_load_explicit(&answers->ip4[rule], memory_order_relaxed);
+            if (addr == 0) {    // the netif of the rule has no IP (yet)
+                continue;
+            }
+            ESP_LOGD(TAG, "Answer with PTR offset: 0x%X and IP 0x%X", qd_name_offset, (unsigned)addr);
+            truncated = !append_dns_record(&cur_ans_ptr, buf_end, qd_name_offset, QD_TYPE_A, ANS_TTL_SEC, &addr, sizeof(addr));
+            an_count += !truncated;
+        } else if (qd_type == QD_TYPE_AAAA && answers->get_ip6) {
+            uint8_t ip6[16];
+            if (!answers->get_ip6(answers->ctx, rule, ip6)) {    // NODATA, no usable IPv6
+                continue;
+            }
+            truncated = !append_dns_record(&cur_ans_ptr, buf_end, qd_name_offset, QD_TYPE_AAAA, ANS_TTL_SEC, ip6, sizeof(ip6));
+            an_count += !truncated;
+        }
+        // Any other type (AAAA without IPv6, HTTPS, SVCB, ...) gets NODATA
+    }
+
+    uint16_t ns_count = 0;
+    if (an_count == 0 && qd_count > 0 && !truncated) {
+        // Negative answer, the SOA's minimum field tells how long to cache it (RFC 2308)
+        const uint8_t soa[] = {
+            0, 0,                       // MNAME and RNAME, root
+            0, 0, 0, 1,                 // SERIAL
+            0, 0, (NEG_TTL_SEC >> 8) & 0xFF, NEG_TTL_SEC & 0xFF,    // REFRESH
+            0, 0, (NEG_TTL_SEC >> 8) & 0xFF, NEG_TTL_SEC & 0xFF,    // RETRY
+            0, 0, (NEG_TTL_SEC >> 8) & 0xFF, NEG_TTL_SEC & 0xFF,    // EXPIRE
+            0, 0, (NEG_TTL_SEC >> 8) & 0xFF, NEG_TTL_SEC & 0xFF,    // MINIMUM
+        };
+        ns_count = append_dns_record(&cur_ans_ptr, buf_end, HDR_LEN, QD_TYPE_SOA, NEG_TTL_SEC, soa, sizeof(soa));
+    }
+
+    // Set question response flag, the answers are authoritative
+    flags = (flags & (OPCODE_MASK | RD_FLAG)) | QR_FLAG | AA_FLAG;
+    if (truncated) {
+        // The reply would overflow, tell the client to retry over TCP
+        flags |= TC_FLAG;
+    }
+    if (!name_matched && qd_count > 0) {
+        flags |= RCODE_NXDOMAIN;
+    }
+    put_u16(buf + HDR_FLAGS, flags);
+    put_u16(buf + HDR_AN_COUNT, an_count);
+    put_u16(buf + HDR_NS_COUNT, ns_count);
+    put_u16(buf + HDR_AR_COUNT, 0);
+
+    if (info) {
+        info->an_count = an_count;
+        info->truncated = truncated;
+    }
+    return cur_ans_ptr - buf;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+/*
+ * DNS packet engine of the captive portal DNS server: rule matching and in-place reply generation.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Classic maximum of a DNS message over UDP
+#define DNS_ENGINE_MAX_MSG_LEN (512)
+
+// Slot of the open addressing table of exact names
+typedef struct {
+    uint32_t hash;
+    int16_t rule;               // index of the rule, -1 if the slot is empty
+} dns_exact_slot_t;
+
+// Node of the suffix trie of "*.<suffix>" rules, labels are stored in reverse order (TLD first)
+// Node 0 is the root, its rule is the match-all "*" rule
+typedef struct {
+    const char *label;          // points into the name of the rule that added the node
+    uint8_t label_len;
+    int16_t child;              // first child, -1 if none
+    int16_t sibling;            // next sibling, -1 if none
+    int16_t rule;               // rule matching names under this suffix, -1 if none
+} dns_suffix_node_t;
+
+/**
+ * @brief Rule names compiled for constant time matching regardless of the number of rules
+ */
+typedef struct {
+    const char **names;         // name of each rule, not copied
+    int num_of_rules;
+    uint32_t exact_mask;        // size of the exact names table - 1, the size is a power of 2
+    dns_exact_slot_t *exact;
+    dns_suffix_node_t *suffix;
+    int num_of_suffix_nodes;
+} dns_rule_index_t;
+
+/**
+ * @brief Where the engine takes the addresses to answer from, per rule
+ */
+typedef struct {
+    const _Atomic uint32_t *ip4;    /**<! IPv4 per rule in network byte order, 0 if the rule has none (yet) */
+    /**
+     * Copies the IPv6 address of the rule in network byte order to `ip6`, returns false if the rule has none.
+     * NULL if IPv6 is not supported
+     */
+    bool (*get_ip6)(void *ctx, int rule, uint8_t ip6[16]);
+    void *ctx;                      /**<! Context of get_ip6 */
+} dns_answer_source_t;
+
+/**
+ * @brief Outcome of a reply, for statistics
+ */
+typedef struct {
+    uint16_t an_count;          /**<! Number of answers in the reply */
+    bool truncated;             /**<! Not all answers fit, TC is set */
+    bool not_implemented;       /**<! Not a standard query, the reply is a NOTIMP header */
+} dns_reply_info_t;
+
+/**
+ * @brief Compiles the rule names into an exact names table and a suffix trie
+ *
+ * A name is an exact name, "*.example.com" for any name under example.com, or "*" for all names, all
+ * case-insensitive. An exact name wins over the longest matching "*.<suffix>", which wins over "*";
+ * among duplicates the first rule wins.
+ *
+ * @param index Index to initialize
+ * @param names Rule names, the strings must stay valid for the lifetime of the index
+ * @param num_of_names Number of rules
+ * @return 0 on success, -1 if out of memory
+ */
+int dns_rule_index_init(dns_rule_index_t *index, const char *const names[], int num_of_names);
+
+/**
+ * @brief Frees the memory of an index, safe to call on a zeroed or partially initialized index
+ */
+void dns_rule_index_free(dns_rule_index_t *index);
+
+/**
+ * @brief Turns the DNS request in `buf` into the DNS response in place
+ *
+ * The reply keeps the question section, drops anything after it (e.g. EDNS OPT records) and appends one
+ * answer per answered question, setting TC if not all answers fit in `buf_len`.
+ * Questions for names matching a rule get NOERROR: A and AAAA are answered from `answers`, other types
+ * get no answer (NODATA). If no question matches any rule the reply is NXDOMAIN. Replies without answers
+ * carry an SOA record, so clients cache the negative answer instead of retrying.
+ * Non-standard opcodes get NOTIMP, responses are never answered.
+ *
+ * @param buf Buffer holding the request, the reply is written over it
+ * @param req_len Length of the request
+ * @param buf_len Size of the buffer, the maximum length of the reply
+ * @param index Compiled rules
+ * @param answers Addresses to answer per rule
+ * @param[out] info Outcome of the reply, may be NULL
+ * @return Length of the reply, 0 if the request must not be answered, -1 if it is malformed
+ */
+int dns_engine_build_reply(uint8_t *buf, size_t req_len, size_t buf_len, const dns_rule_index_t *index,
+                           const dns_answer_source_t *answers, dns_reply_info_t *info);
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,289 +3,424 @@
  *
  * SPDX-License-Identifier: Unlicense OR CC0-1.0
  */
-
+ 
  #include <sys/param.h>
  #include <inttypes.h>
+ #include <stdatomic.h>
  
  #include "esp_log.h"
  #include "esp_system.h"
  #include "esp_check.h"
+ #include "esp_timer.h"
  #include "esp_netif.h"
+ #include "esp_event.h"
+ #include "esp_wifi.h"
  
  #include "lwip/err.h"
  #include "lwip/sockets.h"
  #include "lwip/sys.h"
  #include "lwip/netdb.h"
  #include "dns_server.h"
+ #include "dns_engine.h"
  
  #define DNS_PORT (53)
- #define DNS_MAX_LEN (256)
- 
- #define OPCODE_MASK (0x7800)
- #define QR_FLAG (1 << 7)
- #define QD_TYPE_A (0x0001)
- #define ANS_TTL_SEC (300)
+ // Size of the single rx/reply buffer
+ #define DNS_MAX_LEN DNS_ENGINE_MAX_MSG_LEN
+ // Upper bound of the time the task takes to notice a stop request if the control socket is unavailable
+ #define DNS_POLL_TIMEOUT_MS (200)
+ // How long stop_dns_server() waits for the task to exit before deleting it
+ #define DNS_STOP_TIMEOUT_MS (1000)
+ // Number of clients the rate limiter keeps track of
+ #define DNS_RATE_LIMIT_SLOTS (16)
  
  static const char *TAG = "example_dns_redirect_server";
  
- // DNS Header Packet
- typedef struct __attribute__((__packed__))
- {
-     uint16_t id;
-     uint16_t flags;
-     uint16_t qd_count;
-     uint16_t an_count;
-     uint16_t ns_count;
-     uint16_t ar_count;
- } dns_header_t;
- 
- // DNS Question Packet
+ // Token bucket of a client, kept as the time at which the bucket would be full again (GCRA),
+ // so deciding on a packet takes one comparison and no division
  typedef struct {
-     uint16_t type;
-     uint16_t class;
- } dns_question_t;
- 
- // DNS Answer Packet
- typedef struct __attribute__((__packed__))
- {
-     uint16_t ptr_offset;
-     uint16_t type;
-     uint16_t class;
-     uint32_t ttl;
-     uint16_t addr_len;
-     uint32_t ip_addr;
- } dns_answer_t;
+     uint32_t addr;
+     int64_t full_at_us;
+ } dns_rate_slot_t;
  
  // DNS server handle
  struct dns_server_handle {
-     bool started;
+     atomic_bool started;
      TaskHandle_t task;
+     TaskHandle_t stopper;           // task waiting in stop_dns_server() for the DNS task to exit
+     int sock;
+     int ctrl_sock;                  // loopback socket waking the DNS task up to stop, -1 if none
+     struct sockaddr_in ctrl_addr;
+     dns_rule_index_t rules;
+     _Atomic uint32_t *answer_ip;    // IP to answer per rule, netif IPs are refreshed from events
+ #if CONFIG_LWIP_IPV6
+     esp_ip6_addr_t *answer_ip6;     // IPv6 to answer per rule, all zero if none
+     portMUX_TYPE answer_ip6_lock;
+ #endif
+     dns_answer_source_t answers;
+     esp_event_handler_instance_t ip_event;
+     esp_event_handler_instance_t ap_start_event;
+     dns_server_stats_t stats;       // only written by the DNS task
+     uint32_t rate_interval_us;      // time to earn one token, 0 if not rate limited
+     uint32_t rate_tolerance_us;     // time to earn a full bucket but one token
+     dns_rate_slot_t rate[DNS_RATE_LIMIT_SLOTS];
      int num_of_entries;
      dns_entry_pair_t entry[];
  };
  
+ #if CONFIG_LWIP_IPV6
+ // Answers AAAA questions of the engine, the addresses are swapped by the event handler
+ static bool get_dns_answer_ip6(void *ctx, int rule, uint8_t ip6[16])
+ {
+     dns_server_handle_t h = ctx;
+     esp_ip6_addr_t addr;
+     portENTER_CRITICAL(&h->answer_ip6_lock);
+     addr = h->answer_ip6[rule];
+     portEXIT_CRITICAL(&h->answer_ip6_lock);
+     memcpy(ip6, addr.addr, 16);
+     return (addr.addr[0] | addr.addr[1] | addr.addr[2] | addr.addr[3]) != 0;
+ }
+ #endif
+ 
  /*
-     Parse the name from the packet from the DNS name format to a regular .-seperated name
-     returns the pointer to the next part of the packet
+     Resolves the IP to answer for each rule, so the DNS task never has to query the netif layer
  */
- static char *parse_dns_name(char *raw_name, char *parsed_name, size_t parsed_name_max_len)
+ static void refresh_dns_answer_ips(dns_server_handle_t h)
  {
- 
-     char *label = raw_name;
-     char *name_itr = parsed_name;
-     int name_len = 0;
- 
-     do {
-         int sub_name_len = *label;
-         // (len + 1) since we are adding  a '.'
-         name_len += (sub_name_len + 1);
-         if (name_len > parsed_name_max_len) {
-             return NULL;
+     for (int i = 0; i < h->num_of_entries; ++i) {
+         uint32_t addr = h->entry[i].ip.addr;
+         if (h->entry[i].if_key) {
+             esp_netif_ip_info_t ip_info;
+             esp_netif_t *netif = esp_netif_get_handle_from_ifkey(h->entry[i].if_key);
+             addr = (netif && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) ? ip_info.ip.addr : IPADDR_ANY;
          }
+         atomic_store_explicit(&h->answer_ip[i], addr, memory_order_relaxed);
+ 
+ #if CONFIG_LWIP_IPV6
+         // Only answer AAAA with an address clients can use without a scope, link-local ones are left out
+         esp_ip6_addr_t ip6 = { 0 };
+         esp_netif_t *netif = h->entry[i].if_key ? esp_netif_get_handle_from_ifkey(h->entry[i].if_key) : NULL;
+         if (netif) {
+             esp_ip6_addr_t if_ip6[CONFIG_LWIP_IPV6_NUM_ADDRESSES];
+             int num_of_ip6 = esp_netif_get_all_ip6(netif, if_ip6);
+             for (int j = 0; j < num_of_ip6; ++j) {
+                 esp_ip6_addr_type_t type = esp_netif_ip6_get_addr_type(&if_ip6[j]);
+                 if (type == ESP_IP6_ADDR_IS_GLOBAL || type == ESP_IP6_ADDR_IS_UNIQUE_LOCAL) {
+                     ip6 = if_ip6[j];
+                     break;
+                 }
+             }
+         }
+         portENTER_CRITICAL(&h->answer_ip6_lock);
+         h->answer_ip6[i] = ip6;
+         portEXIT_CRITICAL(&h->answer_ip6_lock);
+ #endif
+     }
+ }
  
-         // Copy the sub name that follows the the label
-         memcpy(name_itr, label + 1, sub_name_len);
-         name_itr[sub_name_len] = '.';
-         name_itr += (sub_name_len + 1);
-         label += sub_name_len + 1;
-     } while (*label != 0);
- 
-     // Terminate the final string, replacing the last '.'
-     parsed_name[name_len - 1] = '\0';
-     // Return pointer to first char after the name
-     return label + 1;
+ // Netif IPs change on IP events, and the softAP's is configured by the time it starts
+ static void dns_netif_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+ {
+     refresh_dns_answer_ips(arg);
  }
  
- // Parses the DNS request and prepares a DNS response with the IP of the softAP
- static int parse_dns_request(char *req, size_t req_len, char *dns_reply, size_t dns_reply_max_len, dns_server_handle_t h)
+ static void free_dns_handle(dns_server_handle_t handle)
  {
-     if (req_len > dns_reply_max_len) {
-         return -1;
+     if (handle->sock >= 0) {
+         close(handle->sock);
      }
- 
-     // Prepare the reply
-     memset(dns_reply, 0, dns_reply_max_len);
-     memcpy(dns_reply, req, req_len);
- 
-     // Endianess of NW packet different from chip
-     dns_header_t *header = (dns_header_t *)dns_reply;
-     ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d",
-              ntohs(header->id), ntohs(header->flags), ntohs(header->qd_count));
- 
-     // Not a standard query
-     if ((header->flags & OPCODE_MASK) != 0) {
-         return 0;
+     if (handle->ctrl_sock >= 0) {
+         close(handle->ctrl_sock);
      }
+     if (handle->ip_event) {
+         esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID, handle->ip_event);
+     }
+     if (handle->ap_start_event) {
+         esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_AP_START, handle->ap_start_event);
+     }
+     free(handle->answer_ip);
+ #if CONFIG_LWIP_IPV6
+     free(handle->answer_ip6);
+ #endif
+     dns_rule_index_free(&handle->rules);
+     free(handle);
+ }
  
-     // Set question response flag
-     header->flags |= QR_FLAG;
- 
-     uint16_t qd_count = ntohs(header->qd_count);
-     header->an_count = htons(qd_count);
- 
-     int reply_len = qd_count * sizeof(dns_answer_t) + req_len;
-     if (reply_len > dns_reply_max_len) {
-         return -1;
+ // Bucket i counts the queries processed in less than (DNS_SERVER_LATENCY_BUCKET0_US << i) us
+ static void record_dns_latency(dns_server_stats_t *stats, int64_t elapsed_us)
+ {
+     int bucket = 0;
+     while (bucket < DNS_SERVER_LATENCY_BUCKETS - 1 && elapsed_us >= (DNS_SERVER_LATENCY_BUCKET0_US << bucket)) {
+         bucket++;
      }
+     stats->latency[bucket]++;
+     stats->latency_sum_us += elapsed_us;
+ }
  
-     // Pointer to current answer and question
-     char *cur_ans_ptr = dns_reply + req_len;
-     char *cur_qd_ptr = dns_reply + sizeof(dns_header_t);
-     char name[128];
- 
-     // Respond to all questions based on configured rules
-     for (int qd_i = 0; qd_i < qd_count; qd_i++) {
-         char *name_end_ptr = parse_dns_name(cur_qd_ptr, name, sizeof(name));
-         if (name_end_ptr == NULL) {
-             ESP_LOGE(TAG, "Failed to parse DNS question: %s", cur_qd_ptr);
-             return -1;
+ /*
+     Takes a token from the bucket of the client, returns false if it has none left.
+     A new client takes the slot of the client with the fullest bucket, so spoofed sources can
+     only evict clients which were not limited anyway
+ */
+ static bool dns_rate_limit_allow(dns_server_handle_t h, uint32_t addr, int64_t now_us)
+ {
+     dns_rate_slot_t *slot = &h->rate[0];
+     for (int i = 0; i < DNS_RATE_LIMIT_SLOTS; ++i) {
+         if (h->rate[i].addr == addr) {
+             slot = &h->rate[i];
+             break;
          }
+         if (h->rate[i].full_at_us < slot->full_at_us) {
+             slot = &h->rate[i];
+         }
+     }
+     if (slot->addr != addr) {
+         slot->addr = addr;
+         slot->full_at_us = now_us;
+     }
  
-         dns_question_t *question = (dns_question_t *)(name_end_ptr);
-         uint16_t qd_type = ntohs(question->type);
-         uint16_t qd_class = ntohs(question->class);
- 
-         ESP_LOGD(TAG, "Received type: %d | Class: %d | Question for: %s", qd_type, qd_class, name);
- 
-         if (qd_type == QD_TYPE_A) {
-             esp_ip4_addr_t ip = { .addr = IPADDR_ANY };
-             // Check the configured rules to decide whether to answer this question or not
-             for (int i = 0; i < h->num_of_entries; ++i) {
-                 // check if the name either corresponds to the entry, or if we should answer to all queries ("*")
-                 if (strcmp(h->entry[i].name, "*") == 0 || strcmp(h->entry[i].name, name) == 0) {
-                     if (h->entry[i].if_key) {
-                         esp_netif_ip_info_t ip_info;
-                         esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey(h->entry[i].if_key), &ip_info);
-                         ip.addr = ip_info.ip.addr;
-                         break;
-                     } else if (h->entry->ip.addr != IPADDR_ANY) {
-                         ip.addr = h->entry[i].ip.addr;
-                         break;
-                     }
-                 }
-             }
-             if (ip.addr == IPADDR_ANY) {    // no rule applies, continue with another question
-                 continue;
-             }
-             dns_answer_t *answer = (dns_answer_t *)cur_ans_ptr;
- 
-             answer->ptr_offset = htons(0xC000 | (cur_qd_ptr - dns_reply));
-             answer->type = htons(qd_type);
-             answer->class = htons(qd_class);
-             answer->ttl = htonl(ANS_TTL_SEC);
- 
-             ESP_LOGD(TAG, "Answer with PTR offset: 0x%" PRIX16 " and IP 0x%" PRIX32, ntohs(answer->ptr_offset), ip.addr);
+     int64_t full_at_us = MAX(slot->full_at_us, now_us);
+     if (full_at_us - now_us > h->rate_tolerance_us) {
+         return false;
+     }
+     slot->full_at_us = full_at_us + h->rate_interval_us;
+     return true;
+ }
  
-             answer->addr_len = htons(sizeof(ip.addr));
-             answer->ip_addr = ip.addr;
+ /*
+     Creates the DNS socket, bound to port 53, and the control socket the task is woken up through to stop.
+     Both are created once for the lifetime of the server
+ */
+ static esp_err_t open_dns_sockets(dns_server_handle_t h)
+ {
+     struct sockaddr_in dest_addr = {
+         .sin_family = AF_INET,
+         .sin_addr.s_addr = htonl(INADDR_ANY),
+         .sin_port = htons(DNS_PORT),
+     };
+     h->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+     ESP_RETURN_ON_FALSE(h->sock >= 0, ESP_FAIL, TAG, "Unable to create socket: errno %d", errno);
+     // A server restarted right after a stop must not fail to bind
+     int reuse = 1;
+     setsockopt(h->sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+     ESP_RETURN_ON_FALSE(bind(h->sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) == 0, ESP_FAIL, TAG,
+                         "Socket unable to bind: errno %d", errno);
+     ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
+ 
+     // Bound to an ephemeral loopback port, stop_dns_server() sends a datagram to it
+     struct sockaddr_in ctrl_addr = {
+         .sin_family = AF_INET,
+         .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+         .sin_port = 0,
+     };
+     socklen_t ctrl_addr_len = sizeof(h->ctrl_addr);
+     h->ctrl_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+     if (h->ctrl_sock < 0 || bind(h->ctrl_sock, (struct sockaddr *)&ctrl_addr, sizeof(ctrl_addr)) != 0 ||
+             getsockname(h->ctrl_sock, (struct sockaddr *)&h->ctrl_addr, &ctrl_addr_len) != 0) {
+         // Not fatal, the task also wakes up periodically to check whether to stop
+         ESP_LOGW(TAG, "Unable to create control socket: errno %d", errno);
+         if (h->ctrl_sock >= 0) {
+             close(h->ctrl_sock);
+             h->ctrl_sock = -1;
          }
      }
-     return reply_len;
+     return ESP_OK;
  }
  
  /*
-     Sets up a socket and listen for DNS queries,
-     replies to all type A queries with the IP of the softAP
+     Listens for DNS queries and replies to them based on the configured rules, until the server is stopped
  */
  void dns_server_task(void *pvParameters)
  {
-     char rx_buffer[128];
+     uint8_t rx_buffer[DNS_MAX_LEN];
      char addr_str[128];
-     int addr_family;
-     int ip_protocol;
      dns_server_handle_t handle = pvParameters;
- 
-     while (handle->started) {
- 
-         struct sockaddr_in dest_addr;
-         dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-         dest_addr.sin_family = AF_INET;
-         dest_addr.sin_port = htons(DNS_PORT);
-         addr_family = AF_INET;
-         ip_protocol = IPPROTO_IP;
-         inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
- 
-         int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-         if (sock < 0) {
-             ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-             break;
+     int max_fd = MAX(handle->sock, handle->ctrl_sock);
+ 
+     while (atomic_load(&handle->started)) {
+         fd_set read_fds;
+         FD_ZERO(&read_fds);
+         FD_SET(handle->sock, &read_fds);
+         if (handle->ctrl_sock >= 0) {
+             FD_SET(handle->ctrl_sock, &read_fds);
          }
-         ESP_LOGI(TAG, "Socket created");
- 
-         int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-         if (err < 0) {
-             ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+         struct timeval timeout = { .tv_sec = 0, .tv_usec = DNS_POLL_TIMEOUT_MS * 1000 };
+         int ready = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+         if (ready < 0) {
+             ESP_LOGE(TAG, "select failed: errno %d", errno);
+             vTaskDelay(pdMS_TO_TICKS(DNS_POLL_TIMEOUT_MS));
+             continue;
+         }
+         if (handle->ctrl_sock >= 0 && FD_ISSET(handle->ctrl_sock, &read_fds)) {
+             // Woken up by stop_dns_server(), drained so a stray datagram cannot keep the socket readable
+             uint8_t wake;
+             recv(handle->ctrl_sock, &wake, sizeof(wake), MSG_DONTWAIT);
+             continue;
+         }
+         if (ready == 0) {
+             continue;
          }
-         ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
  
-         while (handle->started) {
-             ESP_LOGI(TAG, "Waiting for data");
-             struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-             socklen_t socklen = sizeof(source_addr);
-             int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0, (struct sockaddr *)&source_addr, &socklen);
+         struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+         socklen_t socklen = sizeof(source_addr);
+         int len = recvfrom(handle->sock, rx_buffer, sizeof(rx_buffer), MSG_DONTWAIT, (struct sockaddr *)&source_addr, &socklen);
  
-             // Error occurred during receiving
-             if (len < 0) {
+         // Error occurred during receiving, the socket stays usable
+         if (len < 0) {
+             if (errno != EAGAIN && errno != EWOULDBLOCK) {
                  ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                 close(sock);
-                 break;
              }
-             // Data received
-             else {
-                 // Get the sender's ip address as string
-                 if (source_addr.sin6_family == PF_INET) {
-                     inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
-                 } else if (source_addr.sin6_family == PF_INET6) {
-                     inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-                 }
+             continue;
+         }
  
-                 // Null-terminate whatever we received and treat like a string...
-                 rx_buffer[len] = 0;
- 
-                 char reply[DNS_MAX_LEN];
-                 int reply_len = parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN, handle);
- 
-                 ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len, addr_str, reply_len);
-                 if (reply_len <= 0) {
-                     ESP_LOGE(TAG, "Failed to prepare a DNS reply");
-                 } else {
-                     int err = sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                     if (err < 0) {
-                         ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                         break;
-                     }
-                 }
+         int64_t start_us = esp_timer_get_time();
+         handle->stats.received++;
+ 
+         // Drop floods before spending any time on them, the socket is IPv4 only
+         if (handle->rate_interval_us &&
+                 !dns_rate_limit_allow(handle, ((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, start_us)) {
+             handle->stats.rate_limited++;
+             continue;
+         }
+ 
+         // Per packet logging is a cost of its own, only format the sender's address when debugging
+         if (LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG && esp_log_level_get(TAG) >= ESP_LOG_DEBUG) {
+             if (source_addr.sin6_family == PF_INET) {
+                 inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr, addr_str, sizeof(addr_str) - 1);
+             } else if (source_addr.sin6_family == PF_INET6) {
+                 inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
              }
+             ESP_LOGD(TAG, "Received %d bytes from %s", len, addr_str);
          }
  
-         if (sock != -1) {
-             ESP_LOGE(TAG, "Shutting down socket");
-             shutdown(sock, 0);
-             close(sock);
+         // The reply is built in place of the request
+         dns_reply_info_t info;
+         int reply_len = dns_engine_build_reply(rx_buffer, len, sizeof(rx_buffer), &handle->rules, &handle->answers, &info);
+ 
+         ESP_LOGD(TAG, "DNS reply with len: %d", reply_len);
+         if (reply_len < 0) {
+             handle->stats.malformed++;
+         } else if (reply_len == 0) {
+             handle->stats.responses++;
+         } else {
+             if (info.not_implemented) {
+                 handle->stats.not_implemented++;
+             } else if (info.an_count != 0) {
+                 handle->stats.answered++;
+             } else {
+                 handle->stats.unanswered++;
+             }
+             if (info.truncated) {
+                 handle->stats.truncated++;
+             }
+ 
+             int err = sendto(handle->sock, rx_buffer, reply_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
+             if (err < 0) {
+                 handle->stats.send_errors++;
+                 ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+             }
          }
+         record_dns_latency(&handle->stats, esp_timer_get_time() - start_us);
      }
+ 
+     // The handle may be freed as soon as the stopping task is notified
+     TaskHandle_t stopper = handle->stopper;
+     xTaskNotifyGive(stopper);
      vTaskDelete(NULL);
  }
  
- dns_server_handle_t start_dns_server(dns_server_config_t *config)
+  dns_server_handle_t start_dns_server(dns_server_config_t *config)
  {
      dns_server_handle_t handle = calloc(1, sizeof(struct dns_server_handle) + config->num_of_entries * sizeof(dns_entry_pair_t));
      ESP_RETURN_ON_FALSE(handle, NULL, TAG, "Failed to allocate dns server handle");
  
-     handle->started = true;
+     handle->sock = -1;
+     handle->ctrl_sock = -1;
      handle->num_of_entries = config->num_of_entries;
+     if (config->rate_limit_qps) {
+         handle->rate_interval_us = 1000000 / config->rate_limit_qps;
+         handle->rate_tolerance_us = handle->rate_interval_us * (MAX(config->rate_limit_burst, 1) - 1);
+     }
      memcpy(handle->entry, config->item, config->num_of_entries * sizeof(dns_entry_pair_t));
+     // Sized from the config, whose DNS_SERVER_MAX_ITEMS may differ from this file's
+     const char **names = malloc((handle->num_of_entries + 1) * sizeof(*names));
+     for (int i = 0; names && i < handle->num_of_entries; ++i) {
+         names[i] = handle->entry[i].name;
+     }
+     int err = names ? dns_rule_index_init(&handle->rules, names, handle->num_of_entries) : -1;
+     free(names);
+     if (err != 0) {
+         ESP_LOGE(TAG, "Failed to allocate DNS rule index");
+         free_dns_handle(handle);
+         return NULL;
+     }
  
-     xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task);
+     handle->answer_ip = calloc(config->num_of_entries, sizeof(*handle->answer_ip));
+ #if CONFIG_LWIP_IPV6
+     handle->answer_ip6 = calloc(config->num_of_entries, sizeof(*handle->answer_ip6));
+     portMUX_INITIALIZE(&handle->answer_ip6_lock);
+     if (!handle->answer_ip6) {
+         ESP_LOGE(TAG, "Failed to allocate DNS answer IPv6s");
+         free_dns_handle(handle);
+         return NULL;
+     }
+ #endif
+     if (!handle->answer_ip) {
+         ESP_LOGE(TAG, "Failed to allocate DNS answer IPs");
+         free_dns_handle(handle);
+         return NULL;
+     }
+     handle->answers.ip4 = handle->answer_ip;
+ #if CONFIG_LWIP_IPV6
+     handle->answers.get_ip6 = get_dns_answer_ip6;
+     handle->answers.ctx = handle;
+ #endif
+     refresh_dns_answer_ips(handle);
+     for (int i = 0; i < handle->num_of_entries; ++i) {
+         if (handle->entry[i].if_key) {
+             esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID, dns_netif_event_handler, handle, &handle->ip_event);
+             esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_AP_START, dns_netif_event_handler, handle, &handle->ap_start_event);
+             break;
+         }
+     }
+ 
+     if (open_dns_sockets(handle) != ESP_OK) {
+         free_dns_handle(handle);
+         return NULL;
+     }
+     atomic_store(&handle->started, true);
+     if (xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task) != pdPASS) {
+         ESP_LOGE(TAG, "Failed to create DNS server task");
+         free_dns_handle(handle);
+         return NULL;
+     }
      return handle;
  }
  
+ esp_err_t dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats)
+ {
+     ESP_RETURN_ON_FALSE(handle && stats, ESP_ERR_INVALID_ARG, TAG, "Invalid arguments");
+     memcpy(stats, &handle->stats, sizeof(*stats));
+     return ESP_OK;
+ }
+ 
  void stop_dns_server(dns_server_handle_t handle)
  {
-     if (handle) {
-         handle->started = false;
+     if (!handle) {
+         return;
+     }
+ 
+     // Set before the task may see the stop request
+     handle->stopper = xTaskGetCurrentTaskHandle();
+     ulTaskNotifyTake(pdTRUE, 0);
+     atomic_store(&handle->started, false);
+     if (handle->ctrl_sock >= 0) {
+         const uint8_t wake = 0;
+         sendto(handle->ctrl_sock, &wake, sizeof(wake), 0, (struct sockaddr *)&handle->ctrl_addr, sizeof(handle->ctrl_addr));
+     }
+     if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DNS_STOP_TIMEOUT_MS)) == 0) {
+         ESP_LOGE(TAG, "DNS server task did not exit, deleting it");
          vTaskDelete(handle->task);
-         free(handle);
      }
+     free_dns_handle(handle);
  }
  
\ No newline at end of file
@@ -6,6 +6,10 @@
 
  #pragma once
 
+ #include <stdint.h>
+ #include "esp_err.h"
+ #include "esp_netif_ip_addr.h"
+
  #ifdef __cplusplus
  extern "C" {
  #endif
@@ -26,7 +30,8 @@
   * we don't take copies of the config values `name` and `if_key`
   */
  typedef struct dns_entry_pair {
-     const char* name;       /**<! Exact match of the name field of the DNS query to answer */
+     const char* name;       /**<! Name of the DNS query to answer, case-insensitive: an exact name, "*.example.com" for
+                                  any name under example.com, or "*" for all names */
      const char* if_key;     /**<! Use this network interface IP to answer, only if NULL, use the static IP below */
      esp_ip4_addr_t ip;      /**<! Constant IP address to answer this query, if "if_key==NULL" */
  } dns_entry_pair_t;
@@ -35,6 +40,10 @@
   * @brief DNS server config struct defining the rules for answering DNS (A type) queries
   *
   * @note If you want to define more rules, you can set `DNS_SERVER_MAX_ITEMS` before including this header
+  * The rules are compiled once when the server starts. An exact name takes precedence over the longest matching
+  * "*.<suffix>" rule, which takes precedence over "*"; among duplicates the first rule wins.
+  * Each client is allowed `rate_limit_qps` queries per second on average, with bursts of up to
+  * `rate_limit_burst` queries; queries over the limit are dropped unanswered. Leave them 0 to disable the limit.
   * Example of using 2 entries with constant IP addresses
   * \code{.c}
   * #define DNS_SERVER_MAX_ITEMS 2
@@ -49,7 +58,9 @@
   */
  typedef struct dns_server_config {
      int num_of_entries;                             /**<! Number of rules specified in the config struct */
-     dns_entry_pair_t item[DNS_SERVER_MAX_ITEMS];    /**<! Array of pairs */
+     uint16_t rate_limit_qps;                        /**<! Sustained queries per second per client, 0 for no limit */
+     uint16_t rate_limit_burst;                      /**<! Queries a client may send at once, at least 1 if limited */
+     dns_entry_pair_t item[DNS_SERVER_MAX_ITEMS];    /**<! Array of pairs, last as its size is set by the caller */
  } dns_server_config_t;
  
  /**
@@ -57,17 +68,61 @@
   */
  typedef struct dns_server_handle *dns_server_handle_t;
  
+ // Sockets a running DNS server holds: the UDP server socket and a loopback control socket
+ #define DNS_SERVER_NUM_OF_SOCKETS 2
+ 
+ #define DNS_SERVER_LATENCY_BUCKETS 8
+ #define DNS_SERVER_LATENCY_BUCKET0_US 16
+ 
+ /**
+  * @brief DNS server statistics, counted since the server started
+  *
+  * @note The processing time covers parsing the query and sending the reply. Bucket i of `latency` counts the
+  * queries processed in less than (DNS_SERVER_LATENCY_BUCKET0_US << i) microseconds, not counted in a lower
+  * bucket; the last bucket counts all slower ones.
+  */
+ typedef struct dns_server_stats {
+     uint32_t received;          /**<! Packets received */
+     uint32_t answered;          /**<! Replies to standard queries sent with at least one answer */
+     uint32_t unanswered;        /**<! Replies to standard queries sent without any answer */
+     uint32_t not_implemented;   /**<! NOTIMP replies sent to queries other than standard ones */
+     uint32_t responses;         /**<! Packets dropped as they were responses, not queries */
+     uint32_t malformed;         /**<! Packets dropped as malformed */
+     uint32_t truncated;         /**<! Replies sent with the TC flag set, as not all answers fit */
+     uint32_t send_errors;       /**<! Replies that failed to send */
+     uint32_t rate_limited;      /**<! Packets dropped unparsed as their client was over its rate limit */
+     uint32_t latency[DNS_SERVER_LATENCY_BUCKETS];  /**<! Histogram of the processing time */
+     uint64_t latency_sum_us;    /**<! Total processing time of the queries counted in `latency` */
+ } dns_server_stats_t;
+ 
  /**
   * @brief Set ups and starts a simple DNS server that will respond to all A queries (IPv4)
   * based on configured rules, pairs of name and either IPv4 address or a netif ID (to respond by it's IPv4 add)
   *
+  * @note AAAA queries for a rule with a netif are answered with the netif's global IPv6 address, if it has one.
+  * Other query types for names matching a rule get an empty NOERROR (NODATA) reply, names matching no rule get
+  * NXDOMAIN, both with an SOA record so clients cache the negative answer.
+  *
   * @param config Configuration structure listing the pairs of (name, IP/netif-id)
   * @return dns_server's handle on success, NULL on failure
   */
  dns_server_handle_t start_dns_server(dns_server_config_t *config);
  
  /**
-  * @brief Stops and destroys DNS server's task and structs
+  * @brief Gets a snapshot of the DNS server statistics
+  *
+  * @note The counters are updated by the DNS task without locking, so the snapshot is not atomic across fields
+  * @param handle DNS server's handle
+  * @param[out] stats Statistics
+  * @return ESP_OK on success, ESP_ERR_INVALID_ARG if an argument is NULL
+  */
+ esp_err_t dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats);
+ 
+ /**
+  * @brief Stops and destroys DNS server's task, socket and structs
+  *
+  * @note Wakes the DNS task up and waits for it to exit, a second at most, before releasing port 53,
+  * so the server can be started again right away
   * @param handle DNS server's handle to destroy
   */
  void stop_dns_server(dns_server_handle_t handle);
@@ -0,0 +1,183 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "dns_corpus.h"
+
+#define TYPE_A (1)
+#define TYPE_NS (2)
+#define TYPE_PTR (12)
+#define TYPE_TXT (16)
+#define TYPE_AAAA (28)
+#define TYPE_SVCB (64)
+#define TYPE_HTTPS (65)
+#define TYPE_OPT (41)
+
+// SoftAP IP the portal answers with, 192.168.4.1 in network byte order
+#define PORTAL_IP4 (0x0104A8C0u)
+
+typedef struct {
+    const char *label;
+    const char *name;
+    uint16_t type;
+    uint16_t qd_count;          // the question is repeated, 0 for 1
+    bool edns;
+} query_spec_t;
+
+// Probes and background lookups seen while a phone or a laptop is on the softAP
+static const query_spec_t s_specs[] = {
+    { "android-probe-A", "connectivitycheck.gstatic.com", TYPE_A },
+    { "android-probe-AAAA", "connectivitycheck.gstatic.com", TYPE_AAAA },
+    { "android-fallback-A", "www.google.com", TYPE_A },
+    { "android-time-A", "time.android.com", TYPE_A },
+    { "android-mtalk-A", "mtalk.google.com", TYPE_A, 0, true },
+    { "android-ddr-SVCB", "_dns.resolver.arpa", TYPE_SVCB, 0, true },
+    { "ios-probe-A", "captive.apple.com", TYPE_A, 0, true },
+    { "ios-probe-HTTPS", "captive.apple.com", TYPE_HTTPS, 0, true },
+    { "ios-probe-AAAA", "captive.apple.com", TYPE_AAAA, 0, true },
+    { "ios-push-A", "1-courier.push.apple.com", TYPE_A, 0, true },
+    { "windows-probe-A", "www.msftconnecttest.com", TYPE_A },
+    { "windows-ncsi-A", "dns.msftncsi.com", TYPE_A },
+    { "windows-ncsi-AAAA", "dns.msftncsi.com", TYPE_AAAA },
+    { "firefox-probe-A", "detectportal.firefox.com", TYPE_A, 0, true },
+    { "linux-probe-A", "nmcheck.gnome.org", TYPE_A },
+    { "mdns-like-PTR", "1.4.168.192.in-addr.arpa", TYPE_PTR },
+    { "txt-query", "example.com", TYPE_TXT },
+    { "ns-root", "", TYPE_NS },
+    { "mixed-case-A", "ConnectivityCheck.GSTATIC.com", TYPE_A },
+    { "two-questions-A", "captive.apple.com", TYPE_A, 2 },
+    { "many-questions-A", "www.google.com", TYPE_A, 24 },
+    { "long-name-A", "a-very-long-label-to-exercise-the-name-parser-0123456789abcdef."
+                     "another-long-label-0123456789.and-a-third-one.example.com", TYPE_A },
+};
+
+// Invalid or unusual packets, kept as they are
+static const struct {
+    const char *label;
+    uint8_t packet[32];
+    size_t len;
+} s_raw[] = {
+    { "response", { 0x12, 0x34, 0x81, 0x80, 0, 1, 0, 0, 0, 0, 0, 0, 1, 'a', 0, 0, 1, 0, 1 }, 19 },
+    { "notify-opcode", { 0x12, 0x34, 0x20, 0x00, 0, 1, 0, 0, 0, 0, 0, 0, 1, 'a', 0, 0, 6, 0, 1 }, 19 },
+    { "compressed-question", { 0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0, 0xC0, 0x0C, 0, 1, 0, 1 }, 18 },
+    { "truncated-question", { 0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0, 7, 'c', 'a', 'p' }, 16 },
+    { "header-only", { 0x12, 0x34, 0x01, 0x00, 0, 0, 0, 0, 0, 0, 0, 0 }, 12 },
+    { "short-header", { 0x12, 0x34, 0x01 }, 3 },
+};
+
+#define CORPUS_LEN (sizeof(s_specs) / sizeof(s_specs[0]) + sizeof(s_raw) / sizeof(s_raw[0]))
+
+static dns_corpus_query_t s_corpus[CORPUS_LEN];
+static bool s_corpus_built;
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+// Builds the query of `spec`, returns its length, 0 if it does not fit
+static size_t build_query(uint8_t *buf, size_t size, uint16_t id, const query_spec_t *spec)
+{
+    uint16_t qd_count = spec->qd_count ? spec->qd_count : 1;
+    memset(buf, 0, 12);
+    put_u16(buf, id);
+    put_u16(buf + 2, 0x0100);   // RD
+    put_u16(buf + 4, qd_count);
+    put_u16(buf + 10, spec->edns);
+    size_t len = 12;
+
+    for (uint16_t q = 0; q < qd_count; q++) {
+        const char *label = spec->name;
+        while (*label) {
+            size_t label_len = strcspn(label, ".");
+            if (len + 1 + label_len > size) {
+                return 0;
+            }
+            buf[len++] = label_len;
+            memcpy(buf + len, label, label_len);
+            len += label_len;
+            label += label_len + (label[label_len] == '.');
+        }
+        if (len + 5 > size) {
+            return 0;
+        }
+        buf[len++] = 0;
+        put_u16(buf + len, spec->type);
+        put_u16(buf + len + 2, 1);  // IN
+        len += 4;
+    }
+
+    if (spec->edns) {
+        // OPT record of the root name, 1232 bytes UDP payload, no options
+        const uint8_t opt[] = { 0, TYPE_OPT >> 8, TYPE_OPT & 0xFF, 1232 >> 8, 1232 & 0xFF, 0, 0, 0, 0, 0, 0 };
+        if (len + sizeof(opt) > size) {
+            return 0;
+        }
+        memcpy(buf + len, opt, sizeof(opt));
+        len += sizeof(opt);
+    }
+    return len;
+}
+
+const dns_corpus_query_t *dns_corpus_get(size_t *count)
+{
+    if (!s_corpus_built) {
+        size_t n = 0;
+        for (size_t i = 0; i < sizeof(s_specs) / sizeof(s_specs[0]); i++, n++) {
+            s_corpus[n].label = s_specs[i].label;
+            s_corpus[n].len = build_query(s_corpus[n].packet, sizeof(s_corpus[n].packet), 0x1000 + n, &s_specs[i]);
+        }
+        for (size_t i = 0; i < sizeof(s_raw) / sizeof(s_raw[0]); i++, n++) {
+            s_corpus[n].label = s_raw[i].label;
+            memcpy(s_corpus[n].packet, s_raw[i].packet, s_raw[i].len);
+            s_corpus[n].len = s_raw[i].len;
+        }
+        s_corpus_built = true;
+    }
+    *count = CORPUS_LEN;
+    return s_corpus;
+}
+
+static bool get_ip6(void *ctx, int rule, uint8_t ip6[16])
+{
+    // fe80::1 for every rule
+    memset(ip6, 0, 16);
+    ip6[0] = 0xFE;
+    ip6[1] = 0x80;
+    ip6[15] = 1;
+    return true;
+}
+
+const dns_answer_source_t *dns_corpus_portal_rules(dns_rule_index_t *index)
+{
+    static const char *const names[] = { "*" };
+    static _Atomic uint32_t ip4[] = { PORTAL_IP4 };
+    static const dns_answer_source_t answers = { .ip4 = ip4, .get_ip6 = get_ip6 };
+
+    if (dns_rule_index_init(index, names, 1) != 0) {
+        return NULL;
+    }
+    return &answers;
+}
+
+const dns_answer_source_t *dns_corpus_mixed_rules(dns_rule_index_t *index)
+{
+    static const char *const names[] = {
+        "captive.apple.com", "connectivitycheck.gstatic.com", "www.msftconnecttest.com", "dns.msftncsi.com",
+        "*.google.com", "*.apple.com", "*.push.apple.com", "*.arpa", "my-esp32.local", "*",
+        "*.example.com", "nmcheck.gnome.org", "detectportal.firefox.com", "time.android.com", "*.local",
+    };
+    #define MIXED_RULES (sizeof(names) / sizeof(names[0]))
+    static _Atomic uint32_t ip4[MIXED_RULES];
+    static const dns_answer_source_t answers = { .ip4 = ip4, .get_ip6 = get_ip6 };
+
+    for (size_t i = 0; i < MIXED_RULES; i++) {
+        // 192.168.4.1 + i, the "*.arpa" rule has no IP
+        atomic_store(&ip4[i], i == 7 ? 0 : PORTAL_IP4 + ((uint32_t)i << 24));
+    }
+    if (dns_rule_index_init(index, names, MIXED_RULES) != 0) {
+        return NULL;
+    }
+    return &answers;
+}
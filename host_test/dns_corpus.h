@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Queries captured from phones and laptops joining the captive portal, rebuilt in wire format.
+ * They seed the DNS engine fuzzer and are replayed by the DNS engine benchmark.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dns_engine.h"
+
+typedef struct {
+    const char *label;          // what the query is, e.g. "android-probe-A"
+    uint8_t packet[DNS_ENGINE_MAX_MSG_LEN];
+    size_t len;
+} dns_corpus_query_t;
+
+/**
+ * @brief Gets the corpus, built on first use
+ *
+ * @param[out] count Number of queries
+ * @return Queries of the corpus
+ */
+const dns_corpus_query_t *dns_corpus_get(size_t *count);
+
+/**
+ * @brief Compiles the rules of the provisioning portal, "*" answered with the softAP IP, into `index`
+ *
+ * @return Answer source of the rules, answering AAAA queries too
+ */
+const dns_answer_source_t *dns_corpus_portal_rules(dns_rule_index_t *index);
+
+/**
+ * @brief Compiles a larger rule set mixing exact names, "*.<suffix>" rules and "*", into `index`
+ *
+ * @return Answer source of the rules
+ */
+const dns_answer_source_t *dns_corpus_mixed_rules(dns_rule_index_t *index);
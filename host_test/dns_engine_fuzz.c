@@ -0,0 +1,68 @@
+/*
+ * libFuzzer target of the DNS engine: any packet is turned into a reply in place, checking the reply stays
+ * in the buffer and is a well-formed response header. Built with clang it links against libFuzzer, otherwise
+ * fuzz_driver.c replays the corpus and random mutations of it.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_corpus.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static dns_rule_index_t s_portal_index;
+static dns_rule_index_t s_mixed_index;
+static const dns_answer_source_t *s_portal_answers;
+static const dns_answer_source_t *s_mixed_answers;
+
+static void run_one(const uint8_t *data, size_t size, size_t buf_len, const dns_rule_index_t *index,
+                    const dns_answer_source_t *answers)
+{
+    // Exactly sized, so the sanitizers catch any write past the reply buffer
+    uint8_t *buf = malloc(buf_len);
+    assert(buf);
+    size_t req_len = size < buf_len ? size : buf_len;
+    memcpy(buf, data, req_len);
+
+    dns_reply_info_t info;
+    int reply_len = dns_engine_build_reply(buf, req_len, buf_len, index, answers, &info);
+    assert(reply_len >= -1 && reply_len <= (int)buf_len);
+    if (reply_len > 0) {
+        assert(reply_len >= 12);
+        assert(buf[2] & 0x80);  // QR
+        uint16_t an_count = buf[6] << 8 | buf[7];
+        assert(an_count == info.an_count);
+        assert(!info.truncated || (buf[2] & 0x02));
+        assert(!info.not_implemented || ((buf[3] & 0x0f) == 4 && an_count == 0));
+    } else {
+        assert(info.an_count == 0 && !info.truncated && !info.not_implemented);
+    }
+    free(buf);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (!s_portal_answers) {
+        s_portal_answers = dns_corpus_portal_rules(&s_portal_index);
+        s_mixed_answers = dns_corpus_mixed_rules(&s_mixed_index);
+        assert(s_portal_answers && s_mixed_answers);
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    // The first byte picks the rules and the size of the reply buffer, to also reach truncated replies
+    uint8_t selector = data[0];
+    data++;
+    size--;
+    size_t buf_len = (selector & 0x80) ? DNS_ENGINE_MAX_MSG_LEN : 12 + (selector & 0x7F) * 4;
+    if (selector & 0x01) {
+        run_one(data, size, buf_len, &s_mixed_index, s_mixed_answers);
+    } else {
+        run_one(data, size, buf_len, &s_portal_index, s_portal_answers);
+    }
+    return 0;
+}
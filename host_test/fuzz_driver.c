@@ -0,0 +1,128 @@
+/*
+ * Stand-in for libFuzzer when the compiler has none: runs the target over the files given on the command line,
+ * or over the corpus and random mutations of it.
+ *
+ *   dns_engine_fuzz [-runs=N] [-seed=S] [FILE...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_corpus.h"
+
+#define DEFAULT_RUNS 1000000
+#define MAX_INPUT_LEN (DNS_ENGINE_MAX_MSG_LEN + 64)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint64_t s_rng;
+
+static uint32_t next_random(void)
+{
+    // xorshift64*
+    s_rng ^= s_rng >> 12;
+    s_rng ^= s_rng << 25;
+    s_rng ^= s_rng >> 27;
+    return (s_rng * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static int run_file(const char *path)
+{
+    uint8_t data[MAX_INPUT_LEN];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    size_t size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    LLVMFuzzerTestOneInput(data, size);
+    return 0;
+}
+
+// Flips, overwrites, inserts or drops bytes of the input, or rewrites a header count
+static size_t mutate(uint8_t *data, size_t size)
+{
+    int mutations = 1 + next_random() % 8;
+    for (int i = 0; i < mutations; i++) {
+        size_t pos = size > 1 ? 1 + next_random() % (size - 1) : 1;
+        switch (next_random() % 6) {
+        case 0:
+            if (pos < size) {
+                data[pos] ^= 1 << (next_random() % 8);
+            }
+            break;
+        case 1:
+            if (pos < size) {
+                data[pos] = next_random();
+            }
+            break;
+        case 2:
+            if (size < MAX_INPUT_LEN) {
+                memmove(data + pos + 1, data + pos, size - pos);
+                data[pos] = next_random();
+                size++;
+            }
+            break;
+        case 3:
+            if (pos < size) {
+                memmove(data + pos, data + pos + 1, size - pos - 1);
+                size--;
+            }
+            break;
+        case 4:
+            size = 1 + next_random() % size;
+            break;
+        default:
+            // qd_count, an_count, ns_count or ar_count, the first byte of data picks the setup
+            if (size >= 13) {
+                size_t field = 1 + 4 + 2 * (next_random() % 4);
+                data[field] = next_random() % 2 ? 0 : next_random();
+                data[field + 1] = next_random();
+            }
+            break;
+        }
+    }
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long runs = DEFAULT_RUNS;
+    unsigned long long seed = 1;
+    int files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = strtoul(argv[i] + 6, NULL, 10);
+        } else if (strncmp(argv[i], "-seed=", 6) == 0) {
+            seed = strtoull(argv[i] + 6, NULL, 10);
+        } else if (argv[i][0] != '-') {
+            if (run_file(argv[i]) != 0) {
+                return 1;
+            }
+            files++;
+        }
+    }
+    if (files > 0) {
+        printf("Ran %d inputs\n", files);
+        return 0;
+    }
+
+    size_t count;
+    const dns_corpus_query_t *corpus = dns_corpus_get(&count);
+    s_rng = seed ? seed : 1;
+    uint8_t data[MAX_INPUT_LEN];
+    for (unsigned long run = 0; run < runs; run++) {
+        const dns_corpus_query_t *query = &corpus[run % count];
+        size_t size = 1 + query->len;
+        data[0] = next_random();
+        memcpy(data + 1, query->packet, query->len);
+        if (run >= count) {
+            size = mutate(data, size);
+        }
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("Ran %lu inputs from %zu seeds, seed %llu\n", runs, count, seed);
+    return 0;
+}
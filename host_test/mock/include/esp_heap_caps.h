@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_DEFAULT (1 << 12)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+// Backed by the allocations of the code under test, out of a heap of MOCK_HEAP_SIZE bytes, see mock.h
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif_ip_addr.h"
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef struct {
+    esp_ip_addr_t ip;
+} esp_netif_dns_info_t;
+
+typedef enum {
+    ESP_NETIF_DNS_MAIN,
+    ESP_NETIF_DNS_BACKUP,
+    ESP_NETIF_DNS_FALLBACK,
+} esp_netif_dns_type_t;
+
+typedef enum {
+    ESP_NETIF_OP_START,
+    ESP_NETIF_OP_SET,
+    ESP_NETIF_OP_GET,
+} esp_netif_dhcp_option_mode_t;
+
+typedef enum {
+    ESP_NETIF_CAPTIVEPORTAL_URI = 114,
+} esp_netif_dhcp_option_id_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+    IP_EVENT_AP_STAIPASSIGNED,
+} ip_event_t;
+
+typedef struct {
+    esp_netif_t *esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+#define ESP_ERR_ESP_NETIF_BASE 0x5000
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED (ESP_ERR_ESP_NETIF_BASE + 0x04)
+#define ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED (ESP_ERR_ESP_NETIF_BASE + 0x05)
+#define ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED (ESP_ERR_ESP_NETIF_BASE + 0x06)
+
+/*
+ * The netifs of the default Wi-Fi AP and STA. The STA's DHCP client hands out the lease of the AP it is associated
+ * with, see mock_ap_t. As in ESP-IDF, setting a static IP while the client is stopped posts IP_EVENT_STA_GOT_IP.
+ */
+esp_err_t esp_netif_init(void);
+esp_netif_t *esp_netif_create_default_wifi_ap(void);
+esp_netif_t *esp_netif_create_default_wifi_sta(void);
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key);
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info);
+esp_err_t esp_netif_set_ip_info(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info);
+esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+esp_err_t esp_netif_set_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns);
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *esp_netif);
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *esp_netif);
+esp_err_t esp_netif_dhcps_start(esp_netif_t *esp_netif);
+esp_err_t esp_netif_dhcps_stop(esp_netif_t *esp_netif);
+esp_err_t esp_netif_dhcps_option(esp_netif_t *esp_netif, esp_netif_dhcp_option_mode_t opt_op,
+                                 esp_netif_dhcp_option_id_t opt_id, void *opt_val, uint32_t opt_len);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t addr;                  // network byte order
+} esp_ip4_addr_t;
+
+typedef struct {
+    uint32_t addr[4];
+    uint8_t zone;
+} esp_ip6_addr_t;
+
+#define ESP_IPADDR_TYPE_V4 0
+#define ESP_IPADDR_TYPE_V6 6
+
+typedef struct {
+    union {
+        esp_ip6_addr_t ip6;
+        esp_ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} esp_ip_addr_t;
+
+// Little endian host, as the chips are
+#define ESP_IP4TOADDR(a, b, c, d) (((uint32_t)(d) << 24) | ((uint32_t)(c) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(a))
+#define esp_ip4_addr_get_byte(ipaddr, idx) (((const uint8_t *)(&(ipaddr)->addr))[idx])
+#define IPSTR "%d.%d.%d.%d"
+#define IP2STR(ipaddr) esp_ip4_addr_get_byte(ipaddr, 0), esp_ip4_addr_get_byte(ipaddr, 1), \
+                       esp_ip4_addr_get_byte(ipaddr, 2), esp_ip4_addr_get_byte(ipaddr, 3)
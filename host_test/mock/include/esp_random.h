@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Deterministic, seeded by mock_random_seed()
+uint32_t esp_random(void);
@@ -0,0 +1,249 @@
+#pragma once
+
+/*
+ * Wi-Fi driver API used by the component, backed by the simulated APs of mock.h. Connecting and scanning take
+ * mock time and report through the default event loop, as the driver does.
+ */
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+#define ESP_ERR_WIFI_NOT_STOPPED (ESP_ERR_WIFI_BASE + 4)
+#define ESP_ERR_WIFI_NOT_CONNECT (ESP_ERR_WIFI_BASE + 15)
+
+typedef enum {
+    WIFI_MODE_NULL,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef enum {
+    WIFI_IF_STA,
+    WIFI_IF_AP,
+} wifi_interface_t;
+
+#define ESP_IF_WIFI_STA WIFI_IF_STA
+#define ESP_IF_WIFI_AP WIFI_IF_AP
+
+typedef enum {
+    WIFI_AUTH_OPEN,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK,
+    WIFI_AUTH_WPA_WPA2_PSK,
+    WIFI_AUTH_WPA2_ENTERPRISE,
+    WIFI_AUTH_WPA3_PSK,
+    WIFI_AUTH_WPA2_WPA3_PSK,
+    WIFI_AUTH_MAX,
+} wifi_auth_mode_t;
+
+typedef enum {
+    WIFI_SECOND_CHAN_NONE,
+    WIFI_SECOND_CHAN_ABOVE,
+    WIFI_SECOND_CHAN_BELOW,
+} wifi_second_chan_t;
+
+typedef enum {
+    WIFI_SCAN_TYPE_ACTIVE,
+    WIFI_SCAN_TYPE_PASSIVE,
+} wifi_scan_type_t;
+
+typedef enum {
+    WIFI_FAST_SCAN,
+    WIFI_ALL_CHANNEL_SCAN,
+} wifi_scan_method_t;
+
+typedef enum {
+    WIFI_STORAGE_FLASH,
+    WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+} wifi_active_scan_time_t;
+
+typedef struct {
+    wifi_active_scan_time_t active;
+    uint32_t passive;
+} wifi_scan_time_t;
+
+typedef struct {
+    uint16_t ghz_2_channels;
+    uint32_t ghz_5_channels;
+} wifi_scan_channel_bitmap_t;
+
+typedef struct {
+    uint8_t *ssid;
+    uint8_t *bssid;
+    uint8_t channel;
+    bool show_hidden;
+    wifi_scan_type_t scan_type;
+    wifi_scan_time_t scan_time;
+    uint8_t home_chan_dwell_time;
+    wifi_scan_channel_bitmap_t channel_bitmap;
+} wifi_scan_config_t;
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t primary;
+    wifi_second_chan_t second;
+    int8_t rssi;
+    wifi_auth_mode_t authmode;
+} wifi_ap_record_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    wifi_scan_method_t scan_method;
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_sta_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint8_t ssid_len;
+    uint8_t channel;
+    wifi_auth_mode_t authmode;
+    uint8_t ssid_hidden;
+    uint8_t max_connection;
+    uint16_t beacon_interval;
+} wifi_ap_config_t;
+
+typedef union {
+    wifi_ap_config_t ap;
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    int magic;
+} wifi_init_config_t;
+
+#define WIFI_INIT_CONFIG_DEFAULT() { .magic = 0x1F2F3F4F }
+
+#define WIFI_PROTOCOL_11B 0x1
+#define WIFI_PROTOCOL_11G 0x2
+#define WIFI_PROTOCOL_11N 0x4
+#define WIFI_PROTOCOL_LR 0x8
+
+typedef enum {
+    WIFI_EVENT_WIFI_READY = 0,
+    WIFI_EVENT_SCAN_DONE,
+    WIFI_EVENT_STA_START,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+    WIFI_EVENT_STA_AUTHMODE_CHANGE,
+    WIFI_EVENT_STA_WPS_ER_SUCCESS,
+    WIFI_EVENT_STA_WPS_ER_FAILED,
+    WIFI_EVENT_STA_WPS_ER_TIMEOUT,
+    WIFI_EVENT_STA_WPS_ER_PIN,
+    WIFI_EVENT_STA_WPS_ER_PBC_OVERLAP,
+    WIFI_EVENT_AP_START,
+    WIFI_EVENT_AP_STOP,
+    WIFI_EVENT_AP_STACONNECTED,
+    WIFI_EVENT_AP_STADISCONNECTED,
+    WIFI_EVENT_AP_PROBEREQRECVED,
+    WIFI_EVENT_FTM_REPORT,
+    WIFI_EVENT_STA_BSS_RSSI_LOW,
+    WIFI_EVENT_ACTION_TX_STATUS,
+    WIFI_EVENT_ROC_DONE,
+    WIFI_EVENT_STA_BEACON_TIMEOUT,
+    WIFI_EVENT_CONNECTIONLESS_MODULE_WAKE_INTERVAL_START,
+    WIFI_EVENT_AP_WPS_RG_SUCCESS,
+    WIFI_EVENT_AP_WPS_RG_FAILED,
+    WIFI_EVENT_AP_WPS_RG_TIMEOUT,
+    WIFI_EVENT_AP_WPS_RG_PIN,
+    WIFI_EVENT_AP_WPS_RG_PBC_OVERLAP,
+    WIFI_EVENT_ITWT_SETUP,
+    WIFI_EVENT_ITWT_TEARDOWN,
+    WIFI_EVENT_ITWT_PROBE,
+    WIFI_EVENT_ITWT_SUSPEND,
+    WIFI_EVENT_TWT_WAKEUP,
+    WIFI_EVENT_BTWT_SETUP,
+    WIFI_EVENT_BTWT_TEARDOWN,
+    WIFI_EVENT_NAN_STARTED,
+    WIFI_EVENT_NAN_STOPPED,
+    WIFI_EVENT_NAN_SVC_MATCH,
+    WIFI_EVENT_NAN_REPLIED,
+    WIFI_EVENT_NAN_RECEIVE,
+    WIFI_EVENT_NDP_INDICATION,
+    WIFI_EVENT_NDP_CONFIRM,
+    WIFI_EVENT_NDP_TERMINATED,
+    WIFI_EVENT_HOME_CHANNEL_CHANGE,
+    WIFI_EVENT_STA_NEIGHBOR_REP,
+    WIFI_EVENT_AP_WRONG_PASSWORD,
+    WIFI_EVENT_MAX,
+} wifi_event_t;
+
+typedef enum {
+    WIFI_REASON_UNSPECIFIED = 1,
+    WIFI_REASON_AUTH_EXPIRE = 2,
+    WIFI_REASON_AUTH_LEAVE = 3,
+    WIFI_REASON_ASSOC_LEAVE = 8,
+    WIFI_REASON_MIC_FAILURE = 14,
+    WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT = 15,
+    WIFI_REASON_802_1X_AUTH_FAILED = 23,
+    WIFI_REASON_BEACON_TIMEOUT = 200,
+    WIFI_REASON_NO_AP_FOUND = 201,
+    WIFI_REASON_AUTH_FAIL = 202,
+    WIFI_REASON_ASSOC_FAIL = 203,
+    WIFI_REASON_HANDSHAKE_TIMEOUT = 204,
+    WIFI_REASON_CONNECTION_FAIL = 205,
+    WIFI_REASON_AP_TSF_RESET = 206,
+    WIFI_REASON_ROAMING = 207,
+} wifi_err_reason_t;
+
+typedef struct {
+    uint32_t status;
+    uint8_t number;
+    uint8_t scan_id;
+} wifi_event_sta_scan_done_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+    wifi_auth_mode_t authmode;
+    uint16_t aid;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+    int8_t rssi;
+} wifi_event_sta_disconnected_t;
+
+typedef struct {
+    uint8_t old_chan;
+    wifi_second_chan_t old_snd;
+    uint8_t new_chan;
+    wifi_second_chan_t new_snd;
+} wifi_event_home_channel_change_t;
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block);
+esp_err_t esp_wifi_scan_stop(void);
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number);
+esp_err_t esp_wifi_scan_get_ap_record(wifi_ap_record_t *ap_record);
+esp_err_t esp_wifi_clear_ap_list(void);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+esp_err_t esp_wifi_set_protocol(wifi_interface_t ifx, uint8_t protocol_bitmap);
+esp_err_t esp_wifi_get_protocol(wifi_interface_t ifx, uint8_t *protocol_bitmap);
@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * FreeRTOS API used by the component, on POSIX threads. A tick is a millisecond of mock time, which runs
+ * mock_time_set_scale() times faster than real time.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+// Critical sections only exclude each other, as spinlocks do on a dual core chip
+typedef struct {
+    pthread_mutex_t lock;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { PTHREAD_MUTEX_INITIALIZER }
+#define portMUX_INITIALIZE(mux) pthread_mutex_init(&(mux)->lock, NULL)
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->lock)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->lock)
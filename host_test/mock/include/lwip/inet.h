@@ -0,0 +1,10 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdint.h>
+
+char *mock_ip4addr_ntoa_r(const uint32_t *addr, char *buf, int buflen);
+
+// lwIP takes the address in network byte order, as a u32_t
+#define inet_ntoa_r(addr, buf, buflen) mock_ip4addr_ntoa_r(&(addr), buf, buflen)
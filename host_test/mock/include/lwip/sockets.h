@@ -0,0 +1,19 @@
+#pragma once
+
+/*
+ * The sockets of the HTTP sessions are not real ones: their peer is the client given to
+ * mock_httpd_open_session(), closing them ends the session. Receiving only peeks, to find
+ * whether a request of the session waits for the server.
+ */
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int mock_getpeername(int s, struct sockaddr *name, socklen_t *namelen);
+int mock_socket_close(int s);
+ssize_t mock_recv(int s, void *mem, size_t len, int flags);
+
+#define getpeername(s, name, namelen) mock_getpeername(s, name, namelen)
+#define close(s) mock_socket_close(s)
+#define recv(s, mem, len, flags) mock_recv(s, mem, len, flags)
@@ -0,0 +1,256 @@
+#pragma once
+
+/*
+ * Control of the simulated ESP-IDF the component runs on in the host tests: time, heap, the APs around, the
+ * HTTP clients and NVS.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+
+// Size of the simulated heap, about what is left to the application on an ESP32 running Wi-Fi
+#define MOCK_HEAP_SIZE (160 * 1024)
+
+/**
+ * @brief Sets how many times faster than real time mock time runs, 1 by default or the MOCK_TIME_SCALE variable
+ */
+void mock_time_set_scale(double scale);
+
+/**
+ * @brief Microseconds of mock time since the mock started, as esp_timer_get_time()
+ */
+int64_t mock_time_now_us(void);
+
+/**
+ * @brief Sleeps the calling thread for an amount of mock time
+ */
+void mock_sleep_ms(uint32_t ms);
+
+/**
+ * @brief Seeds esp_random()
+ */
+void mock_random_seed(uint32_t seed);
+
+/**
+ * @brief Heap used by the allocations made since start
+ */
+size_t mock_heap_used(void);
+
+/**
+ * @brief Highest heap usage since the last mock_heap_reset_peak()
+ */
+size_t mock_heap_peak_used(void);
+
+/**
+ * @brief Starts measuring the peak heap usage from the current usage
+ */
+void mock_heap_reset_peak(void);
+
+/**
+ * @brief An AP around the device
+ */
+typedef struct {
+    const char *ssid;
+    const char *password;               /**<! "" for an open network */
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+    wifi_auth_mode_t authmode;
+    bool no_dhcp;                       /**<! The DHCP server never answers */
+    esp_netif_ip_info_t lease;          /**<! IP handed out by its DHCP server, 192.168.<channel>.100 if zero */
+} mock_ap_t;
+
+/**
+ * @brief Time the simulated driver takes
+ */
+typedef struct {
+    uint32_t connect_ms;                /**<! From esp_wifi_connect() to the connection or its failure */
+    uint32_t dhcp_ms;                   /**<! From the connection to the IP */
+    uint32_t scan_channel_ms;           /**<! Scanning a channel */
+} mock_wifi_timing_t;
+
+#define MOCK_WIFI_TIMING_DEFAULT() { .connect_ms = 300, .dhcp_ms = 200, .scan_channel_ms = 120 }
+
+/**
+ * @brief Counters of the calls into the driver
+ */
+typedef struct {
+    uint32_t connects;                  /**<! esp_wifi_connect() calls */
+    uint32_t connects_rejected;         /**<! Of which failed to start, e.g. while scanning */
+    uint32_t scans;                     /**<! esp_wifi_scan_start() calls */
+    uint32_t scans_rejected;            /**<! Of which failed to start, e.g. while connecting */
+    uint32_t disconnects;               /**<! esp_wifi_disconnect() calls */
+} mock_wifi_stats_t;
+
+/**
+ * @brief Removes the APs and resets the timing, counters and the scripted mode
+ */
+void mock_wifi_reset(void);
+
+/**
+ * @brief Adds an AP, returns its index
+ */
+int mock_wifi_add_ap(const mock_ap_t *ap);
+
+/**
+ * @brief Adds `count` APs on random channels with random RSSIs, SSIDs of `ssid_len` bytes, some of them shared
+ *        between several BSSs
+ */
+void mock_wifi_add_synthetic_aps(size_t count, size_t ssid_len, uint32_t seed);
+
+/**
+ * @brief Number of APs added
+ */
+size_t mock_wifi_num_aps(void);
+
+/**
+ * @brief Gets an AP, its SSID and password are valid until mock_wifi_reset()
+ */
+void mock_wifi_get_ap(int index, mock_ap_t *ap);
+
+/**
+ * @brief Moves an AP to another channel and BSSID, e.g. after a router restart
+ */
+void mock_wifi_move_ap(int index, uint8_t channel, const uint8_t bssid[6]);
+
+/**
+ * @brief Switches an AP off or on. Switching the AP the STA is connected to off disconnects it on a beacon timeout.
+ */
+void mock_wifi_set_ap_enabled(int index, bool enabled);
+
+/**
+ * @brief Sets whether the DHCP server of an AP answers
+ */
+void mock_wifi_set_ap_dhcp(int index, bool dhcp);
+
+void mock_wifi_set_timing(const mock_wifi_timing_t *timing);
+void mock_wifi_get_stats(mock_wifi_stats_t *stats);
+
+/**
+ * @brief Makes esp_wifi_scan_start() fail with an error, ESP_OK to let the scans through again
+ */
+void mock_wifi_set_scan_error(esp_err_t err);
+
+/**
+ * @brief Gets the STA configuration last set, e.g. to check which BSS the STA was pointed at
+ */
+void mock_wifi_get_sta_config(wifi_sta_config_t *config);
+
+/**
+ * @brief Whether the STA is associated
+ */
+bool mock_wifi_sta_connected(void);
+
+/**
+ * @brief In scripted mode, the driver only counts the calls, and the events come from mock_wifi_play_trace()
+ */
+void mock_wifi_set_scripted(bool scripted);
+
+/**
+ * @brief Checks an expectation of a trace, see mock_wifi_play_trace()
+ *
+ * @param expectation Rest of the EXPECT line, e.g. "state=backoff connects=2"
+ * @param arg Argument passed to mock_wifi_play_trace()
+ * @return Whether the expectation holds
+ */
+typedef bool (*mock_trace_expect_t)(const char *expectation, void *arg);
+
+/**
+ * @brief Posts the events of a trace to the default event loop, at the times it gives
+ *
+ * A trace holds one event per line, "<delay_ms> <event> [key=value...]", the delay counting from the previous
+ * line, e.g. "120 STA_DISCONNECTED reason=200". '#' starts a comment. The events are STA_START, SCAN_DONE
+ * (number), STA_CONNECTED (ssid, channel), STA_DISCONNECTED (reason), BEACON_TIMEOUT, HOME_CHANNEL_CHANGE
+ * (old, new) and GOT_IP (ip). An EXPECT line is checked by `expect` instead.
+ *
+ * @param path Trace file
+ * @param expect Checks the EXPECT lines
+ * @param arg Argument passed to `expect`
+ * @return ESP_OK once every line was played, ESP_ERR_NOT_FOUND if the file cannot be read, ESP_ERR_INVALID_ARG
+ *         on a malformed line, ESP_FAIL if an expectation does not hold
+ */
+esp_err_t mock_wifi_play_trace(const char *path, mock_trace_expect_t expect, void *arg);
+
+/**
+ * @brief Whether the DHCP client of the STA runs
+ */
+bool mock_netif_sta_dhcpc_running(void);
+
+/**
+ * @brief IP of the STA, in network byte order, 0 if none
+ */
+uint32_t mock_netif_sta_ip(void);
+
+/**
+ * @brief Response captured by mock_httpd_request()
+ */
+typedef struct {
+    int status;                         /**<! Status code */
+    char content_type[64];
+    char headers[512];                  /**<! Other headers, "Name: value\r\n" each */
+    char *body;                         /**<! Body, NUL terminated, chunks joined */
+    size_t body_len;
+    bool chunked;
+    bool closed;                        /**<! The session was closed after the request */
+} mock_http_response_t;
+
+/**
+ * @brief Whether the HTTP server runs
+ */
+bool mock_httpd_running(void);
+
+/**
+ * @brief Opens a session of a client, as the server accepting a connection does
+ *
+ * @param client_ip IPv4 address of the client, in network byte order
+ * @return Socket of the session, -1 if the server is not running or refused it
+ */
+int mock_httpd_open_session(uint32_t client_ip);
+
+/**
+ * @brief Whether a session is open, it may have been closed by the server since
+ */
+bool mock_httpd_session_is_open(int sockfd);
+
+/**
+ * @brief Closes a session from the client side
+ */
+void mock_httpd_close_session(int sockfd);
+
+/**
+ * @brief Handles a request on a session, as the httpd task does: one request at a time, whatever the session
+ *
+ * @param sockfd Session
+ * @param method HTTP_GET or HTTP_POST
+ * @param uri URI, with its query if any
+ * @param headers Request headers, "Name: value\r\n" each, NULL for none
+ * @param body Body of a POST, NULL for none
+ * @param[out] resp Response, to free with mock_http_response_free()
+ * @return ESP_OK if the handler succeeded, ESP_ERR_INVALID_STATE if the session is not open, or the error
+ *         returned by the handler, after which the session is closed
+ */
+esp_err_t mock_httpd_request(int sockfd, httpd_method_t method, const char *uri, const char *headers,
+                             const char *body, mock_http_response_t *resp);
+
+void mock_http_response_free(mock_http_response_t *resp);
+
+/**
+ * @brief Empties NVS
+ */
+void mock_nvs_erase(void);
+
+/**
+ * @brief Number of commits to NVS
+ */
+uint32_t mock_nvs_commits(void);
+
+/**
+ * @brief Whether the DNS server runs
+ */
+bool mock_dns_server_running(void);
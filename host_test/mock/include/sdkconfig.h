@@ -0,0 +1,27 @@
+#pragma once
+
+// Kconfig defaults of the component, and the options of other components it reads
+#define CONFIG_ESPNOW_CHANNEL 1
+#define CONFIG_LWIP_MAX_SOCKETS 10
+#define CONFIG_WL_SCAN_LIST_SIZE 100
+#define CONFIG_WL_SCAN_CACHE_MAX_AGE_MS 15000
+#define CONFIG_WL_SCAN_API_MAX_APS 20
+#define CONFIG_WL_MESH_CHANNEL_RSSI_MARGIN 10
+#define CONFIG_WL_STORE_MAX_NETWORKS 5
+#define CONFIG_WL_CONNECT_TIMEOUT_MS 8000
+#define CONFIG_WL_RECONNECT_BASE_MS 500
+#define CONFIG_WL_RECONNECT_MAX_MS 60000
+#define CONFIG_WL_RECONNECT_AUTH_RETRIES 3
+#define CONFIG_WL_FAST_BOOT_TIMEOUT_MS 3000
+#define CONFIG_WL_FAST_BOOT_DHCP_TIMEOUT_MS 2000
+#define CONFIG_WL_LEASE_DHCP_RETRY_MS 30000
+#define CONFIG_WL_PROV_MAX_CLIENTS 2
+#define CONFIG_WL_PROV_SOCKETS_PER_CLIENT 2
+#define CONFIG_WL_DNS_RATE_LIMIT_QPS 20
+#define CONFIG_WL_DNS_RATE_LIMIT_BURST 40
+#define CONFIG_WL_EVENT_NAMES 1
+#define CONFIG_WL_TIMING_HISTORY_SIZE 32
+#define CONFIG_WL_HTTP_METRICS 1
+#ifndef CONFIG_WL_HEAP_BUDGET
+#define CONFIG_WL_HEAP_BUDGET 0
+#endif
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+
+#include "mock_internal.h"
+
+// Default event loop: a thread running the handlers of the posted events, in order
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+#define MAX_HANDLERS 16
+
+typedef struct posted_event {
+    esp_event_base_t base;
+    int32_t id;
+    struct posted_event *next;
+    size_t data_size;
+    uint8_t data[];
+} posted_event_t;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} handler_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond;
+static pthread_t s_thread;
+static bool s_running;
+static bool s_stopping;
+static posted_event_t *s_head;
+static posted_event_t *s_tail;
+// Slots are never moved, an instance is a pointer to its slot
+static handler_t s_handlers[MAX_HANDLERS];
+
+static void dispatch(const posted_event_t *event)
+{
+    handler_t matching[MAX_HANDLERS];
+    size_t count = 0;
+    pthread_mutex_lock(&s_lock);
+    for (size_t i = 0; i < MAX_HANDLERS; i++) {
+        if (s_handlers[i].handler && s_handlers[i].base == event->base &&
+            (s_handlers[i].id == ESP_EVENT_ANY_ID || s_handlers[i].id == event->id)) {
+            matching[count++] = s_handlers[i];
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+
+    if (event->base == WIFI_EVENT) {
+        mock_wifi_on_event(event->id, event->data_size ? event->data : NULL);
+    }
+    for (size_t i = 0; i < count; i++) {
+        matching[i].handler(matching[i].arg, event->base, event->id, event->data_size ? (void *)event->data : NULL);
+    }
+}
+
+static void *event_loop_task(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    while (!s_stopping) {
+        posted_event_t *event = s_head;
+        if (!event) {
+            pthread_cond_wait(&s_cond, &s_lock);
+            continue;
+        }
+        s_head = event->next;
+        if (!s_head) {
+            s_tail = NULL;
+        }
+        pthread_mutex_unlock(&s_lock);
+        dispatch(event);
+        free(event);
+        pthread_mutex_lock(&s_lock);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return NULL;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_running) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    mock_cond_init(&s_cond);
+    s_stopping = false;
+    s_running = pthread_create(&s_thread, NULL, event_loop_task, NULL) == 0;
+    pthread_mutex_unlock(&s_lock);
+    return s_running ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_event_loop_delete_default(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_running) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_stopping = true;
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+    pthread_join(s_thread, NULL);
+
+    // The events left are dropped, and the handlers unregistered along with the loop
+    pthread_mutex_lock(&s_lock);
+    while (s_head) {
+        posted_event_t *event = s_head;
+        s_head = event->next;
+        free(event);
+    }
+    s_tail = NULL;
+    memset(s_handlers, 0, sizeof(s_handlers));
+    s_running = false;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+                                              esp_event_handler_t event_handler, void *event_handler_arg,
+                                              esp_event_handler_instance_t *instance)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_running) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (size_t i = 0; i < MAX_HANDLERS; i++) {
+        if (!s_handlers[i].handler) {
+            s_handlers[i] = (handler_t) {
+                .base = event_base,
+                .id = event_id,
+                .handler = event_handler,
+                .arg = event_handler_arg,
+            };
+            if (instance) {
+                *instance = &s_handlers[i];
+            }
+            pthread_mutex_unlock(&s_lock);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t event_base, int32_t event_id,
+                                                esp_event_handler_instance_t instance)
+{
+    handler_t *slot = instance;
+    pthread_mutex_lock(&s_lock);
+    if (!slot || slot->base != event_base || slot->id != event_id) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(slot, 0, sizeof(*slot));
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data,
+                         size_t event_data_size, TickType_t ticks_to_wait)
+{
+    posted_event_t *event = malloc(sizeof(*event) + event_data_size);
+    if (!event) {
+        return ESP_ERR_NO_MEM;
+    }
+    event->base = event_base;
+    event->id = event_id;
+    event->next = NULL;
+    event->data_size = event_data ? event_data_size : 0;
+    if (event->data_size) {
+        memcpy(event->data, event_data, event_data_size);
+    }
+
+    pthread_mutex_lock(&s_lock);
+    if (!s_running || s_stopping) {
+        pthread_mutex_unlock(&s_lock);
+        free(event);
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (s_tail) {
+        s_tail->next = event;
+    } else {
+        s_head = event;
+    }
+    s_tail = event;
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,419 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "mock.h"
+#include "mock_internal.h"
+
+// Mock time runs s_scale times faster than the monotonic clock, from s_offset_us at s_origin
+static pthread_mutex_t s_time_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec s_origin;
+static int64_t s_offset_us;
+static double s_scale = 1;
+
+static int64_t timespec_us(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000LL + ts->tv_nsec / 1000;
+}
+
+__attribute__((constructor)) static void time_init(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &s_origin);
+    const char *scale = getenv("MOCK_TIME_SCALE");
+    if (scale && atof(scale) > 0) {
+        s_scale = atof(scale);
+    }
+}
+
+void mock_time_set_scale(double scale)
+{
+    if (getenv("MOCK_TIME_SCALE") || scale <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&s_time_lock);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    s_offset_us += (timespec_us(&now) - timespec_us(&s_origin)) * s_scale;
+    s_origin = now;
+    s_scale = scale;
+    pthread_mutex_unlock(&s_time_lock);
+}
+
+int64_t mock_time_now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&s_time_lock);
+    int64_t us = s_offset_us + (int64_t)((timespec_us(&now) - timespec_us(&s_origin)) * s_scale);
+    pthread_mutex_unlock(&s_time_lock);
+    return us;
+}
+
+void mock_deadline_at(int64_t at_us, struct timespec *deadline)
+{
+    int64_t left_us = at_us - mock_time_now_us();
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    if (left_us > 0) {
+        pthread_mutex_lock(&s_time_lock);
+        int64_t real_ns = (int64_t)(left_us * 1000 / s_scale);
+        pthread_mutex_unlock(&s_time_lock);
+        deadline->tv_sec += real_ns / 1000000000;
+        deadline->tv_nsec += real_ns % 1000000000;
+        if (deadline->tv_nsec >= 1000000000) {
+            deadline->tv_sec++;
+            deadline->tv_nsec -= 1000000000;
+        }
+    }
+}
+
+bool mock_deadline(TickType_t ticks, struct timespec *deadline)
+{
+    if (ticks == portMAX_DELAY) {
+        return false;
+    }
+    mock_deadline_at(mock_time_now_us() + (int64_t)ticks * 1000 * portTICK_PERIOD_MS, deadline);
+    return true;
+}
+
+void mock_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+bool mock_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline)
+{
+    if (!deadline) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+void mock_sleep_ms(uint32_t ms)
+{
+    struct timespec deadline;
+    mock_deadline(pdMS_TO_TICKS(ms), &deadline);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+// Tasks
+
+struct tskTaskControlBlock {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *arg;
+    char name[16];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notified;
+    bool created;           // by xTaskCreate, rather than a thread of the host
+};
+
+static __thread struct tskTaskControlBlock *s_current;
+static __thread struct tskTaskControlBlock s_host_task;
+
+static void tcb_init(struct tskTaskControlBlock *tcb)
+{
+    pthread_mutex_init(&tcb->lock, NULL);
+    mock_cond_init(&tcb->cond);
+    tcb->notified = 0;
+}
+
+static void *task_main(void *arg)
+{
+    s_current = arg;
+    s_current->code(s_current->arg);
+    fprintf(stderr, "Task %s returned without deleting itself\n", s_current->name);
+    abort();
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    struct tskTaskControlBlock *tcb = calloc(1, sizeof(*tcb));
+    if (!tcb) {
+        return pdFAIL;
+    }
+    tcb_init(tcb);
+    tcb->code = task_code;
+    tcb->arg = arg;
+    tcb->created = true;
+    snprintf(tcb->name, sizeof(tcb->name), "%s", name);
+    if (created_task) {
+        *created_task = tcb;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&tcb->thread, &attr, task_main, tcb);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(tcb);
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!s_current) {
+        tcb_init(&s_host_task);
+        s_host_task.thread = pthread_self();
+        snprintf(s_host_task.name, sizeof(s_host_task.name), "host");
+        s_current = &s_host_task;
+    }
+    return s_current;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (!task || task == s_current) {
+        struct tskTaskControlBlock *self = s_current;
+        if (self && self->created) {
+            pthread_mutex_destroy(&self->lock);
+            pthread_cond_destroy(&self->cond);
+            free(self);
+        }
+        s_current = NULL;
+        pthread_exit(NULL);
+    }
+    // The control block is leaked, the task may still be running until its next blocking call
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    mock_sleep_ms(ticks * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return mock_time_now_us() / 1000 / portTICK_PERIOD_MS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notified++;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    struct tskTaskControlBlock *self = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    bool timed = mock_deadline(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&self->lock);
+    while (self->notified == 0 && ticks_to_wait > 0 && mock_cond_wait(&self->cond, &self->lock, timed ? &deadline : NULL)) {
+    }
+    uint32_t value = self->notified;
+    if (value > 0) {
+        self->notified = clear_on_exit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return value;
+}
+
+// Event groups
+
+struct EventGroupDef_t {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct EventGroupDef_t *group = calloc(1, sizeof(*group));
+    if (group) {
+        pthread_mutex_init(&group->lock, NULL);
+        mock_cond_init(&group->cond);
+    }
+    return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    if (group) {
+        pthread_mutex_destroy(&group->lock);
+        pthread_cond_destroy(&group->cond);
+        free(group);
+    }
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    bool timed = mock_deadline(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&group->lock);
+    while (true) {
+        EventBits_t set = group->bits & bits;
+        if (wait_for_all ? set == bits : set != 0) {
+            EventBits_t value = group->bits;
+            if (clear_on_exit) {
+                group->bits &= ~bits;
+            }
+            pthread_mutex_unlock(&group->lock);
+            return value;
+        }
+        if (ticks_to_wait == 0 || !mock_cond_wait(&group->cond, &group->lock, timed ? &deadline : NULL)) {
+            break;
+        }
+    }
+    EventBits_t value = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t value = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+// Queues, of which semaphores are the ones with items of no size
+
+struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t items[];
+};
+
+static QueueHandle_t queue_create(UBaseType_t length, UBaseType_t item_size, UBaseType_t count)
+{
+    struct QueueDefinition *queue = calloc(1, sizeof(*queue) + (size_t)length * item_size);
+    if (queue) {
+        pthread_mutex_init(&queue->lock, NULL);
+        mock_cond_init(&queue->cond);
+        queue->length = length;
+        queue->item_size = item_size;
+        queue->count = count;
+    }
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    return queue_create(length, item_size, 0);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue) {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->cond);
+        free(queue);
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    bool timed = mock_deadline(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (ticks_to_wait == 0 || !mock_cond_wait(&queue->cond, &queue->lock, timed ? &deadline : NULL)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    if (item && queue->item_size > 0) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + (size_t)tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline;
+    bool timed = mock_deadline(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (ticks_to_wait == 0 || !mock_cond_wait(&queue->cond, &queue->lock, timed ? &deadline : NULL)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size > 0) {
+        memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+    }
+    queue->count--;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return queue_create(1, 0, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return queue_create(1, 0, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    return xQueueReceive(semaphore, NULL, ticks_to_wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xQueueSend(semaphore, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    vQueueDelete(semaphore);
+}
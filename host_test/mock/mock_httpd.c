@@ -0,0 +1,630 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "esp_http_server.h"
+#include "lwip/sockets.h"
+
+#include "mock.h"
+#include "mock_internal.h"
+
+// HTTP server without sockets: the clients are threads calling mock_httpd_request(), which runs the handlers one
+// at a time like the httpd task. The closes triggered meanwhile take effect once the request is handled, as the
+// httpd task only processes them between requests.
+
+// First socket number, as LWIP_SOCKET_OFFSET
+#define SOCKET_OFFSET 54
+#define MAX_SOCKETS 64
+
+typedef struct {
+    int fd;                 // -1 if the slot is free
+    uint32_t client_ip;
+    uint32_t lru;           // the lower the less recently used
+    uint32_t pending;       // requests of the client waiting for the server
+    bool busy;              // a request of the session is being handled
+    bool close_pending;     // httpd_sess_trigger_close() was called
+} session_t;
+
+typedef struct {
+    httpd_config_t config;
+    httpd_uri_t *uris;
+    size_t num_uris;
+    httpd_err_handler_func_t err_handlers[HTTPD_ERR_CODE_MAX];
+    session_t *sessions;
+    uint32_t lru_counter;
+} server_t;
+
+// Request in progress, httpd_req_t first so handlers can be given it
+typedef struct {
+    httpd_req_t req;
+    session_t *session;
+    const char *headers;
+    const char *body;
+    size_t body_read;
+    const char *status;
+    const char *type;
+    size_t num_resp_headers;
+    mock_http_response_t *resp;
+    size_t body_size;       // room in resp->body
+    bool sent;
+} request_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+// Held while a request is handled, the single httpd task
+static pthread_mutex_t s_task_lock = PTHREAD_MUTEX_INITIALIZER;
+static server_t *s_server;
+// Client address of each socket, 0 if the socket is closed
+static uint32_t s_sockets[MAX_SOCKETS];
+
+static const struct {
+    const char *status;
+    const char *msg;
+} s_errors[HTTPD_ERR_CODE_MAX] = {
+    [HTTPD_500_INTERNAL_SERVER_ERROR] = { "500 Internal Server Error", "Server has encountered an unexpected error" },
+    [HTTPD_501_METHOD_NOT_IMPLEMENTED] = { "501 Method Not Implemented", "Server does not support this method" },
+    [HTTPD_505_VERSION_NOT_SUPPORTED] = { "505 Version Not Supported", "HTTP version not supported by server" },
+    [HTTPD_400_BAD_REQUEST] = { "400 Bad Request", "Bad request syntax" },
+    [HTTPD_401_UNAUTHORIZED] = { "401 Unauthorized", "No permission -- see authorization schemes" },
+    [HTTPD_403_FORBIDDEN] = { "403 Forbidden", "Request forbidden -- authorization will not help" },
+    [HTTPD_404_NOT_FOUND] = { "404 Not Found", "This URI does not exist" },
+    [HTTPD_405_METHOD_NOT_ALLOWED] = { "405 Method Not Allowed", "Request method for this URI is not handled by server" },
+    [HTTPD_408_REQ_TIMEOUT] = { "408 Request Timeout", "Server closed this connection" },
+    [HTTPD_411_LENGTH_REQUIRED] = { "411 Length Required", "Chunked encoding not supported by server" },
+    [HTTPD_414_URI_TOO_LONG] = { "414 URI Too Long", "URI is too long" },
+    [HTTPD_431_REQ_HDR_FIELDS_TOO_LARGE] = { "431 Request Header Fields Too Large", "Header fields are too long" },
+};
+
+static session_t *find_session(int sockfd)
+{
+    for (size_t i = 0; s_server && i < s_server->config.max_open_sockets; i++) {
+        if (s_server->sessions[i].fd == sockfd) {
+            return &s_server->sessions[i];
+        }
+    }
+    return NULL;
+}
+
+// Sockets
+
+char *mock_ip4addr_ntoa_r(const uint32_t *addr, char *buf, int buflen)
+{
+    const uint8_t *bytes = (const uint8_t *)addr;
+    snprintf(buf, buflen, "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return buf;
+}
+
+int mock_getpeername(int s, struct sockaddr *name, socklen_t *namelen)
+{
+    pthread_mutex_lock(&s_lock);
+    uint32_t client_ip = s >= SOCKET_OFFSET && s < SOCKET_OFFSET + MAX_SOCKETS ? s_sockets[s - SOCKET_OFFSET] : 0;
+    pthread_mutex_unlock(&s_lock);
+    if (client_ip == 0 || *namelen < sizeof(struct sockaddr_in)) {
+        return -1;
+    }
+    struct sockaddr_in *addr = (struct sockaddr_in *)name;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(49152 + s);
+    addr->sin_addr.s_addr = client_ip;
+    *namelen = sizeof(*addr);
+    return 0;
+}
+
+ssize_t mock_recv(int s, void *mem, size_t len, int flags)
+{
+    pthread_mutex_lock(&s_lock);
+    session_t *session = find_session(s);
+    bool waiting = session && session->pending > 0;
+    pthread_mutex_unlock(&s_lock);
+    if (!session || !(flags & MSG_PEEK)) {
+        errno = EBADF;
+        return -1;
+    }
+    if (!waiting) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (len > 0) {
+        memcpy(mem, "G", 1);
+    }
+    return len > 0;
+}
+
+int mock_socket_close(int s)
+{
+    pthread_mutex_lock(&s_lock);
+    bool open = s >= SOCKET_OFFSET && s < SOCKET_OFFSET + MAX_SOCKETS && s_sockets[s - SOCKET_OFFSET] != 0;
+    if (open) {
+        s_sockets[s - SOCKET_OFFSET] = 0;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return open ? 0 : -1;
+}
+
+
+// Sessions
+
+// Closes a session, must be called with the lock held, which the close function is called without
+static void close_session(session_t *session)
+{
+    int fd = session->fd;
+    httpd_close_func_t close_fn = s_server->config.close_fn;
+    session->fd = -1;
+    session->close_pending = false;
+    pthread_mutex_unlock(&s_lock);
+    if (close_fn) {
+        close_fn(s_server, fd);
+    } else {
+        close(fd);
+    }
+    pthread_mutex_lock(&s_lock);
+}
+
+// Runs the closes triggered while the server was busy, must be called with the lock held
+static void process_pending_closes(void)
+{
+    for (size_t i = 0; s_server && i < s_server->config.max_open_sockets; i++) {
+        session_t *session = &s_server->sessions[i];
+        if (session->fd >= 0 && session->close_pending && !session->busy) {
+            close_session(session);
+        }
+    }
+}
+
+bool mock_httpd_running(void)
+{
+    pthread_mutex_lock(&s_lock);
+    bool running = s_server != NULL;
+    pthread_mutex_unlock(&s_lock);
+    return running;
+}
+
+int mock_httpd_open_session(uint32_t client_ip)
+{
+    pthread_mutex_lock(&s_task_lock);
+    pthread_mutex_lock(&s_lock);
+    int fd = -1;
+    for (int i = 0; s_server && i < MAX_SOCKETS; i++) {
+        if (s_sockets[i] == 0) {
+            fd = SOCKET_OFFSET + i;
+            s_sockets[i] = client_ip;
+            break;
+        }
+    }
+    session_t *slot = NULL;
+    if (fd >= 0) {
+        session_t *lru = NULL;
+        for (size_t i = 0; i < s_server->config.max_open_sockets; i++) {
+            session_t *session = &s_server->sessions[i];
+            if (session->fd < 0) {
+                slot = slot ? slot : session;
+            } else if (!lru || session->lru < lru->lru) {
+                lru = session;
+            }
+        }
+        if (!slot && s_server->config.lru_purge_enable && lru) {
+            close_session(lru);
+            slot = lru;
+        }
+        if (!slot) {
+            s_sockets[fd - SOCKET_OFFSET] = 0;
+            fd = -1;
+        }
+    }
+    if (slot) {
+        *slot = (session_t) { .fd = fd, .client_ip = client_ip, .lru = ++s_server->lru_counter };
+        httpd_open_func_t open_fn = s_server->config.open_fn;
+        pthread_mutex_unlock(&s_lock);
+        esp_err_t err = open_fn ? open_fn(s_server, fd) : ESP_OK;
+        pthread_mutex_lock(&s_lock);
+        if (err != ESP_OK) {
+            close_session(slot);
+            fd = -1;
+        }
+        process_pending_closes();
+    }
+    pthread_mutex_unlock(&s_lock);
+    pthread_mutex_unlock(&s_task_lock);
+    return fd;
+}
+
+bool mock_httpd_session_is_open(int sockfd)
+{
+    pthread_mutex_lock(&s_lock);
+    bool open = find_session(sockfd) != NULL;
+    pthread_mutex_unlock(&s_lock);
+    return open;
+}
+
+void mock_httpd_close_session(int sockfd)
+{
+    pthread_mutex_lock(&s_task_lock);
+    pthread_mutex_lock(&s_lock);
+    session_t *session = find_session(sockfd);
+    if (session) {
+        close_session(session);
+    }
+    pthread_mutex_unlock(&s_lock);
+    pthread_mutex_unlock(&s_task_lock);
+}
+
+// Server
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_server) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_HTTPD_TASK;
+    }
+    // As the real server, its tables are on the heap
+    server_t *server = calloc(1, sizeof(server_t));
+    if (server) {
+        server->config = *config;
+        server->uris = calloc(config->max_uri_handlers, sizeof(httpd_uri_t));
+        server->sessions = calloc(config->max_open_sockets, sizeof(session_t));
+    }
+    if (!server || !server->uris || !server->sessions) {
+        pthread_mutex_unlock(&s_lock);
+        if (server) {
+            free(server->uris);
+            free(server->sessions);
+            free(server);
+        }
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    for (size_t i = 0; i < config->max_open_sockets; i++) {
+        server->sessions[i].fd = -1;
+    }
+    s_server = server;
+    *handle = server;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    pthread_mutex_lock(&s_task_lock);
+    pthread_mutex_lock(&s_lock);
+    if (!handle || handle != s_server) {
+        pthread_mutex_unlock(&s_lock);
+        pthread_mutex_unlock(&s_task_lock);
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < s_server->config.max_open_sockets; i++) {
+        if (s_server->sessions[i].fd >= 0) {
+            close_session(&s_server->sessions[i]);
+        }
+    }
+    free(s_server->uris);
+    free(s_server->sessions);
+    free(s_server);
+    s_server = NULL;
+    pthread_mutex_unlock(&s_lock);
+    pthread_mutex_unlock(&s_task_lock);
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    server_t *server = handle;
+    if (!server || !uri_handler) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t i = 0; i < server->num_uris; i++) {
+        if (server->uris[i].method == uri_handler->method && strcmp(server->uris[i].uri, uri_handler->uri) == 0) {
+            return ESP_ERR_HTTPD_HANDLER_EXISTS;
+        }
+    }
+    if (server->num_uris == server->config.max_uri_handlers) {
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+    }
+    server->uris[server->num_uris++] = *uri_handler;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_err_handler(httpd_handle_t handle, httpd_err_code_t error,
+                                     httpd_err_handler_func_t handler_fn)
+{
+    server_t *server = handle;
+    if (!server || error >= HTTPD_ERR_CODE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    server->err_handlers[error] = handler_fn;
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    pthread_mutex_lock(&s_lock);
+    session_t *session = handle == s_server ? find_session(sockfd) : NULL;
+    if (session) {
+        session->close_pending = true;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return session ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return ((request_t *)r)->session->fd;
+}
+
+// Requests
+
+static void body_append(request_t *request, const char *data, size_t len)
+{
+    mock_http_response_t *resp = request->resp;
+    if (resp->body_len + len + 1 > request->body_size) {
+        request->body_size = (resp->body_len + len + 1) * 2;
+        resp->body = __real_realloc(resp->body, request->body_size);
+    }
+    memcpy(resp->body + resp->body_len, data, len);
+    resp->body_len += len;
+    resp->body[resp->body_len] = '\0';
+}
+
+static void headers_append(mock_http_response_t *resp, const char *field, const char *value)
+{
+    size_t len = strlen(resp->headers);
+    snprintf(resp->headers + len, sizeof(resp->headers) - len, "%s: %s\r\n", field, value);
+}
+
+// Status line and headers of the response, sent with its first part
+static void send_head(request_t *request)
+{
+    if (!request->sent) {
+        request->sent = true;
+        request->resp->status = atoi(request->status);
+        snprintf(request->resp->content_type, sizeof(request->resp->content_type), "%s", request->type);
+    }
+}
+
+static const char *header_value(const char *headers, const char *field, size_t *len)
+{
+    size_t field_len = strlen(field);
+    for (const char *line = headers; line && *line; line = strstr(line, "\r\n"), line = line ? line + 2 : NULL) {
+        if (strncasecmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            const char *value = line + field_len + 1;
+            value += strspn(value, " ");
+            *len = strcspn(value, "\r\n");
+            return value;
+        }
+    }
+    return NULL;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    request_t *request = (request_t *)r;
+    size_t left = r->content_len - request->body_read;
+    size_t len = buf_len < left ? buf_len : left;
+    memcpy(buf, request->body + request->body_read, len);
+    request->body_read += len;
+    return len;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    size_t len = 0;
+    return header_value(((request_t *)r)->headers, field, &len) ? len : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    size_t len;
+    const char *value = header_value(((request_t *)r)->headers, field, &len);
+    if (!value) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(val, val_size, "%.*s", (int)len, value);
+    return len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r)
+{
+    const char *query = strchr(r->uri, '?');
+    return query ? strlen(query + 1) : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *query = strchr(r->uri, '?');
+    if (!query) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(buf, buf_len, "%s", query + 1);
+    return strlen(query + 1) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+    for (const char *pair = qry; pair; pair = strchr(pair, '&'), pair = pair ? pair + 1 : NULL) {
+        if (strncmp(pair, key, key_len) == 0 && pair[key_len] == '=') {
+            const char *value = pair + key_len + 1;
+            size_t len = strcspn(value, "&");
+            snprintf(val, val_size, "%.*s", (int)len, value);
+            return len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    ((request_t *)r)->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((request_t *)r)->type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    request_t *request = (request_t *)r;
+    if (request->num_resp_headers == s_server->config.max_resp_headers) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    request->num_resp_headers++;
+    headers_append(request->resp, field, value);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    request_t *request = (request_t *)r;
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    send_head(request);
+    body_append(request, buf ? buf : "", buf_len);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    request_t *request = (request_t *)r;
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = buf ? strlen(buf) : 0;
+    }
+    send_head(request);
+    request->resp->chunked = true;
+    if (buf && buf_len > 0) {
+        body_append(request, buf, buf_len);
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    request_t *request = (request_t *)req;
+    request->status = s_errors[error].status;
+    request->type = "text/html";
+    return httpd_resp_send(req, msg ? msg : s_errors[error].msg, HTTPD_RESP_USE_STRLEN);
+}
+
+// Sends raw bytes, which must form the whole response here
+int httpd_send(httpd_req_t *r, const char *buf, size_t buf_len)
+{
+    request_t *request = (request_t *)r;
+    mock_http_response_t *resp = request->resp;
+    const char *end = buf + buf_len;
+    const char *head_end = memmem(buf, buf_len, "\r\n\r\n", 4);
+    if (request->sent || buf_len < 12 || strncmp(buf, "HTTP/1.1 ", 9) != 0 || !head_end) {
+        return -1;
+    }
+    request->sent = true;
+    resp->status = atoi(buf + 9);
+    for (const char *line = strstr(buf, "\r\n") + 2; line < head_end; line = strstr(line, "\r\n") + 2) {
+        size_t len = strstr(line, "\r\n") - line;
+        if (strncasecmp(line, "Content-Type:", 13) == 0) {
+            snprintf(resp->content_type, sizeof(resp->content_type), "%.*s", (int)(len - 14), line + 14);
+        } else if (strncasecmp(line, "Content-Length:", 15) != 0) {
+            size_t used = strlen(resp->headers);
+            snprintf(resp->headers + used, sizeof(resp->headers) - used, "%.*s\r\n", (int)len, line);
+        }
+    }
+    body_append(request, head_end + 4, end - head_end - 4);
+    return buf_len;
+}
+
+static const httpd_uri_t *find_uri(const char *uri, httpd_method_t method, bool *other_method)
+{
+    size_t len = strcspn(uri, "?");
+    *other_method = false;
+    for (size_t i = 0; i < s_server->num_uris; i++) {
+        if (strlen(s_server->uris[i].uri) == len && strncmp(s_server->uris[i].uri, uri, len) == 0) {
+            if (s_server->uris[i].method == method) {
+                return &s_server->uris[i];
+            }
+            *other_method = true;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t mock_httpd_request(int sockfd, httpd_method_t method, const char *uri, const char *headers,
+                             const char *body, mock_http_response_t *resp)
+{
+    memset(resp, 0, sizeof(*resp));
+    resp->body = __real_calloc(1, 1);
+
+    pthread_mutex_lock(&s_lock);
+    session_t *session = find_session(sockfd);
+    if (session) {
+        session->pending++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    if (!session) {
+        resp->closed = true;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Waits for the server to get to the request
+    pthread_mutex_lock(&s_task_lock);
+    pthread_mutex_lock(&s_lock);
+    session->pending--;
+    if (session->fd != sockfd) {
+        // Closed meanwhile, the client sees the connection reset
+        pthread_mutex_unlock(&s_lock);
+        pthread_mutex_unlock(&s_task_lock);
+        resp->closed = true;
+        return ESP_ERR_INVALID_STATE;
+    }
+    session->busy = true;
+    session->lru = ++s_server->lru_counter;
+    pthread_mutex_unlock(&s_lock);
+
+    request_t *request = __real_calloc(1, sizeof(request_t));
+    request->req.handle = s_server;
+    request->req.method = method;
+    snprintf((char *)request->req.uri, sizeof(request->req.uri), "%s", uri);
+    request->req.content_len = body ? strlen(body) : 0;
+    request->session = session;
+    request->headers = headers ? headers : "";
+    request->body = body;
+    request->status = "200 OK";
+    request->type = "text/html";
+    request->resp = resp;
+    request->body_size = 1;
+
+    bool other_method;
+    const httpd_uri_t *handler = find_uri(uri, method, &other_method);
+    esp_err_t err;
+    if (handler) {
+        request->req.user_ctx = handler->user_ctx;
+        err = handler->handler(&request->req);
+    } else {
+        httpd_err_code_t error = other_method ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND;
+        err = s_server->err_handlers[error] ? s_server->err_handlers[error](&request->req, error)
+                                            : httpd_resp_send_err(&request->req, error, NULL);
+    }
+    __real_free(request);
+
+    pthread_mutex_lock(&s_lock);
+    session->busy = false;
+    // The server closes the session of a failed handler
+    if (err != ESP_OK) {
+        session->close_pending = true;
+    }
+    process_pending_closes();
+    resp->closed = session->fd != sockfd;
+    pthread_mutex_unlock(&s_lock);
+    pthread_mutex_unlock(&s_task_lock);
+    return err;
+}
+
+void mock_http_response_free(mock_http_response_t *resp)
+{
+    __real_free(resp->body);
+    resp->body = NULL;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Shared by the mock sources only
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Allocations of the mock itself, e.g. the captured responses, which the device does not make
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/**
+ * @brief Initializes a condition variable waiting on the monotonic clock, as mock_deadline() computes
+ */
+void mock_cond_init(pthread_cond_t *cond);
+
+/**
+ * @brief Real time deadline `ticks` of mock time from now
+ *
+ * @return false for portMAX_DELAY, which never expires
+ */
+bool mock_deadline(TickType_t ticks, struct timespec *deadline);
+
+/**
+ * @brief Waits on a condition variable until the deadline, NULL for none
+ *
+ * @return false once the deadline passed
+ */
+bool mock_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline);
+
+/**
+ * @brief Real time deadline of the mock time `at_us`
+ */
+void mock_deadline_at(int64_t at_us, struct timespec *deadline);
+
+/**
+ * @brief Called by the event loop for each Wi-Fi event posted, so a scripted trace keeps the STA state in step
+ */
+void mock_wifi_on_event(int32_t event_id, const void *event_data);
@@ -0,0 +1,501 @@
+#include <errno.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_server.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "mock.h"
+#include "mock_internal.h"
+
+// Logging, errors, random numbers, the heap, NVS and the DNS server
+
+// Logging
+
+#define MAX_LOG_TAGS 16
+
+static pthread_mutex_t s_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static esp_log_level_t s_log_default = ESP_LOG_WARN;
+static struct {
+    const char *tag;
+    esp_log_level_t level;
+} s_log_tags[MAX_LOG_TAGS];
+
+__attribute__((constructor)) static void log_init(void)
+{
+    const char *level = getenv("MOCK_LOG_LEVEL");
+    if (level) {
+        s_log_default = atoi(level);
+    }
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    pthread_mutex_lock(&s_log_lock);
+    if (strcmp(tag, "*") == 0) {
+        s_log_default = level;
+    } else {
+        for (size_t i = 0; i < MAX_LOG_TAGS; i++) {
+            if (!s_log_tags[i].tag || strcmp(s_log_tags[i].tag, tag) == 0) {
+                s_log_tags[i].tag = tag;
+                s_log_tags[i].level = level;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_log_lock);
+}
+
+void mock_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    pthread_mutex_lock(&s_log_lock);
+    esp_log_level_t max_level = s_log_default;
+    for (size_t i = 0; i < MAX_LOG_TAGS && s_log_tags[i].tag; i++) {
+        if (strcmp(s_log_tags[i].tag, tag) == 0) {
+            max_level = s_log_tags[i].level;
+        }
+    }
+    if (level <= max_level) {
+        va_list args;
+        va_start(args, format);
+        fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(mock_time_now_us() / 1000), tag);
+        vfprintf(stderr, format, args);
+        fputc('\n', stderr);
+        va_end(args);
+    }
+    pthread_mutex_unlock(&s_log_lock);
+}
+
+// Errors
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static const struct {
+        esp_err_t code;
+        const char *name;
+    } names[] = {
+        { ESP_OK, "ESP_OK" },
+        { ESP_FAIL, "ESP_FAIL" },
+        { ESP_ERR_NO_MEM, "ESP_ERR_NO_MEM" },
+        { ESP_ERR_INVALID_ARG, "ESP_ERR_INVALID_ARG" },
+        { ESP_ERR_INVALID_STATE, "ESP_ERR_INVALID_STATE" },
+        { ESP_ERR_INVALID_SIZE, "ESP_ERR_INVALID_SIZE" },
+        { ESP_ERR_NOT_FOUND, "ESP_ERR_NOT_FOUND" },
+        { ESP_ERR_NOT_SUPPORTED, "ESP_ERR_NOT_SUPPORTED" },
+        { ESP_ERR_TIMEOUT, "ESP_ERR_TIMEOUT" },
+        { ESP_ERR_WIFI_NOT_INIT, "ESP_ERR_WIFI_NOT_INIT" },
+        { ESP_ERR_WIFI_NOT_STARTED, "ESP_ERR_WIFI_NOT_STARTED" },
+        { ESP_ERR_WIFI_CONN, "ESP_ERR_WIFI_CONN" },
+        { ESP_ERR_WIFI_STATE, "ESP_ERR_WIFI_STATE" },
+        { ESP_ERR_NVS_NOT_FOUND, "ESP_ERR_NVS_NOT_FOUND" },
+        { ESP_ERR_NVS_INVALID_LENGTH, "ESP_ERR_NVS_INVALID_LENGTH" },
+        { ESP_ERR_NVS_NOT_ENOUGH_SPACE, "ESP_ERR_NVS_NOT_ENOUGH_SPACE" },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (names[i].code == code) {
+            return names[i].name;
+        }
+    }
+    return "UNKNOWN ERROR";
+}
+
+void mock_error_check_failed(esp_err_t err, const char *file, int line, const char *expr)
+{
+    fprintf(stderr, "ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n", err,
+            esp_err_to_name(err), file, line, expr);
+    abort();
+}
+
+// newlib has it, glibc only since 2.38
+#ifdef MOCK_NEED_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t copied = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, copied);
+        dst[copied] = '\0';
+    }
+    return len;
+}
+#endif
+
+// Random numbers
+
+static _Atomic uint32_t s_random = 1;
+
+void mock_random_seed(uint32_t seed)
+{
+    s_random = seed ? seed : 1;
+}
+
+uint32_t esp_random(void)
+{
+    // xorshift32, racing callers may get the same number, which is fine for the retry jitter
+    uint32_t x = s_random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s_random = x;
+    return x;
+}
+
+// Heap: every allocation of the code linked with --wrap is counted against MOCK_HEAP_SIZE
+
+static pthread_mutex_t s_heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t s_heap_used;
+static size_t s_heap_peak;          // since mock_heap_reset_peak()
+static size_t s_heap_max;           // since start, for the minimum free size
+
+// Reserves the size of an allocation, returns false if the heap would run out
+static bool heap_reserve(size_t size)
+{
+    pthread_mutex_lock(&s_heap_lock);
+    bool fits = size <= MOCK_HEAP_SIZE - s_heap_used;
+    if (fits) {
+        s_heap_used += size;
+        s_heap_peak = s_heap_used > s_heap_peak ? s_heap_used : s_heap_peak;
+        s_heap_max = s_heap_used > s_heap_max ? s_heap_used : s_heap_max;
+    }
+    pthread_mutex_unlock(&s_heap_lock);
+    return fits;
+}
+
+static void heap_release(size_t size)
+{
+    pthread_mutex_lock(&s_heap_lock);
+    s_heap_used -= size;
+    pthread_mutex_unlock(&s_heap_lock);
+}
+
+// Counts what the allocator actually handed out, as the real heap does with its block overhead
+static void *heap_track(void *ptr)
+{
+    if (ptr && !heap_reserve(malloc_usable_size(ptr))) {
+        __real_free(ptr);
+        return NULL;
+    }
+    return ptr;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    return heap_track(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    return heap_track(__real_calloc(nmemb, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return __wrap_malloc(size);
+    }
+    size_t old_size = malloc_usable_size(ptr);
+    void *new_ptr = __real_realloc(ptr, size);
+    if (!new_ptr) {
+        return NULL;
+    }
+    heap_release(old_size);
+    if (!heap_reserve(malloc_usable_size(new_ptr))) {
+        // The old block is gone, give back a block of its size rather than fail with a freed pointer
+        void *shrunk = __real_realloc(new_ptr, old_size);
+        heap_reserve(malloc_usable_size(shrunk));
+        errno = ENOMEM;
+        return NULL;
+    }
+    return new_ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr) {
+        heap_release(malloc_usable_size(ptr));
+        __real_free(ptr);
+    }
+}
+
+size_t mock_heap_used(void)
+{
+    pthread_mutex_lock(&s_heap_lock);
+    size_t used = s_heap_used;
+    pthread_mutex_unlock(&s_heap_lock);
+    return used;
+}
+
+size_t mock_heap_peak_used(void)
+{
+    pthread_mutex_lock(&s_heap_lock);
+    size_t peak = s_heap_peak;
+    pthread_mutex_unlock(&s_heap_lock);
+    return peak;
+}
+
+void mock_heap_reset_peak(void)
+{
+    pthread_mutex_lock(&s_heap_lock);
+    s_heap_peak = s_heap_used;
+    pthread_mutex_unlock(&s_heap_lock);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return MOCK_HEAP_SIZE - mock_heap_used();
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    pthread_mutex_lock(&s_heap_lock);
+    size_t min_free = MOCK_HEAP_SIZE - s_heap_max;
+    pthread_mutex_unlock(&s_heap_lock);
+    return min_free;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return heap_caps_get_free_size(caps);
+}
+
+// NVS, its entries are not counted as heap as they live in flash
+
+#define NVS_MAX_ENTRIES 32
+#define NVS_MAX_HANDLES 8
+#define NVS_KEY_LEN 16
+
+typedef struct {
+    char namespace_name[NVS_KEY_LEN];
+    char key[NVS_KEY_LEN];
+    void *value;
+    size_t length;
+} nvs_entry_t;
+
+static pthread_mutex_t s_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_entry_t s_nvs[NVS_MAX_ENTRIES];
+static struct {
+    bool open;
+    nvs_open_mode_t mode;
+    char namespace_name[NVS_KEY_LEN];
+} s_nvs_handles[NVS_MAX_HANDLES];
+static uint32_t s_nvs_commits;
+
+static nvs_entry_t *nvs_find(const char *namespace_name, const char *key)
+{
+    for (size_t i = 0; i < NVS_MAX_ENTRIES; i++) {
+        if (s_nvs[i].value && strcmp(s_nvs[i].namespace_name, namespace_name) == 0 &&
+            (!key || strcmp(s_nvs[i].key, key) == 0)) {
+            return &s_nvs[i];
+        }
+    }
+    return NULL;
+}
+
+// Namespace of an open handle, NULL if the handle is not open
+static const char *nvs_namespace(nvs_handle_t handle)
+{
+    return handle > 0 && handle <= NVS_MAX_HANDLES && s_nvs_handles[handle - 1].open
+           ? s_nvs_handles[handle - 1].namespace_name : NULL;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    mock_nvs_erase();
+    return ESP_OK;
+}
+
+void mock_nvs_erase(void)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    for (size_t i = 0; i < NVS_MAX_ENTRIES; i++) {
+        __real_free(s_nvs[i].value);
+        s_nvs[i].value = NULL;
+    }
+    s_nvs_commits = 0;
+    pthread_mutex_unlock(&s_nvs_lock);
+}
+
+uint32_t mock_nvs_commits(void)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    uint32_t commits = s_nvs_commits;
+    pthread_mutex_unlock(&s_nvs_lock);
+    return commits;
+}
+
+esp_err_t nvs_open(const char *namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (strlen(namespace_name) >= NVS_KEY_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_nvs_lock);
+    esp_err_t err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    // A namespace exists once a key was written to it
+    if (open_mode == NVS_READONLY && !nvs_find(namespace_name, NULL)) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else {
+        for (size_t i = 0; i < NVS_MAX_HANDLES; i++) {
+            if (!s_nvs_handles[i].open) {
+                s_nvs_handles[i].open = true;
+                s_nvs_handles[i].mode = open_mode;
+                strcpy(s_nvs_handles[i].namespace_name, namespace_name);
+                *out_handle = i + 1;
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    if (nvs_namespace(handle)) {
+        s_nvs_handles[handle - 1].open = false;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    const char *namespace_name = nvs_namespace(handle);
+    nvs_entry_t *entry = namespace_name ? nvs_find(namespace_name, key) : NULL;
+    esp_err_t err = ESP_OK;
+    if (!namespace_name) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (!entry) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (!out_value) {
+        *length = entry->length;
+    } else if (*length < entry->length) {
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+        memcpy(out_value, entry->value, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    if (strlen(key) >= NVS_KEY_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_nvs_lock);
+    const char *namespace_name = nvs_namespace(handle);
+    esp_err_t err = ESP_OK;
+    if (!namespace_name) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (s_nvs_handles[handle - 1].mode == NVS_READONLY) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else {
+        nvs_entry_t *entry = nvs_find(namespace_name, key);
+        for (size_t i = 0; !entry && i < NVS_MAX_ENTRIES; i++) {
+            if (!s_nvs[i].value) {
+                entry = &s_nvs[i];
+            }
+        }
+        if (!entry) {
+            err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        } else {
+            void *copy = __real_malloc(length ? length : 1);
+            memcpy(copy, value, length);
+            __real_free(entry->value);
+            strcpy(entry->namespace_name, namespace_name);
+            strcpy(entry->key, key);
+            entry->value = copy;
+            entry->length = length;
+        }
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    const char *namespace_name = nvs_namespace(handle);
+    nvs_entry_t *entry = namespace_name ? nvs_find(namespace_name, key) : NULL;
+    esp_err_t err = ESP_OK;
+    if (!namespace_name) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (s_nvs_handles[handle - 1].mode == NVS_READONLY) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else if (!entry) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    } else {
+        __real_free(entry->value);
+        entry->value = NULL;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    esp_err_t err = nvs_namespace(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+    if (err == ESP_OK) {
+        s_nvs_commits++;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return err;
+}
+
+// DNS server, the real one needs sockets and is covered by the DNS engine tests
+
+struct dns_server_handle {
+    dns_server_stats_t stats;
+};
+
+static _Atomic bool s_dns_running;
+
+dns_server_handle_t start_dns_server(dns_server_config_t *config)
+{
+    dns_server_handle_t handle = calloc(1, sizeof(struct dns_server_handle));
+    if (handle) {
+        s_dns_running = true;
+    }
+    return handle;
+}
+
+esp_err_t dns_server_get_stats(dns_server_handle_t handle, dns_server_stats_t *stats)
+{
+    if (!handle || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = handle->stats;
+    return ESP_OK;
+}
+
+void stop_dns_server(dns_server_handle_t handle)
+{
+    if (handle) {
+        s_dns_running = false;
+        free(handle);
+    }
+}
+
+bool mock_dns_server_running(void)
+{
+    return s_dns_running;
+}
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+
+#include "esp_timer.h"
+
+#include "mock.h"
+#include "mock_internal.h"
+
+// The callbacks run one at a time on a thread of their own, as with ESP_TIMER_TASK dispatch
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void *arg;
+    bool active;
+    uint64_t period_us;     // 0 for a one-shot timer
+    int64_t alarm_us;
+    struct esp_timer *next;
+};
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_cond;
+static pthread_t s_thread;
+static bool s_thread_started;
+static struct esp_timer *s_timers;
+
+int64_t esp_timer_get_time(void)
+{
+    return mock_time_now_us();
+}
+
+static struct esp_timer *next_alarm(void)
+{
+    struct esp_timer *next = NULL;
+    for (struct esp_timer *timer = s_timers; timer; timer = timer->next) {
+        if (timer->active && (!next || timer->alarm_us < next->alarm_us)) {
+            next = timer;
+        }
+    }
+    return next;
+}
+
+static void *timer_task(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    while (true) {
+        struct esp_timer *timer = next_alarm();
+        if (!timer) {
+            pthread_cond_wait(&s_cond, &s_lock);
+            continue;
+        }
+        if (timer->alarm_us > mock_time_now_us()) {
+            struct timespec deadline;
+            mock_deadline_at(timer->alarm_us, &deadline);
+            mock_cond_wait(&s_cond, &s_lock, &deadline);
+            continue;
+        }
+        if (timer->period_us) {
+            timer->alarm_us += timer->period_us;
+        } else {
+            timer->active = false;
+        }
+        esp_timer_cb_t callback = timer->callback;
+        void *callback_arg = timer->arg;
+        pthread_mutex_unlock(&s_lock);
+        callback(callback_arg);
+        pthread_mutex_lock(&s_lock);
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (!create_args || !create_args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer *timer = calloc(1, sizeof(*timer));
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+
+    pthread_mutex_lock(&s_lock);
+    if (!s_thread_started) {
+        mock_cond_init(&s_cond);
+        pthread_create(&s_thread, NULL, timer_task, NULL);
+        pthread_detach(s_thread);
+        s_thread_started = true;
+    }
+    timer->next = s_timers;
+    s_timers = timer;
+    pthread_mutex_unlock(&s_lock);
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    if (timer->active) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->active = true;
+    timer->period_us = period_us;
+    timer->alarm_us = mock_time_now_us() + timeout_us;
+    pthread_cond_broadcast(&s_cond);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    bool active = timer->active;
+    timer->active = false;
+    pthread_mutex_unlock(&s_lock);
+    return active ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    if (timer->active) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (struct esp_timer **link = &s_timers; *link; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+    free(timer);
+    return ESP_OK;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer)
+{
+    pthread_mutex_lock(&s_lock);
+    bool active = timer->active;
+    pthread_mutex_unlock(&s_lock);
+    return active;
+}
@@ -0,0 +1,1015 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "mock.h"
+#include "mock_internal.h"
+
+// Wi-Fi driver and netifs of the AP and the STA, simulated from a table of APs
+
+#define MAX_APS 512
+// Channels of the default country
+#define VALID_CHANNELS 0x3FFE
+
+typedef struct {
+    mock_ap_t ap;
+    char ssid[33];
+    char password[65];
+    bool enabled;
+} ap_entry_t;
+
+typedef enum {
+    STA_IDLE,
+    STA_CONNECTING,
+    STA_CONNECTED,
+} sta_state_t;
+
+struct esp_netif_obj {
+    const char *if_key;
+    bool created;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+    bool dhcp_running;      // client of the STA, server of the AP
+};
+
+enum { NETIF_AP, NETIF_STA };
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static ap_entry_t s_aps[MAX_APS];
+static size_t s_num_aps;
+static mock_wifi_timing_t s_timing = MOCK_WIFI_TIMING_DEFAULT();
+static mock_wifi_stats_t s_stats;
+static bool s_scripted;
+static esp_err_t s_scan_error;
+
+static struct {
+    bool inited;
+    bool started;
+    wifi_mode_t mode;
+    wifi_config_t sta_config;
+    wifi_config_t ap_config;
+    uint8_t protocols[2];
+    sta_state_t sta_state;
+    wifi_ap_record_t sta_ap;        // AP the STA is connected to
+    esp_timer_handle_t connect_timer;
+    esp_timer_handle_t dhcp_timer;
+    esp_timer_handle_t scan_timer;
+    bool scanning;
+    uint16_t scan_channels;
+    bool scan_show_hidden;
+    wifi_ap_record_t *results;      // the driver's list, on the heap
+    uint16_t num_results;
+    uint16_t next_result;
+} s_wifi;
+
+static struct esp_netif_obj s_netifs[] = {
+    [NETIF_AP] = { .if_key = "WIFI_AP_DEF" },
+    [NETIF_STA] = { .if_key = "WIFI_STA_DEF" },
+};
+
+static void post(esp_event_base_t base, int32_t id, const void *data, size_t size)
+{
+    esp_event_post(base, id, data, size, portMAX_DELAY);
+}
+
+static ap_entry_t *ap_entry(int index)
+{
+    if (index < 0 || (size_t)index >= s_num_aps) {
+        fprintf(stderr, "No AP %d\n", index);
+        abort();
+    }
+    return &s_aps[index];
+}
+
+// APs
+
+void mock_wifi_reset(void)
+{
+    pthread_mutex_lock(&s_lock);
+    memset(s_aps, 0, sizeof(s_aps));
+    s_num_aps = 0;
+    s_timing = (mock_wifi_timing_t)MOCK_WIFI_TIMING_DEFAULT();
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_scripted = false;
+    s_scan_error = ESP_OK;
+    pthread_mutex_unlock(&s_lock);
+}
+
+int mock_wifi_add_ap(const mock_ap_t *ap)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_num_aps == MAX_APS) {
+        pthread_mutex_unlock(&s_lock);
+        return -1;
+    }
+    int index = s_num_aps++;
+    ap_entry_t *entry = &s_aps[index];
+    entry->ap = *ap;
+    snprintf(entry->ssid, sizeof(entry->ssid), "%s", ap->ssid ? ap->ssid : "");
+    snprintf(entry->password, sizeof(entry->password), "%s", ap->password ? ap->password : "");
+    entry->ap.ssid = entry->ssid;
+    entry->ap.password = entry->password;
+    entry->enabled = true;
+    pthread_mutex_unlock(&s_lock);
+    return index;
+}
+
+void mock_wifi_add_synthetic_aps(size_t count, size_t ssid_len, uint32_t seed)
+{
+    uint32_t rng = seed ? seed : 1;
+    const char filler[] = "abcdefghijklmnopqrstuvwxyz0123456789 _-\"\\";
+    char ssid[33];
+    ssid_len = ssid_len > 32 ? 32 : ssid_len;
+
+    for (size_t i = 0; i < count; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        // Every fifth BSS shares the SSID of the previous one, as the APs of a mesh or a dual band router do
+        if (i % 5 != 4 || i == 0) {
+            int len = snprintf(ssid, sizeof(ssid), "AP-%03u-", (unsigned)i);
+            for (size_t j = len; j < ssid_len; j++) {
+                ssid[j] = filler[(rng >> (j % 24)) % (sizeof(filler) - 1)];
+            }
+            ssid[ssid_len > (size_t)len ? ssid_len : (size_t)len] = '\0';
+        }
+        mock_ap_t ap = {
+            .ssid = i % 17 == 16 ? "" : ssid,   // hidden
+            .password = "password",
+            .bssid = { 0x02, 0x00, (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF, rng & 0xFF },
+            .channel = 1 + rng % 13,
+            .rssi = -30 - (int)((rng >> 8) % 66),
+            .authmode = (rng >> 16) % 4 == 0 ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA2_PSK,
+        };
+        mock_wifi_add_ap(&ap);
+    }
+}
+
+size_t mock_wifi_num_aps(void)
+{
+    pthread_mutex_lock(&s_lock);
+    size_t count = s_num_aps;
+    pthread_mutex_unlock(&s_lock);
+    return count;
+}
+
+void mock_wifi_get_ap(int index, mock_ap_t *ap)
+{
+    pthread_mutex_lock(&s_lock);
+    *ap = ap_entry(index)->ap;
+    pthread_mutex_unlock(&s_lock);
+}
+
+// The STA lost the AP it is connected to, must be called with the lock held
+static void lose_ap(int index)
+{
+    ap_entry_t *entry = ap_entry(index);
+    if (s_wifi.sta_state != STA_CONNECTED || memcmp(s_wifi.sta_ap.bssid, entry->ap.bssid, 6) != 0) {
+        return;
+    }
+    s_wifi.sta_state = STA_IDLE;
+    esp_timer_stop(s_wifi.dhcp_timer);
+    if (s_netifs[NETIF_STA].dhcp_running) {
+        memset(&s_netifs[NETIF_STA].ip_info, 0, sizeof(esp_netif_ip_info_t));
+    }
+    wifi_event_sta_disconnected_t event = { .reason = WIFI_REASON_BEACON_TIMEOUT, .rssi = entry->ap.rssi };
+    memcpy(event.ssid, s_wifi.sta_ap.ssid, sizeof(event.ssid));
+    event.ssid_len = strnlen((const char *)event.ssid, sizeof(event.ssid));
+    memcpy(event.bssid, s_wifi.sta_ap.bssid, sizeof(event.bssid));
+    post(WIFI_EVENT, WIFI_EVENT_STA_BEACON_TIMEOUT, NULL, 0);
+    post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event));
+}
+
+void mock_wifi_move_ap(int index, uint8_t channel, const uint8_t bssid[6])
+{
+    pthread_mutex_lock(&s_lock);
+    lose_ap(index);
+    ap_entry(index)->ap.channel = channel;
+    memcpy(ap_entry(index)->ap.bssid, bssid, 6);
+    pthread_mutex_unlock(&s_lock);
+}
+
+void mock_wifi_set_ap_enabled(int index, bool enabled)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!enabled) {
+        lose_ap(index);
+    }
+    ap_entry(index)->enabled = enabled;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void mock_wifi_set_ap_dhcp(int index, bool dhcp)
+{
+    pthread_mutex_lock(&s_lock);
+    ap_entry(index)->ap.no_dhcp = !dhcp;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void mock_wifi_set_timing(const mock_wifi_timing_t *timing)
+{
+    pthread_mutex_lock(&s_lock);
+    s_timing = *timing;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void mock_wifi_get_stats(mock_wifi_stats_t *stats)
+{
+    pthread_mutex_lock(&s_lock);
+    *stats = s_stats;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void mock_wifi_get_sta_config(wifi_sta_config_t *config)
+{
+    pthread_mutex_lock(&s_lock);
+    *config = s_wifi.sta_config.sta;
+    pthread_mutex_unlock(&s_lock);
+}
+
+bool mock_wifi_sta_connected(void)
+{
+    pthread_mutex_lock(&s_lock);
+    bool connected = s_wifi.sta_state == STA_CONNECTED;
+    pthread_mutex_unlock(&s_lock);
+    return connected;
+}
+
+void mock_wifi_set_scan_error(esp_err_t err)
+{
+    pthread_mutex_lock(&s_lock);
+    s_scan_error = err;
+    pthread_mutex_unlock(&s_lock);
+}
+
+void mock_wifi_set_scripted(bool scripted)
+{
+    pthread_mutex_lock(&s_lock);
+    s_scripted = scripted;
+    pthread_mutex_unlock(&s_lock);
+}
+
+bool mock_netif_sta_dhcpc_running(void)
+{
+    pthread_mutex_lock(&s_lock);
+    bool running = s_netifs[NETIF_STA].dhcp_running;
+    pthread_mutex_unlock(&s_lock);
+    return running;
+}
+
+uint32_t mock_netif_sta_ip(void)
+{
+    pthread_mutex_lock(&s_lock);
+    uint32_t ip = s_netifs[NETIF_STA].ip_info.ip.addr;
+    pthread_mutex_unlock(&s_lock);
+    return ip;
+}
+
+// Driver
+
+// The BSS a connection attempt joins, the strongest matching the configuration, -1 if none
+static int find_target_ap(void)
+{
+    const wifi_sta_config_t *sta = &s_wifi.sta_config.sta;
+    int best = -1;
+    for (size_t i = 0; i < s_num_aps; i++) {
+        const ap_entry_t *entry = &s_aps[i];
+        if (!entry->enabled || strncmp(entry->ssid, (const char *)sta->ssid, sizeof(sta->ssid)) != 0 ||
+            (sta->bssid_set && memcmp(entry->ap.bssid, sta->bssid, 6) != 0) ||
+            (sta->channel != 0 && entry->ap.channel != sta->channel)) {
+            continue;
+        }
+        if (best < 0 || entry->ap.rssi > s_aps[best].ap.rssi) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void start_dhcp_locked(void)
+{
+    esp_timer_stop(s_wifi.dhcp_timer);
+    esp_timer_start_once(s_wifi.dhcp_timer, s_timing.dhcp_ms * 1000ULL);
+}
+
+static void connect_timer_cb(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_wifi.sta_state != STA_CONNECTING) {
+        pthread_mutex_unlock(&s_lock);
+        return;
+    }
+    int index = find_target_ap();
+    const ap_entry_t *entry = index >= 0 ? &s_aps[index] : NULL;
+    if (!entry || (entry->ap.authmode != WIFI_AUTH_OPEN &&
+                   strncmp(entry->password, (const char *)s_wifi.sta_config.sta.password, 64) != 0)) {
+        s_wifi.sta_state = STA_IDLE;
+        wifi_event_sta_disconnected_t event = {
+            .reason = entry ? WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT : WIFI_REASON_NO_AP_FOUND,
+            .rssi = entry ? entry->ap.rssi : -127,
+        };
+        memcpy(event.ssid, s_wifi.sta_config.sta.ssid, sizeof(event.ssid));
+        event.ssid_len = strnlen((const char *)event.ssid, sizeof(event.ssid));
+        pthread_mutex_unlock(&s_lock);
+        post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event));
+        return;
+    }
+
+    s_wifi.sta_state = STA_CONNECTED;
+    memset(&s_wifi.sta_ap, 0, sizeof(s_wifi.sta_ap));
+    memcpy(s_wifi.sta_ap.ssid, entry->ssid, sizeof(entry->ssid));
+    memcpy(s_wifi.sta_ap.bssid, entry->ap.bssid, 6);
+    s_wifi.sta_ap.primary = entry->ap.channel;
+    s_wifi.sta_ap.rssi = entry->ap.rssi;
+    s_wifi.sta_ap.authmode = entry->ap.authmode;
+    wifi_event_sta_connected_t event = {
+        .channel = entry->ap.channel,
+        .authmode = entry->ap.authmode,
+        .aid = 1,
+    };
+    memcpy(event.ssid, entry->ssid, sizeof(event.ssid));
+    event.ssid_len = strnlen(entry->ssid, sizeof(event.ssid));
+    memcpy(event.bssid, entry->ap.bssid, 6);
+    if (s_netifs[NETIF_STA].dhcp_running) {
+        start_dhcp_locked();
+    }
+    pthread_mutex_unlock(&s_lock);
+    post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event, sizeof(event));
+}
+
+static const ap_entry_t *connected_entry(void)
+{
+    for (size_t i = 0; i < s_num_aps; i++) {
+        if (memcmp(s_aps[i].ap.bssid, s_wifi.sta_ap.bssid, 6) == 0) {
+            return &s_aps[i];
+        }
+    }
+    return NULL;
+}
+
+static void dhcp_timer_cb(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    const ap_entry_t *entry = connected_entry();
+    struct esp_netif_obj *sta = &s_netifs[NETIF_STA];
+    if (s_wifi.sta_state != STA_CONNECTED || !sta->dhcp_running || !entry || entry->ap.no_dhcp) {
+        pthread_mutex_unlock(&s_lock);
+        return;
+    }
+    sta->ip_info = entry->ap.lease;
+    if (sta->ip_info.ip.addr == 0) {
+        sta->ip_info.ip.addr = ESP_IP4TOADDR(192, 168, entry->ap.channel, 100);
+        sta->ip_info.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+        sta->ip_info.gw.addr = ESP_IP4TOADDR(192, 168, entry->ap.channel, 1);
+    }
+    sta->dns = (esp_netif_dns_info_t) { .ip = { .type = ESP_IPADDR_TYPE_V4, .u_addr.ip4 = sta->ip_info.gw } };
+    ip_event_got_ip_t event = { .esp_netif = sta, .ip_info = sta->ip_info, .ip_changed = true };
+    pthread_mutex_unlock(&s_lock);
+    post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event));
+}
+
+static void scan_timer_cb(void *arg)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.scanning) {
+        pthread_mutex_unlock(&s_lock);
+        return;
+    }
+    s_wifi.scanning = false;
+    // The list of the previous scan is replaced
+    free(s_wifi.results);
+    s_wifi.results = NULL;
+    s_wifi.num_results = 0;
+    s_wifi.next_result = 0;
+
+    size_t found = 0;
+    for (size_t i = 0; i < s_num_aps; i++) {
+        found += s_aps[i].enabled && (s_wifi.scan_channels & (1 << s_aps[i].ap.channel));
+    }
+    s_wifi.results = found ? malloc(found * sizeof(wifi_ap_record_t)) : NULL;
+    for (size_t i = 0; s_wifi.results && i < s_num_aps; i++) {
+        const ap_entry_t *entry = &s_aps[i];
+        if (!entry->enabled || !(s_wifi.scan_channels & (1 << entry->ap.channel)) ||
+            (entry->ssid[0] == '\0' && !s_wifi.scan_show_hidden)) {
+            continue;
+        }
+        wifi_ap_record_t *record = &s_wifi.results[s_wifi.num_results++];
+        memset(record, 0, sizeof(*record));
+        memcpy(record->ssid, entry->ssid, sizeof(entry->ssid));
+        memcpy(record->bssid, entry->ap.bssid, 6);
+        record->primary = entry->ap.channel;
+        record->rssi = entry->ap.rssi;
+        record->authmode = entry->ap.authmode;
+    }
+    wifi_event_sta_scan_done_t event = { .status = 0, .number = s_wifi.num_results };
+    pthread_mutex_unlock(&s_lock);
+    post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &event, sizeof(event));
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_wifi.inited) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_OK;
+    }
+    const esp_timer_create_args_t connect_args = { .callback = connect_timer_cb, .name = "wifi_connect" };
+    const esp_timer_create_args_t dhcp_args = { .callback = dhcp_timer_cb, .name = "wifi_dhcp" };
+    const esp_timer_create_args_t scan_args = { .callback = scan_timer_cb, .name = "wifi_scan" };
+    esp_err_t err = esp_timer_create(&connect_args, &s_wifi.connect_timer);
+    if (err == ESP_OK) {
+        err = esp_timer_create(&dhcp_args, &s_wifi.dhcp_timer);
+    }
+    if (err == ESP_OK) {
+        err = esp_timer_create(&scan_args, &s_wifi.scan_timer);
+    }
+    s_wifi.inited = err == ESP_OK;
+    s_wifi.protocols[WIFI_IF_STA] = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N;
+    s_wifi.protocols[WIFI_IF_AP] = WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N;
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t esp_wifi_deinit(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_wifi.started) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_STOPPED;
+    }
+    if (s_wifi.inited) {
+        esp_timer_delete(s_wifi.connect_timer);
+        esp_timer_delete(s_wifi.dhcp_timer);
+        esp_timer_delete(s_wifi.scan_timer);
+        free(s_wifi.results);
+        memset(&s_wifi, 0, sizeof(s_wifi));
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    pthread_mutex_lock(&s_lock);
+    s_wifi.mode = mode;
+    pthread_mutex_unlock(&s_lock);
+    return s_wifi.inited ? ESP_OK : ESP_ERR_WIFI_NOT_INIT;
+}
+
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage)
+{
+    return s_wifi.inited ? ESP_OK : ESP_ERR_WIFI_NOT_INIT;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.inited) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    if (interface == WIFI_IF_STA) {
+        s_wifi.sta_config = *conf;
+    } else {
+        s_wifi.ap_config = *conf;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.inited) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    *conf = interface == WIFI_IF_STA ? s_wifi.sta_config : s_wifi.ap_config;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.inited) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_INIT;
+    }
+    bool was_started = s_wifi.started;
+    s_wifi.started = true;
+    wifi_mode_t mode = s_wifi.mode;
+    pthread_mutex_unlock(&s_lock);
+    if (!was_started) {
+        if (mode == WIFI_MODE_AP || mode == WIFI_MODE_APSTA) {
+            post(WIFI_EVENT, WIFI_EVENT_AP_START, NULL, 0);
+        }
+        if (mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA) {
+            post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0);
+        }
+    }
+    return ESP_OK;
+}
+
+// Ends the connection or the attempt in progress, must be called with the lock held
+static bool leave_locked(void)
+{
+    bool left = s_wifi.sta_state != STA_IDLE;
+    s_wifi.sta_state = STA_IDLE;
+    esp_timer_stop(s_wifi.connect_timer);
+    esp_timer_stop(s_wifi.dhcp_timer);
+    if (left && s_netifs[NETIF_STA].dhcp_running) {
+        memset(&s_netifs[NETIF_STA].ip_info, 0, sizeof(esp_netif_ip_info_t));
+    }
+    return left;
+}
+
+static void post_leave(void)
+{
+    wifi_event_sta_disconnected_t event = { .reason = WIFI_REASON_ASSOC_LEAVE };
+    post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event));
+}
+
+esp_err_t esp_wifi_stop(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.started) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_OK;
+    }
+    bool left = leave_locked();
+    s_wifi.scanning = false;
+    esp_timer_stop(s_wifi.scan_timer);
+    s_wifi.started = false;
+    wifi_mode_t mode = s_wifi.mode;
+    pthread_mutex_unlock(&s_lock);
+    if (left) {
+        post_leave();
+    }
+    if (mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA) {
+        post(WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0);
+    }
+    if (mode == WIFI_MODE_AP || mode == WIFI_MODE_APSTA) {
+        post(WIFI_EVENT, WIFI_EVENT_AP_STOP, NULL, 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.started) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    s_stats.connects++;
+    esp_err_t err = ESP_OK;
+    if (s_scripted) {
+        // The trace reports the outcome
+    } else if (s_wifi.scanning) {
+        err = ESP_ERR_WIFI_STATE;
+    } else if (s_wifi.sta_state == STA_CONNECTED) {
+        err = ESP_ERR_WIFI_CONN;
+    } else {
+        s_wifi.sta_state = STA_CONNECTING;
+        esp_timer_stop(s_wifi.connect_timer);
+        esp_timer_start_once(s_wifi.connect_timer, s_timing.connect_ms * 1000ULL);
+    }
+    if (err != ESP_OK) {
+        s_stats.connects_rejected++;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.started) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    s_stats.disconnects++;
+    bool left = !s_scripted && leave_locked();
+    pthread_mutex_unlock(&s_lock);
+    if (left) {
+        post_leave();
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+{
+    pthread_mutex_lock(&s_lock);
+    if (!s_wifi.started) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_WIFI_NOT_STARTED;
+    }
+    s_stats.scans++;
+    if (s_scripted) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_OK;
+    }
+    if (s_wifi.sta_state == STA_CONNECTING || s_wifi.scanning || s_scan_error != ESP_OK) {
+        esp_err_t err = s_scan_error != ESP_OK ? s_scan_error : ESP_ERR_WIFI_STATE;
+        s_stats.scans_rejected++;
+        pthread_mutex_unlock(&s_lock);
+        return err;
+    }
+
+    uint16_t channels = VALID_CHANNELS;
+    if (config && config->channel) {
+        channels = 1 << config->channel;
+    } else if (config && config->channel_bitmap.ghz_2_channels) {
+        channels = config->channel_bitmap.ghz_2_channels;
+    }
+    channels &= VALID_CHANNELS;
+    s_wifi.scanning = true;
+    s_wifi.scan_channels = channels;
+    s_wifi.scan_show_hidden = config && config->show_hidden;
+    esp_timer_start_once(s_wifi.scan_timer, (uint64_t)__builtin_popcount(channels) * s_timing.scan_channel_ms * 1000);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_stop(void)
+{
+    pthread_mutex_lock(&s_lock);
+    s_wifi.scanning = false;
+    esp_timer_stop(s_wifi.scan_timer);
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number)
+{
+    pthread_mutex_lock(&s_lock);
+    *number = s_wifi.num_results - s_wifi.next_result;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+static void clear_results_locked(void)
+{
+    free(s_wifi.results);
+    s_wifi.results = NULL;
+    s_wifi.num_results = 0;
+    s_wifi.next_result = 0;
+}
+
+esp_err_t esp_wifi_scan_get_ap_record(wifi_ap_record_t *ap_record)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_wifi.next_result >= s_wifi.num_results) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_FAIL;
+    }
+    *ap_record = s_wifi.results[s_wifi.next_result++];
+    // The list is freed once every record was taken
+    if (s_wifi.next_result == s_wifi.num_results) {
+        clear_results_locked();
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_clear_ap_list(void)
+{
+    pthread_mutex_lock(&s_lock);
+    clear_results_locked();
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    pthread_mutex_lock(&s_lock);
+    esp_err_t err = s_wifi.sta_state == STA_CONNECTED ? ESP_OK : ESP_ERR_WIFI_NOT_CONNECT;
+    if (err == ESP_OK) {
+        *ap_info = s_wifi.sta_ap;
+    }
+    pthread_mutex_unlock(&s_lock);
+    return err;
+}
+
+esp_err_t esp_wifi_set_protocol(wifi_interface_t ifx, uint8_t protocol_bitmap)
+{
+    pthread_mutex_lock(&s_lock);
+    s_wifi.protocols[ifx] = protocol_bitmap;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_protocol(wifi_interface_t ifx, uint8_t *protocol_bitmap)
+{
+    pthread_mutex_lock(&s_lock);
+    *protocol_bitmap = s_wifi.protocols[ifx];
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+// Keeps the STA state in step with the events of a trace
+void mock_wifi_on_event(int32_t event_id, const void *event_data)
+{
+    pthread_mutex_lock(&s_lock);
+    if (s_scripted && event_id == WIFI_EVENT_STA_CONNECTED) {
+        const wifi_event_sta_connected_t *event = event_data;
+        s_wifi.sta_state = STA_CONNECTED;
+        memset(&s_wifi.sta_ap, 0, sizeof(s_wifi.sta_ap));
+        memcpy(s_wifi.sta_ap.ssid, event->ssid, event->ssid_len);
+        memcpy(s_wifi.sta_ap.bssid, event->bssid, 6);
+        s_wifi.sta_ap.primary = event->channel;
+        s_wifi.sta_ap.authmode = event->authmode;
+    } else if (s_scripted && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        s_wifi.sta_state = STA_IDLE;
+        if (s_netifs[NETIF_STA].dhcp_running) {
+            memset(&s_netifs[NETIF_STA].ip_info, 0, sizeof(esp_netif_ip_info_t));
+        }
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+// Netifs
+
+esp_err_t esp_netif_init(void)
+{
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_ap(void)
+{
+    pthread_mutex_lock(&s_lock);
+    struct esp_netif_obj *ap = &s_netifs[NETIF_AP];
+    ap->created = true;
+    ap->dhcp_running = true;
+    ap->ip_info.ip.addr = ESP_IP4TOADDR(192, 168, 4, 1);
+    ap->ip_info.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+    ap->ip_info.gw.addr = ESP_IP4TOADDR(192, 168, 4, 1);
+    pthread_mutex_unlock(&s_lock);
+    return ap;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    pthread_mutex_lock(&s_lock);
+    struct esp_netif_obj *sta = &s_netifs[NETIF_STA];
+    sta->created = true;
+    sta->dhcp_running = true;
+    memset(&sta->ip_info, 0, sizeof(sta->ip_info));
+    pthread_mutex_unlock(&s_lock);
+    return sta;
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    for (size_t i = 0; i < sizeof(s_netifs) / sizeof(s_netifs[0]); i++) {
+        if (s_netifs[i].created && strcmp(s_netifs[i].if_key, if_key) == 0) {
+            return &s_netifs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+    if (!esp_netif) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    *ip_info = esp_netif->ip_info;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t *esp_netif, const esp_netif_ip_info_t *ip_info)
+{
+    if (!esp_netif) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    if (esp_netif == &s_netifs[NETIF_STA] && esp_netif->dhcp_running) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_ESP_NETIF_DHCP_NOT_STOPPED;
+    }
+    esp_netif->ip_info = *ip_info;
+    bool got_ip = esp_netif == &s_netifs[NETIF_STA] && ip_info->ip.addr != 0;
+    ip_event_got_ip_t event = { .esp_netif = esp_netif, .ip_info = *ip_info, .ip_changed = true };
+    pthread_mutex_unlock(&s_lock);
+    if (got_ip) {
+        post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event));
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    if (!esp_netif) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    *dns = esp_netif->dns;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t *esp_netif, esp_netif_dns_type_t type, esp_netif_dns_info_t *dns)
+{
+    if (!esp_netif) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    esp_netif->dns = *dns;
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_start(esp_netif_t *esp_netif)
+{
+    if (esp_netif != &s_netifs[NETIF_STA]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    if (esp_netif->dhcp_running) {
+        pthread_mutex_unlock(&s_lock);
+        return ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED;
+    }
+    // The static IP is dropped, the lease replaces it
+    esp_netif->dhcp_running = true;
+    memset(&esp_netif->ip_info, 0, sizeof(esp_netif->ip_info));
+    if (s_wifi.sta_state == STA_CONNECTED && !s_scripted) {
+        start_dhcp_locked();
+    }
+    pthread_mutex_unlock(&s_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t *esp_netif)
+{
+    if (esp_netif != &s_netifs[NETIF_STA]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    bool running = esp_netif->dhcp_running;
+    esp_netif->dhcp_running = false;
+    if (s_wifi.inited) {
+        esp_timer_stop(s_wifi.dhcp_timer);
+    }
+    pthread_mutex_unlock(&s_lock);
+    return running ? ESP_OK : ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED;
+}
+
+esp_err_t esp_netif_dhcps_start(esp_netif_t *esp_netif)
+{
+    if (esp_netif != &s_netifs[NETIF_AP]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    bool running = esp_netif->dhcp_running;
+    esp_netif->dhcp_running = true;
+    pthread_mutex_unlock(&s_lock);
+    return running ? ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED : ESP_OK;
+}
+
+esp_err_t esp_netif_dhcps_stop(esp_netif_t *esp_netif)
+{
+    if (esp_netif != &s_netifs[NETIF_AP]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    bool running = esp_netif->dhcp_running;
+    esp_netif->dhcp_running = false;
+    pthread_mutex_unlock(&s_lock);
+    return running ? ESP_OK : ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED;
+}
+
+esp_err_t esp_netif_dhcps_option(esp_netif_t *esp_netif, esp_netif_dhcp_option_mode_t opt_op,
+                                 esp_netif_dhcp_option_id_t opt_id, void *opt_val, uint32_t opt_len)
+{
+    if (esp_netif != &s_netifs[NETIF_AP] || !opt_val) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&s_lock);
+    bool running = esp_netif->dhcp_running;
+    pthread_mutex_unlock(&s_lock);
+    return running && opt_op == ESP_NETIF_OP_SET ? ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED : ESP_OK;
+}
+
+// Traces
+
+static const char *trace_value(const char *args, const char *key, char *value, size_t size)
+{
+    size_t key_len = strlen(key);
+    for (const char *p = args; (p = strstr(p, key)) != NULL; p += key_len) {
+        if ((p == args || isspace((unsigned char)p[-1])) && p[key_len] == '=') {
+            size_t len = strcspn(p + key_len + 1, " \t\r\n");
+            snprintf(value, size, "%.*s", (int)len, p + key_len + 1);
+            return value;
+        }
+    }
+    return NULL;
+}
+
+static long trace_number(const char *args, const char *key, long fallback)
+{
+    char value[16];
+    return trace_value(args, key, value, sizeof(value)) ? strtol(value, NULL, 0) : fallback;
+}
+
+// Posts the event of a trace line, returns false if it is unknown
+static bool trace_post(const char *event, const char *args)
+{
+    char value[40];
+    if (strcmp(event, "STA_START") == 0) {
+        post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0);
+    } else if (strcmp(event, "SCAN_DONE") == 0) {
+        wifi_event_sta_scan_done_t done = { .number = trace_number(args, "number", 0) };
+        post(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &done, sizeof(done));
+    } else if (strcmp(event, "STA_CONNECTED") == 0) {
+        wifi_event_sta_connected_t connected = {
+            .channel = trace_number(args, "channel", 1),
+            .authmode = WIFI_AUTH_WPA2_PSK,
+            .aid = 1,
+            .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, trace_number(args, "channel", 1) },
+        };
+        if (trace_value(args, "ssid", value, sizeof(value))) {
+            connected.ssid_len = strnlen(value, sizeof(connected.ssid));
+            memcpy(connected.ssid, value, connected.ssid_len);
+        }
+        post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &connected, sizeof(connected));
+    } else if (strcmp(event, "STA_DISCONNECTED") == 0) {
+        wifi_event_sta_disconnected_t disconnected = {
+            .reason = trace_number(args, "reason", WIFI_REASON_UNSPECIFIED),
+            .rssi = trace_number(args, "rssi", -70),
+        };
+        post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnected, sizeof(disconnected));
+    } else if (strcmp(event, "BEACON_TIMEOUT") == 0) {
+        post(WIFI_EVENT, WIFI_EVENT_STA_BEACON_TIMEOUT, NULL, 0);
+    } else if (strcmp(event, "HOME_CHANNEL_CHANGE") == 0) {
+        wifi_event_home_channel_change_t change = {
+            .old_chan = trace_number(args, "old", 0),
+            .new_chan = trace_number(args, "new", 0),
+        };
+        post(WIFI_EVENT, WIFI_EVENT_HOME_CHANNEL_CHANGE, &change, sizeof(change));
+    } else if (strcmp(event, "GOT_IP") == 0) {
+        unsigned a, b, c, d;
+        if (!trace_value(args, "ip", value, sizeof(value)) || sscanf(value, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) {
+            return false;
+        }
+        pthread_mutex_lock(&s_lock);
+        struct esp_netif_obj *sta = &s_netifs[NETIF_STA];
+        sta->ip_info.ip.addr = ESP_IP4TOADDR(a, b, c, d);
+        sta->ip_info.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+        sta->ip_info.gw.addr = ESP_IP4TOADDR(a, b, c, 1);
+        ip_event_got_ip_t got_ip = { .esp_netif = sta, .ip_info = sta->ip_info, .ip_changed = true };
+        pthread_mutex_unlock(&s_lock);
+        post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip, sizeof(got_ip));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+esp_err_t mock_wifi_play_trace(const char *path, mock_trace_expect_t expect, void *arg)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char line[256];
+    esp_err_t err = ESP_OK;
+    for (int line_number = 1; err == ESP_OK && fgets(line, sizeof(line), f); line_number++) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        char event[32];
+        unsigned long delay_ms;
+        int args_pos = 0;
+        if (line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+        if (sscanf(line, "%lu %31s %n", &delay_ms, event, &args_pos) < 2) {
+            fprintf(stderr, "%s:%d: malformed line\n", path, line_number);
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        mock_sleep_ms(delay_ms);
+        const char *args = line + args_pos;
+        if (strcmp(event, "EXPECT") == 0) {
+            if (!expect(args, arg)) {
+                fprintf(stderr, "%s:%d: expected %s\n", path, line_number, args);
+                err = ESP_FAIL;
+            }
+        } else if (!trace_post(event, args)) {
+            fprintf(stderr, "%s:%d: unknown event %s\n", path, line_number, event);
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    fclose(f);
+    return err;
+}
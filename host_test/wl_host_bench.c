@@ -0,0 +1,198 @@
+/*
+ * Benchmark of the provisioning path on the simulated ESP-IDF of mock/, with 100 BSSs around: latency and peak
+ * heap of the page, scan, status and submit handlers, as the httpd task runs them, then the time the STA takes to
+ * get its IP back after a beacon loss. Latencies are host time, so only compare runs on the same machine; heap is
+ * counted against the bounded mock heap, as on the device.
+ *
+ *   wl_host_bench [-iterations=N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mock.h"
+#include "wireless.h"
+#include "wl_logic.h"
+#include "wl_scan.h"
+
+#define DEFAULT_ITERATIONS 200
+#define TIME_SCALE 20
+#define NUM_OF_APS 100
+#define SUBMIT_PAUSE_MS 50
+#define CLIENT_IP ESP_IP4TOADDR(192, 168, 4, 2)
+
+static volatile uint32_t s_provisioning;
+static volatile uint32_t s_ready;
+static volatile uint32_t s_connected;
+
+static void event_cb(const wl_event_t *event)
+{
+    if (event->id == WL_EVENT_PROVISIONING_STARTED) {
+        s_provisioning++;
+    } else if (event->id == WL_EVENT_READY) {
+        s_ready++;
+    } else if (event->id == WL_EVENT_STA_CONNECTED) {
+        s_connected++;
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the samples, returns the given percentile
+static double percentile(double *samples, unsigned long count, double p)
+{
+    qsort(samples, count, sizeof(double), compare_doubles);
+    unsigned long i = p / 100 * (count - 1) + 0.5;
+    return samples[i];
+}
+
+// Runs a request `iterations` times, `pause_ms` of mock time apart, reports its latency percentiles and the peak
+// heap it used
+static bool bench_request(const char *label, int fd, httpd_method_t method, const char *uri, const char *body,
+                          int expected_status, uint32_t pause_ms, unsigned long iterations, double *samples)
+{
+    size_t used = mock_heap_used();
+    mock_heap_reset_peak();
+    size_t body_len = 0;
+    for (unsigned long i = 0; i < iterations; i++) {
+        mock_http_response_t resp;
+        double start = now_ns();
+        mock_httpd_request(fd, method, uri, NULL, body, &resp);
+        samples[i] = now_ns() - start;
+        int status = resp.status;
+        body_len = resp.body_len;
+        mock_http_response_free(&resp);
+        if (status != expected_status) {
+            fprintf(stderr, "%s: status %d, expected %d\n", uri, status, expected_status);
+            return false;
+        }
+        if (pause_ms) {
+            mock_sleep_ms(pause_ms);
+        }
+    }
+    size_t peak = mock_heap_peak_used() - used;
+    double p50 = percentile(samples, iterations, 50);
+    double p99 = percentile(samples, iterations, 99);
+    printf("%-24s %10.1f %10.1f %10zu %10zu\n", label, p50 / 1000, p99 / 1000, peak, body_len);
+    return true;
+}
+
+// Waits in mock time for an event counter to reach a value
+static bool wait_for(volatile uint32_t *counter, uint32_t value, uint32_t timeout_ms)
+{
+    int64_t until_us = mock_time_now_us() + timeout_ms * 1000LL;
+    while (*counter < value && mock_time_now_us() < until_us) {
+        mock_sleep_ms(5);
+    }
+    return *counter >= value;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = DEFAULT_ITERATIONS;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-iterations=", 12) == 0) {
+            iterations = strtoul(argv[i] + 12, NULL, 10);
+        }
+    }
+    if (iterations == 0) {
+        iterations = 1;
+    }
+    double *samples = malloc(iterations * sizeof(double));
+    if (!samples) {
+        return 1;
+    }
+
+    mock_time_set_scale(TIME_SCALE);
+    mock_random_seed(1);
+    mock_wifi_add_synthetic_aps(NUM_OF_APS - 1, 32, 7);
+    int home = mock_wifi_add_ap(&(mock_ap_t) { .ssid = "HomeNet", .password = "secret123",
+                                               .bssid = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 }, .channel = 6,
+                                               .rssi = -50, .authmode = WIFI_AUTH_WPA2_PSK });
+    size_t heap_before = mock_heap_used();
+    if (wl_wifi_start(NULL, event_cb) != ESP_OK) {
+        return 1;
+    }
+    uint16_t count;
+    if (!wait_for(&s_provisioning, 1, 1000) || !wl_scan_acquire(&count, pdMS_TO_TICKS(10000))) {
+        fprintf(stderr, "Scan cache not running\n");
+        return 1;
+    }
+    bool complete;
+    uint32_t version = wl_scan_get_version(&complete);
+    wl_scan_release();
+    printf("%d BSSs, %u SSIDs cached, portal heap %zu B, peak %zu B\n", NUM_OF_APS, count,
+           mock_heap_used() - heap_before, mock_heap_peak_used() - heap_before);
+
+    int fd = mock_httpd_open_session(CLIENT_IP);
+    char since[48];
+    snprintf(since, sizeof(since), "/api/scan?since=%lu", (unsigned long)version);
+    printf("\n%-24s %10s %10s %10s %10s\n", "handler", "p50 us", "p99 us", "peak B", "body B");
+    // Submissions are spaced by a user's pace, so that each attempt fails before the next one replaces it
+    bool ok = fd >= 0 &&
+              bench_request("page", fd, HTTP_GET, "/", NULL, 200, 0, iterations, samples) &&
+              bench_request("script", fd, HTTP_GET, "/app.js", NULL, 200, 0, iterations, samples) &&
+              bench_request("scan", fd, HTTP_GET, "/api/scan", NULL, 200, 0, iterations, samples) &&
+              bench_request("scan unchanged", fd, HTTP_GET, since, NULL, 204, 0, iterations, samples) &&
+              bench_request("status", fd, HTTP_GET, "/api/status", NULL, 200, 0, iterations, samples) &&
+              bench_request("probe", fd, HTTP_GET, "/generate_204", NULL, 302, 0, iterations, samples) &&
+              bench_request("submit", fd, HTTP_POST, "/submit_provisioning", "ssid=Elsewhere&password=x", 202,
+                            SUBMIT_PAUSE_MS, iterations, samples);
+    if (!ok) {
+        return 1;
+    }
+
+    // The decision made on every disconnection
+    volatile uint32_t sink = 0;
+    double start = now_ns();
+    for (unsigned long i = 0; i < iterations * 1000; i++) {
+        sink += wl_backoff_delay_ms(i % 20 + 1, CONFIG_WL_RECONNECT_BASE_MS, CONFIG_WL_RECONNECT_MAX_MS, i);
+    }
+    printf("\nbackoff decision %.1f ns\n", (now_ns() - start) / (iterations * 1000));
+
+    // Hand over to the network, then time the reconnections after a lost beacon, in mock time
+    mock_http_response_t resp;
+    mock_httpd_request(fd, HTTP_POST, "/submit_provisioning", NULL, "ssid=HomeNet&password=secret123", &resp);
+    mock_http_response_free(&resp);
+    if (!wait_for(&s_ready, 1, 30000)) {
+        fprintf(stderr, "Not connected\n");
+        return 1;
+    }
+    unsigned long reconnects = iterations < 50 ? iterations : 50;
+    for (unsigned long i = 0; i < reconnects; i++) {
+        uint32_t connected = s_connected;
+        int64_t lost_us = mock_time_now_us();
+        mock_wifi_set_ap_enabled(home, false);
+        mock_wifi_set_ap_enabled(home, true);
+        if (!wait_for(&s_connected, connected + 1, 10000)) {
+            fprintf(stderr, "Not reconnected\n");
+            return 1;
+        }
+        samples[i] = (mock_time_now_us() - lost_us) / 1000.0;
+        // Stay connected long enough for the attempt counter to matter, as between real beacon losses
+        mock_sleep_ms(200);
+    }
+    double p50 = percentile(samples, reconnects, 50);
+    double p99 = percentile(samples, reconnects, 99);
+    mock_wifi_timing_t timing = MOCK_WIFI_TIMING_DEFAULT();
+    printf("IP back after a beacon loss: p50 %.0f ms, p99 %.0f ms (connect %u ms + DHCP %u ms in the driver)\n",
+           p50, p99, timing.connect_ms, timing.dhcp_ms);
+
+    wl_wifi_shutdown();
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,834 @@
+/*
+ * Tests of the component on the simulated ESP-IDF of mock/: the reconnect policy, the scan cache with a crowded
+ * band, the provisioning portal end to end and under load, the fast boot paths, and the replay of event traces.
+ * The component keeps its state in statics, so each scenario runs in a process of its own.
+ *
+ *   wl_host_test <scenario>
+ *   wl_host_test trace <file>
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_heap_caps.h"
+#include "mock.h"
+#include "wireless.h"
+#include "wl_conn.h"
+#include "wl_heap.h"
+#include "wl_logic.h"
+#include "wl_scan.h"
+#include "wl_store.h"
+
+// Mock time runs this many times faster than real time, the timeouts of the component are seconds long
+#define TIME_SCALE 20
+// Traces give the times of the events, which the component must keep up with
+#define TRACE_TIME_SCALE 5
+#define CLIENT_IP ESP_IP4TOADDR(192, 168, 4, 2)
+
+static int s_failures;
+
+#define CHECK(expr) do {                                                        \
+        if (!(expr)) {                                                          \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            s_failures++;                                                       \
+        }                                                                       \
+    } while (0)
+
+// Polls a condition every 10 ms of mock time, evaluates to whether it held within the timeout
+#define WAIT_FOR(cond, timeout_ms) ({                                           \
+        int64_t until_us_ = mock_time_now_us() + (timeout_ms) * 1000LL;         \
+        bool held_;                                                             \
+        while (!(held_ = (cond)) && mock_time_now_us() < until_us_) {           \
+            mock_sleep_ms(10);                                                  \
+        }                                                                       \
+        held_;                                                                  \
+    })
+
+// Events delivered to the callback of wl_wifi_start()
+
+static pthread_mutex_t s_events_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t s_event_counts[WL_EVENT_MAX];
+static wl_event_t s_last_events[WL_EVENT_MAX];
+
+static void event_cb(const wl_event_t *event)
+{
+    pthread_mutex_lock(&s_events_lock);
+    s_event_counts[event->id]++;
+    s_last_events[event->id] = *event;
+    pthread_mutex_unlock(&s_events_lock);
+}
+
+static uint32_t event_count(wl_event_id_t id)
+{
+    pthread_mutex_lock(&s_events_lock);
+    uint32_t count = s_event_counts[id];
+    pthread_mutex_unlock(&s_events_lock);
+    return count;
+}
+
+static wl_event_t last_event(wl_event_id_t id)
+{
+    pthread_mutex_lock(&s_events_lock);
+    wl_event_t event = s_last_events[id];
+    pthread_mutex_unlock(&s_events_lock);
+    return event;
+}
+
+static wl_conn_state_t conn_state(void)
+{
+    wl_conn_status_t status;
+    wl_conn_get_status(&status);
+    return status.state;
+}
+
+static uint32_t driver_connects(void)
+{
+    mock_wifi_stats_t stats;
+    mock_wifi_get_stats(&stats);
+    return stats.connects;
+}
+
+// Requests a URI on a session, returns the status code, 0 if the session was closed
+static int http_get(int fd, const char *uri, const char *headers, mock_http_response_t *resp)
+{
+    mock_httpd_request(fd, HTTP_GET, uri, headers, NULL, resp);
+    return resp->closed && resp->status == 0 ? 0 : resp->status;
+}
+
+// Value of a header of a response, "" if it has none
+static const char *resp_header(const mock_http_response_t *resp, const char *name, char *value, size_t size)
+{
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s: ", name);
+    const char *found = strstr(resp->headers, prefix);
+    size_t len = found ? strcspn(found + strlen(prefix), "\r\n") : 0;
+    snprintf(value, size, "%.*s", (int)len, found ? found + strlen(prefix) : "");
+    return value;
+}
+
+// Stores a network, as a previous boot would have
+static void store_network(const char *ssid, const char *password, const uint8_t bssid[6], uint8_t channel,
+                          uint32_t lease_ip)
+{
+    wl_network_t network = { .channel = channel };
+    snprintf(network.ssid, sizeof(network.ssid), "%s", ssid);
+    snprintf(network.password, sizeof(network.password), "%s", password);
+    memcpy(network.bssid, bssid, sizeof(network.bssid));
+    if (lease_ip) {
+        network.lease.ip.addr = lease_ip;
+        network.lease.netmask.addr = ESP_IP4TOADDR(255, 255, 255, 0);
+        network.lease.gw.addr = (lease_ip & ESP_IP4TOADDR(255, 255, 255, 0)) | ESP_IP4TOADDR(0, 0, 0, 1);
+        // The mock's DHCP servers hand out their gateway as DNS server
+        network.dns = network.lease.gw;
+    }
+    CHECK(wl_store_save(&network) == ESP_OK);
+}
+
+// Backoff, JSON escaping and the timing summary, which need no mock
+
+static void test_logic(void)
+{
+    // Equal jitter: between half and all of the capped delay, whatever the random number
+    const uint32_t randoms[] = { 0, 1, 12345, UINT32_MAX / 2, UINT32_MAX };
+    for (uint32_t attempts = 1; attempts <= 40; attempts++) {
+        uint64_t cap = 500ULL << (attempts - 1 < 16 ? attempts - 1 : 16);
+        cap = cap > 60000 ? 60000 : cap;
+        for (size_t i = 0; i < sizeof(randoms) / sizeof(randoms[0]); i++) {
+            uint32_t delay = wl_backoff_delay_ms(attempts, 500, 60000, randoms[i]);
+            CHECK(delay >= cap / 2 && delay <= cap);
+        }
+    }
+    CHECK(wl_backoff_delay_ms(1, 500, 60000, 0) == 250);
+    CHECK(wl_backoff_delay_ms(UINT32_MAX, 500, 60000, UINT32_MAX) <= 60000);
+
+    char out[WL_JSON_SSID_MAX_LEN];
+    CHECK(wl_json_escape(out, sizeof(out), "plain") == 5 && strcmp(out, "plain") == 0);
+    CHECK(wl_json_escape(out, sizeof(out), "a\"b\\c\x01") == 13 && strcmp(out, "a\\\"b\\\\c\\u0001") == 0);
+    // 32 control characters, the worst case
+    char worst[33];
+    memset(worst, '\x1f', 32);
+    worst[32] = '\0';
+    CHECK(wl_json_escape(out, sizeof(out), worst) == 32 * 6);
+    // Truncated between escape sequences, never within one
+    CHECK(wl_json_escape(out, 9, "ab\"cd\x02") == 6 && strcmp(out, "ab\\\"cd") == 0);
+    CHECK(wl_json_escape(out, 1, "abc") == 0 && out[0] == '\0');
+
+    const wl_timing_entry_t entries[] = {
+        { 0, WL_TIMING_START }, { 4, WL_TIMING_NETIF }, { 65, WL_TIMING_WIFI_INIT }, { 74, WL_TIMING_AP_START },
+        { 75, WL_TIMING_STA_START }, { 75, WL_TIMING_CONNECTING }, { 387, WL_TIMING_ASSOCIATED },
+        { 1570, WL_TIMING_GOT_IP }, { 9000, WL_TIMING_DISCONNECTED }, { 9001, WL_TIMING_CONNECTING },
+        { 9400, WL_TIMING_ASSOCIATED }, { 9600, WL_TIMING_GOT_IP },
+    };
+    char line[192];
+    wl_timing_format(line, sizeof(line), entries, 8);
+    CHECK(strcmp(line, "start, netif +4, wifi +61, ap +9, sta +1, connect +0, assoc +312, ip +1183: 1570 ms") == 0);
+    // The last connection starts after the previous one got its IP
+    wl_timing_format(line, sizeof(line), entries, 12);
+    CHECK(strcmp(line, "disconnect, connect +1, assoc +399, ip +200: 600 ms") == 0);
+    CHECK(wl_timing_format(line, 10, entries, 8) == 9 && strlen(line) == 9);
+}
+
+// Reconnect policy of wl_conn, against a driver which only counts the calls
+
+static void test_conn_backoff(void)
+{
+    mock_wifi_set_scripted(true);
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    CHECK(esp_wifi_init(&cfg) == ESP_OK);
+    CHECK(esp_wifi_set_mode(WIFI_MODE_STA) == ESP_OK);
+    CHECK(esp_wifi_start() == ESP_OK);
+    CHECK(wl_conn_init() == ESP_OK);
+
+    wl_conn_start();
+    wl_conn_status_t status;
+    wl_conn_get_status(&status);
+    CHECK(status.state == WL_CONN_CONNECTING && status.total_attempts == 1 && driver_connects() == 1);
+
+    // Unreachable AP: backoff from CONFIG_WL_RECONNECT_BASE_MS, doubling
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_NO_AP_FOUND) == WL_CONN_BACKOFF);
+    wl_conn_get_status(&status);
+    CHECK(status.attempts == 1 && status.next_attempt_ms <= CONFIG_WL_RECONNECT_BASE_MS &&
+          status.next_attempt_ms >= CONFIG_WL_RECONNECT_BASE_MS / 2 - 50);
+    CHECK(WAIT_FOR(driver_connects() == 2, CONFIG_WL_RECONNECT_BASE_MS + 200));
+    CHECK(conn_state() == WL_CONN_CONNECTING);
+
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_NO_AP_FOUND) == WL_CONN_BACKOFF);
+    wl_conn_get_status(&status);
+    CHECK(status.attempts == 2 && status.next_attempt_ms <= 2 * CONFIG_WL_RECONNECT_BASE_MS &&
+          status.next_attempt_ms >= CONFIG_WL_RECONNECT_BASE_MS - 50);
+
+    // Held off while scanning, the attempt falling due meanwhile is made once released
+    wl_conn_hold(true);
+    mock_sleep_ms(2 * CONFIG_WL_RECONNECT_BASE_MS + 200);
+    CHECK(conn_state() == WL_CONN_BACKOFF && driver_connects() == 2);
+    wl_conn_hold(false);
+    CHECK(conn_state() == WL_CONN_CONNECTING && driver_connects() == 3);
+
+    // A lost beacon is retried right away, once
+    wl_conn_notify_connected();
+    CHECK(conn_state() == WL_CONN_CONNECTED);
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_BEACON_TIMEOUT) == WL_CONN_BACKOFF);
+    CHECK(WAIT_FOR(driver_connects() == 4, 100));
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_BEACON_TIMEOUT) == WL_CONN_BACKOFF);
+    wl_conn_get_status(&status);
+    CHECK(status.next_attempt_ms >= CONFIG_WL_RECONNECT_BASE_MS - 50);
+
+    // A rebooting AP: gone, then failing handshakes while it comes up. Only authentication failures in a row
+    // give up, any other outcome starts them again
+    wl_conn_notify_connected();
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_BEACON_TIMEOUT) == WL_CONN_BACKOFF);
+    for (int i = 0; i < 3; i++) {
+        CHECK(wl_conn_notify_disconnected(WIFI_REASON_NO_AP_FOUND) == WL_CONN_BACKOFF);
+    }
+    for (int i = 0; i < CONFIG_WL_RECONNECT_AUTH_RETRIES; i++) {
+        CHECK(wl_conn_notify_disconnected(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) == WL_CONN_BACKOFF);
+    }
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_NO_AP_FOUND) == WL_CONN_BACKOFF);
+    for (int i = 0; i < CONFIG_WL_RECONNECT_AUTH_RETRIES; i++) {
+        CHECK(wl_conn_notify_disconnected(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) == WL_CONN_BACKOFF);
+    }
+    wl_conn_notify_connected();
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) == WL_CONN_BACKOFF);
+    wl_conn_get_status(&status);
+    CHECK(status.attempts == 1);
+
+    // Leaving on purpose is not retried
+    wl_conn_notify_connected();
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_ASSOC_LEAVE) == WL_CONN_IDLE);
+    uint32_t connects = driver_connects();
+    mock_sleep_ms(2 * CONFIG_WL_RECONNECT_BASE_MS);
+    CHECK(conn_state() == WL_CONN_IDLE && driver_connects() == connects);
+
+    // A wrong password is retried CONFIG_WL_RECONNECT_AUTH_RETRIES times, then given up until started again
+    wl_conn_start();
+    connects = driver_connects();
+    for (int i = 0; i < CONFIG_WL_RECONNECT_AUTH_RETRIES; i++) {
+        CHECK(wl_conn_notify_disconnected(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) == WL_CONN_BACKOFF);
+        CHECK(WAIT_FOR(driver_connects() == connects + i + 1, (CONFIG_WL_RECONNECT_BASE_MS << i) + 200));
+    }
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT) == WL_CONN_FAILED);
+    CHECK(wl_conn_notify_disconnected(WIFI_REASON_NO_AP_FOUND) == WL_CONN_FAILED);
+    connects = driver_connects();
+    mock_sleep_ms(4 * CONFIG_WL_RECONNECT_BASE_MS);
+    CHECK(conn_state() == WL_CONN_FAILED && driver_connects() == connects);
+    wl_conn_start();
+    CHECK(conn_state() == WL_CONN_CONNECTING && driver_connects() == connects + 1);
+
+    // A connect the driver refuses, e.g. while scanning, schedules the next attempt itself
+    wl_conn_stop();
+    mock_wifi_set_scripted(false);
+    CHECK(esp_wifi_scan_start(NULL, false) == ESP_OK);
+    wl_conn_start();
+    CHECK(conn_state() == WL_CONN_BACKOFF);
+    esp_wifi_scan_stop();
+
+    wl_conn_deinit();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+}
+
+// Scan cache against 100 BSSs with 32 byte SSIDs, a dual band mesh and a strong BSS off the mesh channel
+
+#define MESH_CHANNEL 6
+
+static void test_scan_100(void)
+{
+    mock_wifi_add_synthetic_aps(100, 32, 7);
+    // The mesh channel wins within CONFIG_WL_MESH_CHANNEL_RSSI_MARGIN dB, not beyond
+    mock_wifi_add_ap(&(mock_ap_t) { .ssid = "MeshHome", .password = "pw", .bssid = { 0x02, 0xAA, 0, 0, 0, 1 },
+                                    .channel = 3, .rssi = -50, .authmode = WIFI_AUTH_WPA2_PSK });
+    mock_wifi_add_ap(&(mock_ap_t) { .ssid = "MeshHome", .password = "pw", .bssid = { 0x02, 0xAA, 0, 0, 0, 2 },
+                                    .channel = MESH_CHANNEL, .rssi = -55, .authmode = WIFI_AUTH_WPA2_PSK });
+    mock_wifi_add_ap(&(mock_ap_t) { .ssid = "FarAway", .password = "pw", .bssid = { 0x02, 0xBB, 0, 0, 0, 1 },
+                                    .channel = 1, .rssi = -40, .authmode = WIFI_AUTH_WPA2_PSK });
+    mock_wifi_add_ap(&(mock_ap_t) { .ssid = "FarAway", .password = "pw", .bssid = { 0x02, 0xBB, 0, 0, 0, 2 },
+                                    .channel = MESH_CHANNEL, .rssi = -60, .authmode = WIFI_AUTH_WPA2_PSK });
+
+    wl_config_t config = WL_CONFIG_DEFAULT();
+    config.ap_channel = MESH_CHANNEL;
+    CHECK(wl_wifi_start(&config, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_PROVISIONING_STARTED) == 1, 1000));
+
+    uint16_t count;
+    const wifi_ap_record_t *records = wl_scan_acquire(&count, pdMS_TO_TICKS(10000));
+    CHECK(records != NULL);
+    bool complete;
+    wl_scan_get_version(&complete);
+    CHECK(complete);
+
+    // Every SSID found once, strongest first, the hidden ones left out
+    size_t expected = 0;
+    for (size_t i = 0; i < mock_wifi_num_aps(); i++) {
+        mock_ap_t ap;
+        mock_wifi_get_ap(i, &ap);
+        bool first = ap.ssid[0] != '\0';
+        for (size_t j = 0; first && j < i; j++) {
+            mock_ap_t other;
+            mock_wifi_get_ap(j, &other);
+            first = strcmp(ap.ssid, other.ssid) != 0;
+        }
+        expected += first;
+        bool found = ap.ssid[0] == '\0';
+        for (uint16_t j = 0; !found && j < count; j++) {
+            found = strcmp((const char *)records[j].ssid, ap.ssid) == 0;
+        }
+        CHECK(found);
+    }
+    CHECK(count == (expected < CONFIG_WL_SCAN_LIST_SIZE ? expected : CONFIG_WL_SCAN_LIST_SIZE));
+    for (uint16_t i = 0; i < count; i++) {
+        CHECK(records[i].ssid[0] != '\0');
+        CHECK(i == 0 || records[i - 1].rssi >= records[i].rssi);
+        for (uint16_t j = 0; j < i; j++) {
+            CHECK(strcmp((const char *)records[i].ssid, (const char *)records[j].ssid) != 0);
+        }
+        if (strcmp((const char *)records[i].ssid, "MeshHome") == 0) {
+            CHECK(records[i].primary == MESH_CHANNEL && records[i].rssi == -55);
+        } else if (strcmp((const char *)records[i].ssid, "FarAway") == 0) {
+            CHECK(records[i].primary == 1 && records[i].rssi == -40);
+        }
+    }
+    wl_scan_release();
+
+    // The page gets the strongest CONFIG_WL_SCAN_API_MAX_APS, escaped
+    int fd = mock_httpd_open_session(CLIENT_IP);
+    mock_http_response_t resp;
+    CHECK(http_get(fd, "/api/scan", NULL, &resp) == 200);
+    CHECK(resp.chunked && strcmp(resp.content_type, "application/json") == 0);
+    CHECK(strstr(resp.body, "\"complete\":true") != NULL);
+    size_t entries = 0;
+    for (const char *p = resp.body; (p = strstr(p, "{\"ssid\":")) != NULL; p++) {
+        entries++;
+    }
+    CHECK(entries == CONFIG_WL_SCAN_API_MAX_APS);
+    CHECK(strstr(resp.body, "\\\"") != NULL || strstr(resp.body, "\\\\") != NULL);
+    mock_http_response_free(&resp);
+
+    // Accounted by the scan task right after the sweep completed
+    wl_heap_stats_t scan_heap;
+    CHECK(WAIT_FOR((wl_heap_get_stats(WL_HEAP_PHASE_SCAN, &scan_heap), scan_heap.runs >= 1), 1000));
+    CHECK(scan_heap.min_free > 0);
+    printf("scan_100: %u unique SSIDs cached, sweep peak heap %zu B, %zu B used now\n", count,
+           scan_heap.peak_used, mock_heap_used());
+}
+
+// A page polling the scan is told it is complete only once a sweep scanned all channels, not before the first one
+// nor while a sweep that could not start waits to be retried
+static void test_scan_aborted(void)
+{
+    mock_wifi_add_synthetic_aps(20, 32, 7);
+    // As while the driver connects
+    mock_wifi_set_scan_error(ESP_ERR_WIFI_STATE);
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_PROVISIONING_STARTED) == 1, 1000));
+
+    int fd = mock_httpd_open_session(CLIENT_IP);
+    mock_http_response_t resp;
+    bool reported_complete = false;
+    for (int i = 0; i < 30 && !reported_complete; i++) {
+        CHECK(http_get(fd, "/api/scan", NULL, &resp) == 200);
+        reported_complete = strstr(resp.body, "\"complete\":true") != NULL;
+        mock_http_response_free(&resp);
+        mock_sleep_ms(100);
+    }
+    CHECK(!reported_complete);
+    mock_wifi_stats_t stats;
+    mock_wifi_get_stats(&stats);
+    CHECK(stats.scans_rejected >= 2);
+
+    mock_wifi_set_scan_error(ESP_OK);
+    CHECK(WAIT_FOR((http_get(fd, "/api/scan", NULL, &resp),
+                    reported_complete = strstr(resp.body, "\"complete\":true") != NULL,
+                    mock_http_response_free(&resp), reported_complete), 10000));
+}
+
+// The provisioning portal end to end: page, scan polling, a wrong then the right password, and the hand over
+
+static void test_portal(void)
+{
+    mock_wifi_add_synthetic_aps(20, 24, 3);
+    int home = mock_wifi_add_ap(&(mock_ap_t) { .ssid = "HomeNet", .password = "secret123",
+                                               .bssid = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 }, .channel = 6,
+                                               .rssi = -50, .authmode = WIFI_AUTH_WPA2_PSK });
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_PROVISIONING_STARTED) == 1, 1000));
+    CHECK(mock_httpd_running() && mock_dns_server_running());
+
+    int fd = mock_httpd_open_session(CLIENT_IP);
+    CHECK(fd >= 0);
+    mock_http_response_t resp;
+    char etag[64];
+    char header[96];
+    CHECK(http_get(fd, "/", NULL, &resp) == 200);
+    CHECK(strcmp(resp.content_type, "text/html") == 0 && resp.body_len > 0);
+    CHECK(strcmp(resp_header(&resp, "Content-Encoding", header, sizeof(header)), "gzip") == 0);
+    resp_header(&resp, "ETag", etag, sizeof(etag));
+    CHECK(etag[0] == '"');
+    mock_http_response_free(&resp);
+    snprintf(header, sizeof(header), "If-None-Match: %s\r\n", etag);
+    CHECK(http_get(fd, "/", header, &resp) == 304 && resp.body_len == 0);
+    mock_http_response_free(&resp);
+
+    // Poll as the page does, until the sweep is complete
+    char uri[48] = "/api/scan";
+    bool complete = false;
+    for (int polls = 0; !complete && polls < 100; polls++) {
+        int status = http_get(fd, uri, NULL, &resp);
+        CHECK(status == 200 || status == 204);
+        if (status == 200) {
+            const char *version = strstr(resp.body, "\"version\":");
+            CHECK(version != NULL);
+            snprintf(uri, sizeof(uri), "/api/scan?since=%lu", version ? strtoul(version + 10, NULL, 10) : 0);
+            complete = strstr(resp.body, "\"complete\":true") != NULL;
+            CHECK(!complete || strstr(resp.body, "\"ssid\":\"HomeNet\"") != NULL);
+        }
+        mock_http_response_free(&resp);
+        mock_sleep_ms(200);
+    }
+    CHECK(complete);
+    CHECK(http_get(fd, uri, NULL, &resp) == 204);
+    mock_http_response_free(&resp);
+
+    // Connectivity checks and unknown URIs get the redirect to the portal
+    CHECK(http_get(fd, "/generate_204", NULL, &resp) == 302);
+    CHECK(strcmp(resp_header(&resp, "Location", header, sizeof(header)), "http://192.168.4.1/") == 0);
+    mock_http_response_free(&resp);
+    CHECK(http_get(fd, "/no/such/page", NULL, &resp) == 302);
+    mock_http_response_free(&resp);
+    CHECK(http_get(fd, "/metrics", NULL, &resp) == 200);
+    CHECK(strstr(resp.body, "dns_processing_time_us_sum") != NULL);
+    mock_http_response_free(&resp);
+
+    // A wrong password is reported through the status
+    CHECK(mock_httpd_request(fd, HTTP_POST, "/submit_provisioning", NULL, "ssid=HomeNet&password=wrong", &resp) ==
+          ESP_OK);
+    CHECK(resp.status == 202);
+    mock_http_response_free(&resp);
+    bool failed = WAIT_FOR(http_get(fd, "/api/status", NULL, &resp) == 200 &&
+                           strstr(resp.body, "\"state\":\"failed\"") != NULL, 5000);
+    CHECK(failed);
+    CHECK(strstr(resp.body, "\"reason\":15") != NULL);
+    mock_http_response_free(&resp);
+
+    CHECK(mock_httpd_request(fd, HTTP_POST, "/submit_provisioning", NULL, "ssid=HomeNet&password=secret123",
+                             &resp) == ESP_OK);
+    CHECK(resp.status == 202);
+    mock_http_response_free(&resp);
+    bool connected = WAIT_FOR(http_get(fd, "/api/status", NULL, &resp) == 200 &&
+                              strstr(resp.body, "\"state\":\"connected\"") != NULL, 10000);
+    CHECK(connected);
+    mock_http_response_free(&resp);
+
+    // The portal lingers so the page can show the outcome, then hands over
+    CHECK(WAIT_FOR(event_count(WL_EVENT_READY) == 1, 10000));
+    CHECK(event_count(WL_EVENT_PROVISIONING_STOPPED) == 1);
+    CHECK(last_event(WL_EVENT_READY).ready.long_range);
+    CHECK(!mock_httpd_running() && !mock_dns_server_running());
+    CHECK(wl_wifi_get_home_channel() == 6);
+
+    wl_network_t network;
+    mock_ap_t ap;
+    mock_wifi_get_ap(home, &ap);
+    CHECK(wl_store_get_latest(&network) == ESP_OK);
+    CHECK(strcmp(network.ssid, "HomeNet") == 0 && strcmp(network.password, "secret123") == 0);
+    CHECK(network.channel == 6 && memcmp(network.bssid, ap.bssid, 6) == 0);
+    CHECK(network.lease.ip.addr == ESP_IP4TOADDR(192, 168, 6, 100));
+
+    wl_heap_stats_t render;
+    wl_heap_stats_t submit;
+    wl_heap_get_stats(WL_HEAP_PHASE_RENDER, &render);
+    wl_heap_get_stats(WL_HEAP_PHASE_SUBMIT, &submit);
+    CHECK(render.runs >= 1 && submit.runs == 2);
+    printf("portal: render peak %zu B, submit peak %zu B, minimum free heap %zu B\n", render.peak_used,
+           submit.peak_used, heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+
+    wl_wifi_shutdown();
+}
+
+// The portal under load: a phone loading the page over parallel connections, more of them than it may keep open
+
+// Connections of the phone, as many as the server has sessions
+#define LOAD_CONNECTIONS (CONFIG_WL_PROV_MAX_CLIENTS * CONFIG_WL_PROV_SOCKETS_PER_CLIENT)
+#define LOAD_ROUNDS 50
+#define LOAD_REQUESTS_PER_SESSION 2
+// Between page loads
+#define LOAD_THINK_MS 200
+
+static const char *const s_load_uris[] = { "/", "/app.js", "/style.css", "/api/scan", "/api/status" };
+
+typedef struct {
+    pthread_t thread;
+    pthread_barrier_t *round;
+    int connection;
+    double latencies_us[LOAD_ROUNDS * LOAD_REQUESTS_PER_SESSION];
+    size_t num_requests;
+    uint32_t resets;        // requests the server closed the session under
+    uint32_t errors;        // other failures
+} load_client_t;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Each round is a page load: the connections are opened together, then each fetches a few URIs, then all are closed
+static void *load_client(void *arg)
+{
+    load_client_t *client = arg;
+    for (int round = 0; round < LOAD_ROUNDS; round++) {
+        pthread_barrier_wait(client->round);
+        int fd = mock_httpd_open_session(CLIENT_IP);
+        // The requests are on their way by the time the last connection is accepted
+        pthread_barrier_wait(client->round);
+        for (int i = 0; i < LOAD_REQUESTS_PER_SESSION; i++) {
+            const char *uri = s_load_uris[(client->connection + round + i) % 5];
+            mock_http_response_t resp;
+            double start = now_us();
+            esp_err_t err = mock_httpd_request(fd, HTTP_GET, uri, NULL, NULL, &resp);
+            client->latencies_us[client->num_requests++] = now_us() - start;
+            if (err == ESP_ERR_INVALID_STATE) {
+                client->resets++;
+            } else if (err != ESP_OK || resp.status != 200) {
+                client->errors++;
+            }
+            mock_http_response_free(&resp);
+        }
+        pthread_barrier_wait(client->round);
+        mock_httpd_close_session(fd);
+        if (client->connection == 0) {
+            mock_sleep_ms(LOAD_THINK_MS);
+        }
+    }
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void test_load(void)
+{
+    mock_wifi_add_synthetic_aps(100, 32, 7);
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_PROVISIONING_STARTED) == 1, 1000));
+
+    // Idle sessions over the limit are closed, the oldest of the client first, those of another client kept
+    int other = mock_httpd_open_session(ESP_IP4TOADDR(192, 168, 4, 3));
+    int fds[CONFIG_WL_PROV_SOCKETS_PER_CLIENT + 1];
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        fds[i] = mock_httpd_open_session(CLIENT_IP);
+        CHECK(fds[i] >= 0);
+        // Past the grace of a new session
+        mock_sleep_ms(600);
+    }
+    CHECK(!mock_httpd_session_is_open(fds[0]));
+    for (size_t i = 1; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        CHECK(mock_httpd_session_is_open(fds[i]));
+        mock_httpd_close_session(fds[i]);
+    }
+    CHECK(mock_httpd_session_is_open(other));
+    mock_httpd_close_session(other);
+
+    // Requests in flight are never cut off, whatever the number of connections of the phone
+    static load_client_t clients[LOAD_CONNECTIONS];
+    pthread_barrier_t round;
+    pthread_barrier_init(&round, NULL, LOAD_CONNECTIONS);
+    for (int i = 0; i < LOAD_CONNECTIONS; i++) {
+        clients[i] = (load_client_t) { .round = &round, .connection = i };
+        pthread_create(&clients[i].thread, NULL, load_client, &clients[i]);
+    }
+    static double latencies_us[LOAD_CONNECTIONS * LOAD_ROUNDS * LOAD_REQUESTS_PER_SESSION];
+    size_t num_requests = 0;
+    uint32_t resets = 0;
+    uint32_t errors = 0;
+    for (int i = 0; i < LOAD_CONNECTIONS; i++) {
+        pthread_join(clients[i].thread, NULL);
+        memcpy(&latencies_us[num_requests], clients[i].latencies_us, clients[i].num_requests * sizeof(double));
+        num_requests += clients[i].num_requests;
+        resets += clients[i].resets;
+        errors += clients[i].errors;
+    }
+    pthread_barrier_destroy(&round);
+    CHECK(resets == 0);
+    CHECK(errors == 0);
+
+    qsort(latencies_us, num_requests, sizeof(double), compare_doubles);
+    printf("load: %d connections, %zu requests, %" PRIu32 " resets, latency p50 %.1f us, p90 %.1f us, "
+           "p99 %.1f us\n", LOAD_CONNECTIONS, num_requests, resets, latencies_us[num_requests / 2],
+           latencies_us[num_requests * 9 / 10], latencies_us[num_requests * 99 / 100]);
+}
+
+// The stored network is reachable: no scan, no portal
+
+static const uint8_t s_home_bssid[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 };
+
+static int add_home(uint8_t channel, bool dhcp)
+{
+    return mock_wifi_add_ap(&(mock_ap_t) { .ssid = "HomeNet", .password = "secret123", .channel = channel,
+                                           .rssi = -50, .authmode = WIFI_AUTH_WPA2_PSK, .no_dhcp = !dhcp,
+                                           .bssid = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x55 } });
+}
+
+static void test_fast_boot(void)
+{
+    add_home(6, true);
+    store_network("HomeNet", "secret123", s_home_bssid, 6, ESP_IP4TOADDR(192, 168, 6, 100));
+    uint32_t commits = mock_nvs_commits();
+
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_READY) == 1, CONFIG_WL_FAST_BOOT_TIMEOUT_MS));
+    mock_wifi_stats_t stats;
+    mock_wifi_get_stats(&stats);
+    CHECK(stats.scans == 0 && stats.connects == 1);
+    CHECK(event_count(WL_EVENT_PROVISIONING_STARTED) == 0);
+    CHECK(mock_netif_sta_dhcpc_running() && mock_netif_sta_ip() == ESP_IP4TOADDR(192, 168, 6, 100));
+    // Same network, same lease: nothing to write
+    CHECK(mock_nvs_commits() == commits);
+
+    wl_timing_entry_t entries[CONFIG_WL_TIMING_HISTORY_SIZE];
+    size_t count = wl_get_timing(entries, CONFIG_WL_TIMING_HISTORY_SIZE);
+    CHECK(count > 0 && entries[0].phase == WL_TIMING_START && entries[count - 1].phase == WL_TIMING_GOT_IP);
+    printf("fast_boot: online %" PRIu32 " ms after start\n", entries[count - 1].time_ms - entries[0].time_ms);
+
+    wl_wifi_shutdown();
+}
+
+// DHCP does not answer after a fast boot: the stored lease is reused, and dropped once the AP is lost
+
+static void test_lease_fallback(void)
+{
+    int home = add_home(6, false);
+    store_network("HomeNet", "secret123", s_home_bssid, 6, ESP_IP4TOADDR(10, 0, 0, 50));
+
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_READY) == 1, CONFIG_WL_FAST_BOOT_TIMEOUT_MS));
+    CHECK(mock_netif_sta_ip() == ESP_IP4TOADDR(10, 0, 0, 50) && !mock_netif_sta_dhcpc_running());
+
+    // Whatever the STA joins next gets its IP through DHCP
+    mock_wifi_set_ap_enabled(home, false);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_STA_DISCONNECTED) >= 1, 1000));
+    CHECK(WAIT_FOR(mock_netif_sta_dhcpc_running(), 1000));
+    CHECK(wl_wifi_get_event_count(WIFI_EVENT_STA_BEACON_TIMEOUT) == 1);
+    mock_wifi_set_ap_dhcp(home, true);
+    mock_wifi_set_ap_enabled(home, true);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_STA_CONNECTED) == 2, 10000));
+    CHECK(mock_netif_sta_ip() == ESP_IP4TOADDR(192, 168, 6, 100));
+
+    wl_wifi_shutdown();
+}
+
+// DHCP is retried while on the stored lease: the lease is applied again while it gets no answer, and replaced once
+// it does, as its address may have been handed to another host since
+
+static void test_lease_retry(void)
+{
+    int home = add_home(6, false);
+    store_network("HomeNet", "secret123", s_home_bssid, 6, ESP_IP4TOADDR(10, 0, 0, 50));
+
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_READY) == 1, CONFIG_WL_FAST_BOOT_TIMEOUT_MS));
+    CHECK(mock_netif_sta_ip() == ESP_IP4TOADDR(10, 0, 0, 50) && !mock_netif_sta_dhcpc_running());
+
+    CHECK(WAIT_FOR(mock_netif_sta_dhcpc_running(), CONFIG_WL_LEASE_DHCP_RETRY_MS + 500));
+    CHECK(WAIT_FOR(!mock_netif_sta_dhcpc_running(), CONFIG_WL_FAST_BOOT_DHCP_TIMEOUT_MS + 500));
+    CHECK(mock_netif_sta_ip() == ESP_IP4TOADDR(10, 0, 0, 50));
+    // The same address again, not a new connection
+    CHECK(event_count(WL_EVENT_STA_CONNECTED) == 1);
+
+    mock_wifi_set_ap_dhcp(home, true);
+    CHECK(WAIT_FOR(mock_netif_sta_ip() == ESP_IP4TOADDR(192, 168, 6, 100),
+                   CONFIG_WL_LEASE_DHCP_RETRY_MS + CONFIG_WL_FAST_BOOT_DHCP_TIMEOUT_MS + 500));
+    CHECK(WAIT_FOR(event_count(WL_EVENT_STA_CONNECTED) == 2, 500));
+    CHECK(last_event(WL_EVENT_STA_CONNECTED).sta_connected.ip_info.ip.addr == ESP_IP4TOADDR(192, 168, 6, 100));
+    // DHCP keeps the address from now on
+    uint32_t connected = event_count(WL_EVENT_STA_CONNECTED);
+    mock_sleep_ms(CONFIG_WL_LEASE_DHCP_RETRY_MS + CONFIG_WL_FAST_BOOT_DHCP_TIMEOUT_MS);
+    CHECK(mock_netif_sta_dhcpc_running() && event_count(WL_EVENT_STA_CONNECTED) == connected);
+
+    wl_wifi_shutdown();
+}
+
+// The stored network moved to another channel and BSS while the portal was up: found again without a submit
+
+static void test_moved_network(void)
+{
+    int home = add_home(6, true);
+    mock_wifi_set_ap_enabled(home, false);
+    store_network("HomeNet", "secret123", s_home_bssid, 6, 0);
+
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_PROVISIONING_STARTED) == 1, CONFIG_WL_FAST_BOOT_TIMEOUT_MS + 15000));
+    CHECK(event_count(WL_EVENT_STA_CONNECTED) == 0);
+
+    const uint8_t moved_bssid[6] = { 0x02, 0x11, 0x22, 0x33, 0x44, 0x66 };
+    mock_wifi_move_ap(home, 11, moved_bssid);
+    mock_wifi_set_ap_enabled(home, true);
+    CHECK(WAIT_FOR(event_count(WL_EVENT_READY) == 1, 2 * CONFIG_WL_RECONNECT_MAX_MS));
+    CHECK(event_count(WL_EVENT_PROVISIONING_STOPPED) == 1);
+    CHECK(wl_wifi_get_home_channel() == 11);
+
+    wl_network_t network;
+    CHECK(wl_store_get_latest(&network) == ESP_OK);
+    CHECK(network.channel == 11 && memcmp(network.bssid, moved_bssid, 6) == 0);
+
+    wl_wifi_shutdown();
+}
+
+// Replay of an event trace against the component, with a driver which only counts the calls
+
+static const char *const s_conn_states[] = {
+    [WL_CONN_IDLE] = "idle",
+    [WL_CONN_CONNECTING] = "connecting",
+    [WL_CONN_BACKOFF] = "backoff",
+    [WL_CONN_CONNECTED] = "connected",
+    [WL_CONN_FAILED] = "failed",
+};
+
+// Checks each key=value of an EXPECT line
+static bool trace_expect(const char *expectation, void *arg)
+{
+    char copy[200];
+    snprintf(copy, sizeof(copy), "%s", expectation);
+    bool holds = true;
+    char *save;
+    for (char *pair = strtok_r(copy, " \t", &save); pair; pair = strtok_r(NULL, " \t", &save)) {
+        char *value = strchr(pair, '=');
+        if (!value) {
+            return false;
+        }
+        *value++ = '\0';
+        wl_conn_status_t status;
+        wl_conn_get_status(&status);
+        unsigned long number = strtoul(value, NULL, 10);
+        bool ok;
+        if (strcmp(pair, "state") == 0) {
+            ok = strcmp(s_conn_states[status.state], value) == 0;
+        } else if (strcmp(pair, "connects") == 0) {
+            ok = driver_connects() == number;
+        } else if (strcmp(pair, "attempts") == 0) {
+            ok = status.total_attempts == number;
+        } else if (strcmp(pair, "home") == 0) {
+            ok = wl_wifi_get_home_channel() == number;
+        } else if (strcmp(pair, "ready") == 0) {
+            ok = event_count(WL_EVENT_READY) == number;
+        } else if (strcmp(pair, "gave_up") == 0) {
+            ok = last_event(WL_EVENT_STA_DISCONNECTED).sta_disconnected.gave_up == (number != 0);
+        } else if (strcmp(pair, "portal") == 0) {
+            ok = mock_httpd_running() == (number != 0);
+        } else if (strcmp(pair, "beacon_timeouts") == 0) {
+            ok = wl_wifi_get_event_count(WIFI_EVENT_STA_BEACON_TIMEOUT) == number;
+        } else {
+            fprintf(stderr, "Unknown expectation %s\n", pair);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s is not %s\n", pair, value);
+            holds = false;
+        }
+    }
+    return holds;
+}
+
+static void test_trace(const char *path)
+{
+    mock_time_set_scale(TRACE_TIME_SCALE);
+    // Fast boot, so the STA connects as soon as it starts
+    store_network("HomeNet", "secret123", s_home_bssid, 6, 0);
+    mock_wifi_set_scripted(true);
+    CHECK(wl_wifi_start(NULL, event_cb) == ESP_OK);
+    CHECK(mock_wifi_play_trace(path, trace_expect, NULL) == ESP_OK);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        void (*run)(void);
+    } scenarios[] = {
+        { "logic", test_logic },
+        { "conn_backoff", test_conn_backoff },
+        { "scan_100", test_scan_100 },
+        { "scan_aborted", test_scan_aborted },
+        { "portal", test_portal },
+        { "load", test_load },
+        { "fast_boot", test_fast_boot },
+        { "lease_fallback", test_lease_fallback },
+        { "lease_retry", test_lease_retry },
+        { "moved_network", test_moved_network },
+    };
+
+    mock_time_set_scale(TIME_SCALE);
+    mock_random_seed(1);
+    if (argc == 3 && strcmp(argv[1], "trace") == 0) {
+        test_trace(argv[2]);
+    } else {
+        size_t i = 0;
+        while (argc == 2 && i < sizeof(scenarios) / sizeof(scenarios[0]) && strcmp(argv[1], scenarios[i].name) != 0) {
+            i++;
+        }
+        if (argc != 2 || i == sizeof(scenarios) / sizeof(scenarios[0])) {
+            fprintf(stderr, "Usage: %s <scenario> | trace <file>\nScenarios:", argv[0]);
+            for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+                fprintf(stderr, " %s", scenarios[i].name);
+            }
+            fputc('\n', stderr);
+            return 2;
+        }
+        scenarios[i].run();
+    }
+
+    if (s_failures > 0) {
+        fprintf(stderr, "%d checks failed\n", s_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+#
+# Minifies and gzips the provisioning web assets and generates a C source file
+# embedding them, along with their ETags, for the HTTP server to serve as is.
+#
+# The assets are served with "Content-Encoding: gzip". Assets referenced from an
+# HTML asset get "?v=<hash>" appended to the reference, so browsers can cache them
+# for good and still fetch the new version after a firmware update.
+
+import argparse
+import gzip
+import hashlib
+import os
+import re
+
+MIME_TYPES = {
+    '.html': 'text/html',
+    '.css': 'text/css',
+    '.js': 'application/javascript',
+}
+
+CACHE_REVALIDATE = 'no-cache'
+CACHE_IMMUTABLE = 'public, max-age=31536000, immutable'
+
+
+def minify_css(text):
+    text = re.sub(r'/\*.*?\*/', '', text, flags=re.S)
+    text = re.sub(r'\s+', ' ', text)
+    text = re.sub(r'\s*([{};:,>])\s*', r'\1', text)
+    return text.replace(';}', '}').strip()
+
+
+def minify_js(text):
+    # Conservative: only drops indentation, blank lines and whole-line comments
+    lines = (line.strip() for line in text.splitlines())
+    return '\n'.join(line for line in lines if line and not line.startswith('//'))
+
+
+def minify_html(text):
+    text = re.sub(r'<!--.*?-->', '', text, flags=re.S)
+    lines = (line.strip() for line in text.splitlines())
+    return '\n'.join(line for line in lines if line)
+
+
+MINIFIERS = {
+    '.html': minify_html,
+    '.css': minify_css,
+    '.js': minify_js,
+}
+
+
+def c_bytes(data):
+    lines = []
+    for i in range(0, len(data), 16):
+        lines.append('    ' + ' '.join('0x%02x,' % b for b in data[i:i + 16]))
+    return '\n'.join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Embed gzipped web assets into a C source file')
+    parser.add_argument('-o', '--output', required=True, help='Generated C source file')
+    parser.add_argument('assets', nargs='+',
+                        help='Web assets, an asset must be listed after the assets it references')
+    args = parser.parse_args()
+
+    versions = {}
+    entries = []
+    for index, path in enumerate(args.assets):
+        name = os.path.basename(path)
+        ext = os.path.splitext(name)[1]
+        if ext not in MIME_TYPES:
+            parser.error('unsupported asset type: ' + path)
+
+        with open(path, encoding='utf-8') as f:
+            text = MINIFIERS[ext](f.read())
+
+        if ext == '.html':
+            for ref, version in versions.items():
+                text = re.sub(r'(["\'])%s\1' % re.escape(ref), r'\g<1>%s?v=%s\g<1>' % (ref, version), text)
+            uri = '/' if name == 'index.html' else '/' + name
+            cache_control = CACHE_REVALIDATE
+        else:
+            uri = '/' + name
+            cache_control = CACHE_IMMUTABLE
+
+        # mtime=0 keeps the output, and so the ETag, reproducible between builds
+        data = gzip.compress(text.encode('utf-8'), compresslevel=9, mtime=0)
+        digest = hashlib.sha256(data).hexdigest()[:16]
+        versions[name] = digest[:8]
+        entries.append((index, uri, MIME_TYPES[ext], cache_control, digest, data))
+
+    with open(args.output, 'w', encoding='utf-8') as out:
+        out.write('// Generated by tools/embed_web_assets.py, do not edit\n\n')
+        out.write('#include "web_assets.h"\n\n')
+        for index, _, _, _, _, data in entries:
+            out.write('static const uint8_t asset_%d[] = {\n%s\n};\n\n' % (index, c_bytes(data)))
+        out.write('const web_asset_t web_assets[] = {\n')
+        for index, uri, mime, cache_control, digest, data in entries:
+            out.write('    { .uri = "%s", .type = "%s", .cache_control = "%s", .etag = "\\"%s\\"", '
+                      '.data = asset_%d, .len = %d },\n' % (uri, mime, cache_control, digest, index, len(data)))
+        out.write('};\n\n')
+        out.write('const size_t web_assets_count = %d;\n' % len(entries))
+
+
+if __name__ == '__main__':
+    main()
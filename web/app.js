@@ -0,0 +1,213 @@
+// The device scans a few channels at a time and returns the networks found so far, deduplicated and
+// sorted by signal strength. Poll until the scan completes, so networks show up as they are found.
+const select = document.querySelector('select[name="ssid"]');
+const SCAN_POLL_MS = 300;
+const SCAN_TIMEOUT_MS = 20000;
+
+// Replaces the listed networks, keeping the placeholder and the selection
+function renderNetworks(networks) {
+  const selected = select.value;
+  while (select.options.length > 1) {
+    select.remove(1);
+  }
+  networks.forEach((network) => {
+    const option = document.createElement("option");
+    option.value = network.ssid;
+    option.textContent = network.ssid;
+    select.appendChild(option);
+  });
+  if (networks.some((network) => network.ssid == selected)) {
+    select.value = selected;
+  } else {
+    select.selectedIndex = 0;
+  }
+}
+
+async function loadNetworks() {
+  let version = null;
+  const deadline = Date.now() + SCAN_TIMEOUT_MS;
+  while (Date.now() < deadline) {
+    try {
+      const query = version === null ? "" : "?since=" + version;
+      const response = await fetch("/api/scan" + query);
+      // 204: nothing new since the last poll
+      if (response.status == 200) {
+        const scan = await response.json();
+        version = scan.version;
+        renderNetworks(scan.aps);
+        if (scan.complete) {
+          return;
+        }
+      }
+    } catch (error) {
+      console.error("Failed to load networks", error);
+    }
+    await new Promise((resolve) => setTimeout(resolve, SCAN_POLL_MS));
+  }
+}
+
+loadNetworks();
+
+// Get system language
+const userLang = navigator.language || navigator.userLanguage;
+
+// Define translations
+const translations = {
+  zh: {
+    selectNetwork: "请选择 Mist 使用的无线网络",
+    password: "无线网络密码",
+    connect: "连接",
+    information: "请注意：Mist 仅支持 2.4GHz 无线网络",
+  },
+  en: {
+    selectNetwork: "Please select a Wifi",
+    password: "Wifi Password",
+    connect: "Connect",
+    information: "Note: Mist only supports 2.4GHz wireless networks",
+  },
+};
+
+// Set default language to English if not Chinese
+const lang = userLang.startsWith("zh") ? "zh" : "en";
+
+// Apply translations when DOM is loaded
+document.addEventListener("DOMContentLoaded", () => {
+  document.querySelector(".information").textContent =
+    translations[lang].information;
+  document.querySelector("select option").textContent =
+    translations[lang].selectNetwork;
+  document.querySelector('input[type="password"]').placeholder =
+    translations[lang].password;
+  document.querySelector(".submit-btn").textContent =
+    translations[lang].connect;
+});
+
+// Animation for submit button and form fields
+document.querySelector("form").addEventListener("submit", async (e) => {
+  e.preventDefault();
+
+  const formElements = document.querySelectorAll("input, select");
+  const submitBtn = document.querySelector(".submit-btn");
+  const informationText = document.querySelector(".information");
+  const formPanel = document.querySelector(".login-form");
+
+  // Get initial height for animation
+  const initialHeight = formPanel.offsetHeight;
+  formPanel.style.height = `${initialHeight}px`;
+
+  // Fade out input and select fields
+  formElements.forEach((field) => {
+    field.disabled = true;
+    field.style.animation = "fadeOutFields 0.5s ease-out forwards";
+
+    field.addEventListener(
+      "animationend",
+      () => {
+        field.style.display = "none";
+        formPanel.style.height = "140px";
+      },
+      { once: true }
+    );
+  });
+
+  // Change button to connecting state
+  submitBtn.classList.add("connecting");
+  submitBtn.textContent = "Connecting...";
+  submitBtn.style.animation = "connectingState 2s infinite ease-in-out";
+  submitBtn.disabled = true;
+
+  // Change information text
+  informationText.textContent =
+    "Connecting to the network, please wait...";
+
+  // Re-enables the form after a failure
+  const resetForm = (message, buttonText) => {
+    informationText.textContent = message;
+    submitBtn.textContent = buttonText;
+    submitBtn.disabled = false;
+    submitBtn.classList.remove("connecting");
+    submitBtn.style.animation = "";
+
+    // Re-enable form fields
+    formElements.forEach((field) => {
+      field.style.display = "block";
+      field.disabled = false;
+      field.style.animation = "fadeIn 0.5s ease-out forwards";
+    });
+    formPanel.style.height = `${initialHeight}px`;
+  };
+
+  try {
+    // Get the form element directly
+    const form = e.target;
+    // Get values directly from select and input elements
+    const ssid = form.querySelector('select[name="ssid"]').value;
+    const password = form.querySelector('input[name="password"]').value;
+    const response = await fetch("/submit_provisioning", {
+      method: "POST",
+      body: "ssid=" + ssid + "&password=" + password,
+    });
+    if (response.status != 202) {
+      throw new Error("Submit rejected: " + response.status);
+    }
+
+    // The device connects in the background, follow its progress
+    const status = await pollStatus();
+    if (status.state == "connected") {
+      informationText.textContent =
+        "Connection successful! Page will be closed shortly.";
+      submitBtn.textContent = "Connected";
+      submitBtn.style.animation = "";
+      submitBtn.style.backgroundColor = "#4caf50"; // Green color
+    } else {
+      resetForm(failureMessage(status), "Connect");
+    }
+  } catch (error) {
+    resetForm("Connection failed. Please try again.", "Retry");
+  }
+});
+
+const STATUS_POLL_MS = 500;
+const STATUS_TIMEOUT_MS = 20000;
+
+const progressMessages = {
+  authenticating: "Connecting to the network, please wait...",
+  dhcp: "Connected to the network, getting an IP address...",
+};
+
+// wifi_err_reason_t values reported when the connection fails
+const REASON_NO_AP_FOUND = 201;
+const WRONG_PASSWORD_REASONS = [2, 15, 202, 204];
+
+function failureMessage(status) {
+  if (status.reason == REASON_NO_AP_FOUND) {
+    return "Network not found. Please try again.";
+  }
+  if (WRONG_PASSWORD_REASONS.includes(status.reason)) {
+    return "Wrong password. Please try again.";
+  }
+  return "Connection failed. Please try again.";
+}
+
+// Polls /api/status until the connection succeeds, fails or times out
+async function pollStatus() {
+  const informationText = document.querySelector(".information");
+  const deadline = Date.now() + STATUS_TIMEOUT_MS;
+  while (Date.now() < deadline) {
+    await new Promise((resolve) => setTimeout(resolve, STATUS_POLL_MS));
+    let status;
+    try {
+      status = await (await fetch("/api/status")).json();
+    } catch (error) {
+      // The portal may be briefly unreachable while the device switches channel
+      continue;
+    }
+    if (status.state == "connected" || status.state == "failed") {
+      return status;
+    }
+    if (progressMessages[status.state]) {
+      informationText.textContent = progressMessages[status.state];
+    }
+  }
+  return { state: "failed", reason: 0 };
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief A gzip compressed web asset embedded at build time by tools/embed_web_assets.py
+ */
+typedef struct {
+    const char *uri;            /**<! URI the asset is served at */
+    const char *type;           /**<! Content-Type of the uncompressed asset */
+    const char *cache_control;  /**<! Cache-Control header value */
+    const char *etag;           /**<! Strong ETag (quoted) derived from the compressed content */
+    const uint8_t *data;        /**<! gzip compressed content */
+    size_t len;                 /**<! Length of the compressed content */
+} web_asset_t;
+
+extern const web_asset_t web_assets[];
+extern const size_t web_assets_count;
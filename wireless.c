@@ -1,23 +1,50 @@
 #include <sys/param.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "esp_timer.h"
 
 #include "nvs_flash.h"
 #include "esp_wifi.h"
 #include "esp_netif.h"
 #include "lwip/inet.h"
+#include "lwip/sockets.h"
 
-#include "esp_http_server.h"
-#include "dns_server.h" 
+#include "freertos/queue.h"
 
-#define MAX_RETRIES    1
-#define DEFAULT_SCAN_LIST_SIZE 100
-#define WIFI_AP_SSID "Mist"
+#include "esp_http_server.h"
+#include "wireless.h"
+#include "dns_server.h"
+#include "wl_scan.h"
+#include "wl_store.h"
+#include "wl_conn.h"
+#include "wl_heap.h"
+#include "wl_timing.h"
+#include "wl_logic.h"
+#include "web_assets.h"
 
-extern const char index_html_start[] asm("_binary_index_html_start");
-extern const char index_html_end[] asm("_binary_index_html_end");
+// How long ranking the stored networks waits for the first sweep to complete, 5 steps of up to 3 channels
+// with the radio back on the home channel in between
+#define FIRST_SCAN_WAIT_MS 10000
+// Sockets left to the HTTP server: it uses 3 internally, and the DNS server runs alongside
+#define HTTPD_SOCKET_BUDGET (CONFIG_LWIP_MAX_SOCKETS - 3 - DNS_SERVER_NUM_OF_SOCKETS)
+#define HTTPD_MAX_OPEN_SOCKETS MIN(CONFIG_WL_PROV_MAX_CLIENTS * CONFIG_WL_PROV_SOCKETS_PER_CLIENT, HTTPD_SOCKET_BUDGET)
+_Static_assert(HTTPD_SOCKET_BUDGET >= 1, "CONFIG_LWIP_MAX_SOCKETS leaves no socket to the provisioning HTTP server");
+// A session gets this long to send its first request before it may be closed to make room
+#define HTTP_SESSION_GRACE_MS 500
+// Largest credentials form accepted
+#define SUBMIT_MAX_LEN 1024
+// Events waiting for the user callback
+#define EVENT_QUEUE_LEN 8
+// Size of the buffer the generated parts of a response are batched in before sending a chunk
+#define RESP_CHUNK_SIZE 256
+// How long the portal stays up once provisioning succeeded, so the page can show it through /api/status
+#define PORTAL_LINGER_MS 3000
 
 static const char *TAG = "Wireless";
 
@@ -26,158 +53,327 @@ static esp_event_handler_instance_t instance_any_id;
 static esp_event_handler_instance_t instance_got_ip;
 
 const int WIFI_CONNECTED_BIT = BIT0;
-static int s_retry_count = 0;
+// The STA gave up connecting, see wl_conn_notify_disconnected()
+const int WIFI_FAILED_BIT = BIT1;
+// Bring-up finished, see wl_wifi_start()
+const int WIFI_READY_BIT = BIT2;
 
 static bool wifi_connected = false;
 
-// This function is called when the root page is requested
-// It scan the wifi ssid and list them in the html page
-static esp_err_t index_get_handler(httpd_req_t *req)
+// Progress of the STA connection, reported to the provisioning page through /api/status
+typedef enum {
+    PROV_STATE_IDLE,
+    PROV_STATE_AUTHENTICATING,
+    PROV_STATE_DHCP,            // associated, waiting for an IP
+    PROV_STATE_CONNECTED,
+    PROV_STATE_FAILED,
+} prov_state_t;
+
+static const char *const s_prov_state_names[] = {
+    [PROV_STATE_IDLE] = "idle",
+    [PROV_STATE_AUTHENTICATING] = "authenticating",
+    [PROV_STATE_DHCP] = "dhcp",
+    [PROV_STATE_CONNECTED] = "connected",
+    [PROV_STATE_FAILED] = "failed",
+};
+
+static volatile prov_state_t s_prov_state = PROV_STATE_IDLE;
+// wifi_err_reason_t of the last failure
+static volatile uint8_t s_prov_reason;
+// Credentials were submitted through the portal
+static bool s_prov_submitted = false;
+
+// Lease of the stored network, applied statically if DHCP does not answer right after a fast boot
+// reconnect; all zero once DHCP answered or the STA disconnected
+static esp_netif_ip_info_t s_fast_boot_lease;
+static esp_ip4_addr_t s_fast_boot_dns;
+static esp_timer_handle_t s_lease_timer;
+// The stored lease is applied statically, the DHCP client is stopped until the next retry
+static volatile bool s_lease_applied;
+// The DHCP client was restarted while on the stored lease, which is applied again if it still gets no answer
+static volatile bool s_lease_dhcp_retry;
+
+static dns_server_handle_t s_dns_server;
+
+static wl_config_t s_config;
+static wl_event_cb_t s_event_cb;
+static QueueHandle_t s_event_queue;
+static TaskHandle_t s_event_task;
+static TaskHandle_t s_event_task_stopper;
+// Channel the radio is on, reported to the application when it changes
+static volatile uint8_t s_home_channel;
+
+#if CONFIG_WL_HEAP_BUDGET
+// The HTTP server handles one request at a time, and the bring-up runs once
+static char s_submit_buf[SUBMIT_MAX_LEN + 1];
+static wl_network_t s_ranked[CONFIG_WL_STORE_MAX_NETWORKS];
+#endif
+
+// Absolute URL of the portal, handed out as DHCP option 114, which keeps a pointer to it
+static char s_portal_url[32];
+// Full HTTP response to the OS captive portal probes, built once the softAP IP is known and sent as is
+static char s_probe_response[256];
+static int s_probe_response_len;
+
+// Connectivity check URLs of Android, Apple, Windows and Firefox. Any answer other than the expected
+// one makes the OS open its captive portal UI, a redirect to the portal also takes it straight to the page
+static const char *const s_probe_uris[] = {
+    "/generate_204",
+    "/gen_204",
+    "/hotspot-detect.html",
+    "/library/test/success.html",
+    "/connecttest.txt",
+    "/ncsi.txt",
+    "/canonical.html",
+    "/success.txt",
+};
+
+// Small fixed buffer used to batch the generated parts of a chunked response
+typedef struct {
+    httpd_req_t *req;
+    esp_err_t err;
+    size_t len;
+    char buf[RESP_CHUNK_SIZE];
+} chunk_writer_t;
+
+static void chunk_flush(chunk_writer_t *w)
 {
-    // Perform Wi-Fi scan
-    uint16_t number = DEFAULT_SCAN_LIST_SIZE;
-    wifi_ap_record_t *ap_info = malloc(number * sizeof(wifi_ap_record_t));
-    if (!ap_info) {
-        ESP_LOGE(TAG, "Failed to allocate memory for AP info");
-        return ESP_ERR_NO_MEM;
+    if (w->len > 0 && w->err == ESP_OK) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
     }
+    w->len = 0;
+}
 
-    wifi_scan_config_t scan_config = {
-        .ssid = NULL,
-        .bssid = NULL,
-        .channel = 0, // Use channel_bitmap instead
-        .show_hidden = false,
-        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
-        .scan_time = {
-            .active = {
-                .min = 100,
-                .max = 300
-            }
-        },
-        // Represents 2.4 GHz channels
-        .channel_bitmap = {
-            .ghz_2_channels = 0x3FFF 
+static void chunk_write(chunk_writer_t *w, const char *data, size_t len)
+{
+    while (len > 0 && w->err == ESP_OK) {
+        size_t n = MIN(len, sizeof(w->buf) - w->len);
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+        if (w->len == sizeof(w->buf)) {
+            chunk_flush(w);
         }
-    };
-    ESP_ERROR_CHECK(esp_wifi_scan_start(&scan_config, true));
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&number));
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&number, ap_info));
-    ESP_LOGI(TAG, "Total APs scanned = %u", number);
-
-    // Generate SSID list HTML
-    size_t ssid_list_html_size = 2048;
-    char *ssid_list_html = malloc(ssid_list_html_size);
-    if (!ssid_list_html) {
-        ESP_LOGE(TAG, "Failed to allocate memory for SSID list HTML");
-        free(ap_info);
-        return ESP_ERR_NO_MEM;
     }
-    strcpy(ssid_list_html, "");
-    for (int i = 0; i < number; i++) {
-        size_t ssid_len = strlen((char *)ap_info[i].ssid);
-        if (strlen(ssid_list_html) + ssid_len + 50 > ssid_list_html_size) {
-            ssid_list_html_size *= 2;
-            ssid_list_html = realloc(ssid_list_html, ssid_list_html_size);
-            if (!ssid_list_html) {
-                ESP_LOGE(TAG, "Failed to reallocate memory for SSID list HTML");
-                free(ap_info);
-                return ESP_ERR_NO_MEM;
-            }
-        }
-        strcat(ssid_list_html, "<option value=\"");
-        strcat(ssid_list_html, (char *)ap_info[i].ssid);
-        strcat(ssid_list_html, "\">");
-        strcat(ssid_list_html, (char *)ap_info[i].ssid);
-        strcat(ssid_list_html, "</option>");
-    }
-    
-    // Read the template HTML into a buffer
-    const uint32_t index_len = index_html_end - index_html_start;
-    char *index_html = malloc(index_len + 1);
-    if (!index_html) {
-        ESP_LOGE(TAG, "Failed to allocate memory for root HTML");
-        free(ssid_list_html);
-        free(ap_info);
-        return ESP_ERR_NO_MEM;
+}
+
+// SSIDs are arbitrary bytes, escape them so they always form a valid JSON string
+static void chunk_write_json_escaped(chunk_writer_t *w, const char *str)
+{
+    char escaped[WL_JSON_SSID_MAX_LEN];
+    chunk_write(w, escaped, wl_json_escape(escaped, sizeof(escaped), str));
+}
+
+// Serves an embedded web asset (user_ctx), which is stored gzip compressed. Every browser
+// accepts gzip, so the content is always sent compressed and never inflated on the device.
+static esp_err_t asset_get_handler(httpd_req_t *req)
+{
+    const web_asset_t *asset = req->user_ctx;
+
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    httpd_resp_set_hdr(req, "Cache-Control", asset->cache_control);
+
+    // The browser already has this exact content
+    char if_none_match[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        strstr(if_none_match, asset->etag) != NULL) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
     }
-    memcpy(index_html, index_html_start, index_len);
-    index_html[index_len] = '\0';
-
-    // Find the SSID_LIST placeholder and replace it
-    char *insert_pos = strstr(index_html, "<!-- SSID_LIST -->");
-    if (insert_pos) {
-        // Calculate required buffer size
-        size_t prefix_len = insert_pos - index_html;
-        size_t suffix_len = strlen(insert_pos + strlen("<!-- SSID_LIST -->"));
-        size_t total_len = prefix_len + strlen(ssid_list_html) + suffix_len + 1;
-        
-        // Create new buffer with the exact size needed
-        char *new_html = malloc(total_len);
-        if (!new_html) {
-            ESP_LOGE(TAG, "Failed to allocate memory for new HTML");
-            free(index_html);
-            free(ssid_list_html);
-            free(ap_info);
-            return ESP_ERR_NO_MEM;
-        }
 
-        // Copy parts into new buffer
-        strncpy(new_html, index_html, prefix_len);
-        strcpy(new_html + prefix_len, ssid_list_html);
-        strcat(new_html, insert_pos + strlen("<!-- SSID_LIST -->"));
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset->data, asset->len);
+}
+
+// What the page gets of a scan record
+typedef struct {
+    char ssid[33];
+    int8_t rssi;
+    uint8_t primary;
+    uint8_t authmode;
+} scan_entry_t;
+
+// Copy of the records sent, so the cache is not locked while a slow client is sent them. The httpd task handles
+// one request at a time.
+static scan_entry_t s_scan_entries[CONFIG_WL_SCAN_API_MAX_APS];
 
-        // Send the response
-        httpd_resp_set_type(req, "text/html");
-        httpd_resp_send(req, new_html, strlen(new_html));
+// Returns the scanned networks, strongest first, one entry per SSID, along with the version of the scan cache:
+// {"version":7,"complete":false,"aps":[{"ssid":"...","rssi":-40,"ch":6,"auth":3},...]}
+// The cache fills up a few channels at a time. A page polls with ?since=<version> until the sweep is complete,
+// and gets 204 No Content while nothing changed, so the networks show up as they are found.
+// Sends the scan results, or 204 if the client's version is still the current one
+static esp_err_t scan_send(httpd_req_t *req)
+{
+    char query[32];
+    char since[12];
+    bool has_since = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+                     httpd_query_key_value(query, "since", since, sizeof(since)) == ESP_OK;
 
-        free(new_html);
-    } else {
-        // If placeholder not found, send original HTML
-        httpd_resp_send(req, index_html, strlen(index_html));
+    // Serve the cached scan results without waiting, the cache refreshes itself in the background when stale
+    uint16_t number = 0;
+    const wifi_ap_record_t *ap_info = wl_scan_acquire(&number, 0);
+    if (!ap_info) {
+        ESP_LOGE(TAG, "Scan cache is not running");
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Scan unavailable");
     }
+    bool complete;
+    uint32_t version = wl_scan_get_version(&complete);
 
-    free(ssid_list_html);
-    free(index_html);
-    free(ap_info);
+    bool unchanged = has_since && strtoul(since, NULL, 10) == version;
+    number = unchanged ? 0 : MIN(number, CONFIG_WL_SCAN_API_MAX_APS);
+    for (int i = 0; i < number; i++) {
+        memcpy(s_scan_entries[i].ssid, ap_info[i].ssid, sizeof(s_scan_entries[i].ssid));
+        s_scan_entries[i].rssi = ap_info[i].rssi;
+        s_scan_entries[i].primary = ap_info[i].primary;
+        s_scan_entries[i].authmode = ap_info[i].authmode;
+    }
+    wl_scan_release();
 
-    return ESP_OK;
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (unchanged) {
+        httpd_resp_set_status(req, "204 No Content");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    httpd_resp_set_type(req, "application/json");
+
+    chunk_writer_t writer = { .req = req, .err = ESP_OK };
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), "{\"version\":%" PRIu32 ",\"complete\":%s,\"aps\":[",
+                              version, complete ? "true" : "false");
+    chunk_write(&writer, header, header_len);
+    for (int i = 0; i < number; i++) {
+        const char *open = i ? ",{\"ssid\":\"" : "{\"ssid\":\"";
+        chunk_write(&writer, open, strlen(open));
+        chunk_write_json_escaped(&writer, s_scan_entries[i].ssid);
+        char fields[48];
+        int len = snprintf(fields, sizeof(fields), "\",\"rssi\":%d,\"ch\":%u,\"auth\":%d}",
+                           s_scan_entries[i].rssi, s_scan_entries[i].primary, s_scan_entries[i].authmode);
+        chunk_write(&writer, fields, len);
+    }
+    chunk_write(&writer, "]}", 2);
+    chunk_flush(&writer);
+
+    if (writer.err == ESP_OK) {
+        writer.err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return writer.err;
 }
 
+static esp_err_t scan_get_handler(httpd_req_t *req)
+{
+    wl_heap_mark_t mark;
+    wl_heap_phase_begin(&mark);
+    esp_err_t err = scan_send(req);
+    wl_heap_phase_end(WL_HEAP_PHASE_RENDER, &mark);
+    return err;
+}
 
-static esp_err_t submit_provisioning_post_handler(httpd_req_t *req) {
-    ESP_LOGI(TAG, "POST request received");
-    // Allocate buffer based on content length
-    char *content = NULL;
+
+#if CONFIG_WL_HTTP_METRICS
+// Exposes the DNS server statistics in the Prometheus text format
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    dns_server_stats_t stats;
+    if (!s_dns_server || dns_server_get_stats(s_dns_server, &stats) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "DNS server not running");
+    }
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    chunk_writer_t writer = { .req = req, .err = ESP_OK };
+    char line[160];
+    int len;
+    const struct {
+        const char *name;
+        uint32_t value;
+    } counters[] = {
+        { "dns_queries_received_total", stats.received },
+        { "dns_queries_answered_total", stats.answered },
+        { "dns_queries_unanswered_total", stats.unanswered },
+        { "dns_queries_not_implemented_total", stats.not_implemented },
+        { "dns_responses_dropped_total", stats.responses },
+        { "dns_queries_malformed_total", stats.malformed },
+        { "dns_replies_truncated_total", stats.truncated },
+        { "dns_send_errors_total", stats.send_errors },
+        { "dns_queries_rate_limited_total", stats.rate_limited },
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        len = snprintf(line, sizeof(line), "# TYPE %s counter\n%s %" PRIu32 "\n",
+                       counters[i].name, counters[i].name, counters[i].value);
+        chunk_write(&writer, line, len);
+    }
+
+    // Prometheus histogram buckets are cumulative
+    uint32_t cumulative = 0;
+    chunk_write(&writer, "# TYPE dns_processing_time_us histogram\n", strlen("# TYPE dns_processing_time_us histogram\n"));
+    for (int i = 0; i < DNS_SERVER_LATENCY_BUCKETS; i++) {
+        cumulative += stats.latency[i];
+        if (i < DNS_SERVER_LATENCY_BUCKETS - 1) {
+            len = snprintf(line, sizeof(line), "dns_processing_time_us_bucket{le=\"%d\"} %" PRIu32 "\n",
+                           DNS_SERVER_LATENCY_BUCKET0_US << i, cumulative);
+        } else {
+            len = snprintf(line, sizeof(line), "dns_processing_time_us_bucket{le=\"+Inf\"} %" PRIu32 "\n"
+                           "dns_processing_time_us_sum %" PRIu64 "\n"
+                           "dns_processing_time_us_count %" PRIu32 "\n", cumulative, stats.latency_sum_us, cumulative);
+        }
+        chunk_write(&writer, line, len);
+    }
+    chunk_flush(&writer);
+
+    if (writer.err != ESP_OK) {
+        return writer.err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+#endif
+
+// Reads the SSID and password of the credentials form
+static esp_err_t read_credentials(httpd_req_t *req, char *ssid, size_t ssid_size, char *password, size_t password_size)
+{
     int content_len = req->content_len;
-    
-    if (content_len <= 0 || content_len > 1024) { // Reasonable max size
+    if (content_len <= 0 || content_len > SUBMIT_MAX_LEN) {
         return ESP_ERR_INVALID_SIZE;
     }
-    
-    content = malloc(content_len + 1);
+
+#if CONFIG_WL_HEAP_BUDGET
+    char *content = s_submit_buf;
+#else
+    char *content = malloc(content_len + 1);
     if (!content) {
         return ESP_ERR_NO_MEM;
     }
+#endif
 
     // Read the POST data
-    int received = httpd_req_recv(req, content, content_len);
-    if (received != content_len) {
-        free(content);
-        return ESP_FAIL;
+    esp_err_t err = ESP_FAIL;
+    if (httpd_req_recv(req, content, content_len) == content_len) {
+        content[content_len] = '\0';
+        if (httpd_query_key_value(content, "ssid", ssid, ssid_size) == ESP_OK &&
+            httpd_query_key_value(content, "password", password, password_size) == ESP_OK) {
+            err = ESP_OK;
+        }
     }
-    content[content_len] = '\0';
+
+#if !CONFIG_WL_HEAP_BUDGET
+    free(content);
+#endif
+    return err;
+}
+
+static esp_err_t submit_provisioning(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "POST request received");
 
     // Allocate buffers for SSID and password
     char ssid[33] = {0};    // Max SSID length + 1
     char password[65] = {0}; // Max WPA2 password length + 1
-    
-    if (httpd_query_key_value(content, "ssid", ssid, sizeof(ssid)) != ESP_OK ||
-        httpd_query_key_value(content, "password", password, sizeof(password)) != ESP_OK) {
-        free(content);
-        return ESP_FAIL;
+    esp_err_t err = read_credentials(req, ssid, sizeof(ssid), password, sizeof(password));
+    if (err != ESP_OK) {
+        return err;
     }
-    
-    free(content);
 
     // Log the parsed ssid and password
     ESP_LOGI(TAG, "SSID: %s, Password: %s", ssid, password);
@@ -187,31 +383,85 @@ static esp_err_t submit_provisioning_post_handler(httpd_req_t *req) {
     esp_wifi_get_config(ESP_IF_WIFI_STA, &sta_config);
     strncpy((char *)sta_config.sta.ssid, ssid, sizeof(sta_config.sta.ssid) - 1);
     strncpy((char *)sta_config.sta.password, password, sizeof(sta_config.sta.password) - 1);
-    // Retry the WiFi connection with the new credentials
-    ESP_ERROR_CHECK(esp_wifi_disconnect());
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
-    ESP_ERROR_CHECK(esp_wifi_connect());
-
-    // Block until IP address is obtained, that is when wifi is connected; or when wifi connection fails
-    const TickType_t xTicksToWait = pdMS_TO_TICKS(5000);
-    xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true, xTicksToWait);
+    // Forget the BSS of the stored network, the new one is found by a scan
+    sta_config.sta.bssid_set = false;
+    sta_config.sta.channel = 0;
+    // Unless the scan found it on the mesh channel, where the radio better stays
+    uint16_t count;
+    const wifi_ap_record_t *records = wl_scan_acquire(&count, 0);
+    if (records) {
+        for (uint16_t i = 0; i < count; i++) {
+            if (strcmp((const char *)records[i].ssid, ssid) == 0 && records[i].primary == s_config.ap_channel) {
+                memcpy(sta_config.sta.bssid, records[i].bssid, sizeof(sta_config.sta.bssid));
+                sta_config.sta.bssid_set = true;
+                sta_config.sta.channel = records[i].primary;
+                break;
+            }
+        }
+        wl_scan_release();
+    }
+    // Retry the WiFi connection with the new credentials, the outcome is reported through /api/status
+    s_prov_reason = 0;
+    s_prov_state = PROV_STATE_AUTHENTICATING;
+    s_prov_submitted = true;
+    wl_conn_stop();
+    esp_wifi_disconnect();
+    err = esp_wifi_set_config(WIFI_IF_STA, &sta_config);
+    if (err == ESP_OK) {
+        wl_conn_start();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to connect: %s", esp_err_to_name(err));
+        s_prov_state = PROV_STATE_FAILED;
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to connect");
+    }
 
+    // Do not hold the httpd task while connecting, the page polls /api/status instead
     httpd_resp_set_type(req, "text/plain");
-    httpd_resp_set_status(req, "200 OK");
-    if(wifi_connected) {
-        // iOS requires content in the response to detect a captive portal, simply redirecting is not sufficient.
-        httpd_resp_send(req, "success", HTTPD_RESP_USE_STRLEN);
-    } else {
-        // iOS requires content in the response to detect a captive portal, simply redirecting is not sufficient.
-        httpd_resp_send(req, "fail", HTTPD_RESP_USE_STRLEN);
-    }
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_send(req, "connecting", HTTPD_RESP_USE_STRLEN);
 
     return ESP_OK;
 }
 
+static esp_err_t submit_provisioning_post_handler(httpd_req_t *req)
+{
+    wl_heap_mark_t mark;
+    wl_heap_phase_begin(&mark);
+    esp_err_t err = submit_provisioning(req);
+    wl_heap_phase_end(WL_HEAP_PHASE_SUBMIT, &mark);
+    return err;
+}
+
+static esp_err_t status_get_handler(httpd_req_t *req)
+{
+    char json[72];
+    prov_state_t state = s_prov_state;
+    wl_conn_status_t conn;
+    wl_conn_get_status(&conn);
+    int len = snprintf(json, sizeof(json), "{\"state\":\"%s\",\"reason\":%u,\"attempts\":%" PRIu32 "}",
+                       s_prov_state_names[state], state == PROV_STATE_FAILED ? s_prov_reason : 0,
+                       conn.total_attempts);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, json, len);
+}
+
+// Sends the precomputed redirect to the portal as is, bypassing the response API
+static esp_err_t send_probe_response(httpd_req_t *req)
+{
+    return httpd_send(req, s_probe_response, s_probe_response_len) == s_probe_response_len ? ESP_OK : ESP_FAIL;
+}
+
 // HTTP Error (404) Handler - Redirects all requests to the root page
 esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
 {
+    if (s_probe_response_len > 0) {
+        ESP_LOGD(TAG, "Redirecting %s to the portal", req->uri);
+        return send_probe_response(req);
+    }
+
     // Set status
     httpd_resp_set_status(req, "302 Temporary Redirect");
     // Redirect to the "/" root directory
@@ -223,32 +473,176 @@ esp_err_t http_404_error_handler(httpd_req_t *req, httpd_err_code_t err)
     return ESP_OK;
 }
 
-static const httpd_uri_t index_uri = {
-    .uri = "/",
+// Answers the OS connectivity checks, which arrive in bursts, without building anything per request
+static esp_err_t probe_get_handler(httpd_req_t *req)
+{
+    if (s_probe_response_len == 0) {
+        return http_404_error_handler(req, HTTPD_404_NOT_FOUND);
+    }
+    return send_probe_response(req);
+}
+
+static const httpd_uri_t scan_uri = {
+    .uri = "/api/scan",
+    .method = HTTP_GET,
+    .handler = scan_get_handler
+};
+
+static const httpd_uri_t status_uri = {
+    .uri = "/api/status",
     .method = HTTP_GET,
-    .handler = index_get_handler
+    .handler = status_get_handler
 };
 
+#if CONFIG_WL_HTTP_METRICS
+static const httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = metrics_get_handler
+};
+#endif
+
 static httpd_uri_t submit_uri = {
     .uri       = "/submit_provisioning",
     .method    = HTTP_POST,
     .handler   = submit_provisioning_post_handler,
 };
 
+// Open HTTP sessions and their client. Only used by the HTTP server task.
+static struct {
+    int fd;             // -1 if the slot is free
+    uint32_t addr;      // IPv4 address of the client
+    uint32_t order;     // the lower the older
+    int64_t opened_us;
+} s_http_sessions[HTTPD_MAX_OPEN_SOCKETS];
+static uint32_t s_http_session_order;
+
+static uint32_t peer_addr(int sockfd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    uint32_t ip4 = 0;
+    if (getpeername(sockfd, (struct sockaddr *)&addr, &len) == 0) {
+        if (addr.ss_family == AF_INET) {
+            ip4 = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+        } else if (addr.ss_family == AF_INET6) {
+            // IPv4-mapped address, the server socket is dual stack
+            memcpy(&ip4, &((struct sockaddr_in6 *)&addr)->sin6_addr.s6_addr[12], sizeof(ip4));
+        }
+    }
+    return ip4;
+}
+
+// Whether a session can be closed without failing a request. The open function runs on the httpd task, between
+// requests: a session is busy if the request it was opened for has not arrived yet, or one is waiting unread.
+static bool http_session_idle(int slot, int64_t now_us)
+{
+    if (now_us - s_http_sessions[slot].opened_us < HTTP_SESSION_GRACE_MS * 1000LL) {
+        return false;
+    }
+    uint8_t byte;
+    // 0 if the client closed its end, -1 with EAGAIN if nothing is waiting
+    return recv(s_http_sessions[slot].fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;
+}
+
+// Keeps each client within CONFIG_WL_PROV_SOCKETS_PER_CLIENT sessions. A phone opens many connections to probe
+// and load the page: its oldest idle session is closed, rather than the least recently used one of any client.
+// Sessions with a request in flight are kept, the page fetches its assets and the scan in parallel.
+static esp_err_t http_session_open(httpd_handle_t hd, int sockfd)
+{
+    uint32_t addr = peer_addr(sockfd);
+    int64_t now_us = esp_timer_get_time();
+    int free_slot = -1;
+    int oldest = -1;
+    int num_of_sessions = 0;
+    for (int i = 0; i < HTTPD_MAX_OPEN_SOCKETS; i++) {
+        if (s_http_sessions[i].fd < 0) {
+            free_slot = i;
+        } else if (s_http_sessions[i].addr == addr) {
+            num_of_sessions++;
+            if ((oldest < 0 || s_http_sessions[i].order < s_http_sessions[oldest].order) &&
+                http_session_idle(i, now_us)) {
+                oldest = i;
+            }
+        }
+    }
+    if (num_of_sessions >= CONFIG_WL_PROV_SOCKETS_PER_CLIENT) {
+        if (oldest >= 0) {
+            ESP_LOGD(TAG, "Client " IPSTR " has %d sessions, closing its oldest idle one", IP2STR((esp_ip4_addr_t *)&addr), num_of_sessions);
+            httpd_sess_trigger_close(hd, s_http_sessions[oldest].fd);
+        } else {
+            ESP_LOGD(TAG, "Client " IPSTR " has %d sessions, all busy", IP2STR((esp_ip4_addr_t *)&addr), num_of_sessions);
+        }
+    }
+    // The server never has more sessions open than there are slots
+    if (free_slot >= 0) {
+        s_http_sessions[free_slot].fd = sockfd;
+        s_http_sessions[free_slot].addr = addr;
+        s_http_sessions[free_slot].order = s_http_session_order++;
+        s_http_sessions[free_slot].opened_us = now_us;
+    }
+    return ESP_OK;
+}
+
+static void http_session_close(httpd_handle_t hd, int sockfd)
+{
+    for (int i = 0; i < HTTPD_MAX_OPEN_SOCKETS; i++) {
+        if (s_http_sessions[i].fd == sockfd) {
+            s_http_sessions[i].fd = -1;
+        }
+    }
+    // Setting close_fn replaces the default close
+    close(sockfd);
+}
+
 static httpd_handle_t start_webserver(void)
 {
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.max_open_sockets = 13;
+    // Sized per client, within what lwIP leaves once the DNS server runs. When full anyway, the least recently
+    // used session is closed.
+    config.max_open_sockets = HTTPD_MAX_OPEN_SOCKETS;
     config.lru_purge_enable = true;
+    config.open_fn = http_session_open;
+    config.close_fn = http_session_close;
+    for (int i = 0; i < HTTPD_MAX_OPEN_SOCKETS; i++) {
+        s_http_sessions[i].fd = -1;
+    }
+    if (CONFIG_WL_PROV_MAX_CLIENTS * CONFIG_WL_PROV_SOCKETS_PER_CLIENT > HTTPD_SOCKET_BUDGET) {
+        ESP_LOGW(TAG, "Only %d HTTP sessions for %d clients, raise CONFIG_LWIP_MAX_SOCKETS",
+                 HTTPD_SOCKET_BUDGET, CONFIG_WL_PROV_MAX_CLIENTS);
+    }
+    // Web assets, probes, and the scan, status, submit and metrics handlers
+    config.max_uri_handlers = web_assets_count + sizeof(s_probe_uris) / sizeof(s_probe_uris[0]) + 4;
 
     // Start the httpd server
     ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
     if (httpd_start(&server, &config) == ESP_OK) {
         // Set URI handlers
         ESP_LOGI(TAG, "Registering URI handlers");
-        httpd_register_uri_handler(server, &index_uri);
+        for (size_t i = 0; i < web_assets_count; i++) {
+            const httpd_uri_t asset_uri = {
+                .uri = web_assets[i].uri,
+                .method = HTTP_GET,
+                .handler = asset_get_handler,
+                .user_ctx = (void *)&web_assets[i],
+            };
+            httpd_register_uri_handler(server, &asset_uri);
+        }
+        for (size_t i = 0; i < sizeof(s_probe_uris) / sizeof(s_probe_uris[0]); i++) {
+            const httpd_uri_t probe_uri = {
+                .uri = s_probe_uris[i],
+                .method = HTTP_GET,
+                .handler = probe_get_handler,
+            };
+            httpd_register_uri_handler(server, &probe_uri);
+        }
+        httpd_register_uri_handler(server, &scan_uri);
+        httpd_register_uri_handler(server, &status_uri);
         httpd_register_uri_handler(server, &submit_uri);
+#if CONFIG_WL_HTTP_METRICS
+        httpd_register_uri_handler(server, &metrics_uri);
+#endif
         httpd_register_err_handler(server, HTTPD_404_NOT_FOUND, http_404_error_handler);
     }
 
@@ -266,193 +660,308 @@ static void dhcp_set_captiveportal_url(void)
     ESP_LOGI(TAG, "Set up softAP with IP: %s", ip_addr);
 
     // turn the IP into a URI
-    char* captiveportal_uri = (char*) malloc(32 * sizeof(char));
-    assert(captiveportal_uri && "Failed to allocate captiveportal_uri");
-    strcpy(captiveportal_uri, "http://");
-    strcat(captiveportal_uri, ip_addr);
+    snprintf(s_portal_url, sizeof(s_portal_url), "http://%s/", ip_addr);
+
+    // iOS requires content in the response to detect a captive portal, simply redirecting is not sufficient.
+    static const char body[] = "Redirect to the captive portal";
+    s_probe_response_len = snprintf(s_probe_response, sizeof(s_probe_response),
+                                    "HTTP/1.1 302 Found\r\n"
+                                    "Location: %s\r\n"
+                                    "Content-Type: text/plain\r\n"
+                                    "Cache-Control: no-store\r\n"
+                                    "Content-Length: %d\r\n"
+                                    "\r\n"
+                                    "%s", s_portal_url, (int)strlen(body), body);
 
     // get a handle to configure DHCP with
     esp_netif_t* netif = esp_netif_get_handle_from_ifkey("WIFI_AP_DEF");
 
     // set the DHCP option 114
     ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_dhcps_stop(netif));
-    ESP_ERROR_CHECK(esp_netif_dhcps_option(netif, ESP_NETIF_OP_SET, ESP_NETIF_CAPTIVEPORTAL_URI, captiveportal_uri, strlen(captiveportal_uri)));
+    ESP_ERROR_CHECK(esp_netif_dhcps_option(netif, ESP_NETIF_OP_SET, ESP_NETIF_CAPTIVEPORTAL_URI, s_portal_url, strlen(s_portal_url)));
     ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_dhcps_start(netif));
 }
 
-/**
- * @brief Event handler for Wi-Fi / IP events
- */
+// Queues an event for the user callback, never blocks the caller, typically the event loop
+static void post_event(const wl_event_t *event)
+{
+    if (s_event_queue && xQueueSend(s_event_queue, event, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Event queue full, dropping event %d", event->id);
+    }
+}
+
+// Delivers the queued events to the user callback, until a WL_EVENT_MAX event is received
+static void event_task(void *arg)
+{
+    wl_event_t event;
+    while (xQueueReceive(s_event_queue, &event, portMAX_DELAY) == pdTRUE && event.id != WL_EVENT_MAX) {
+        s_event_cb(&event);
+    }
+    xTaskNotifyGive(s_event_task_stopper);
+    vTaskDelete(NULL);
+}
+
+// DHCP did not answer in time after a fast boot reconnect, reuse the stored lease. The lease may have expired
+// and its address been handed out since, so DHCP is retried every CONFIG_WL_LEASE_DHCP_RETRY_MS meanwhile.
+static void lease_fallback_cb(void *arg)
+{
+    if (s_fast_boot_lease.ip.addr == 0) {
+        return;
+    }
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if (s_lease_applied) {
+        // Drops the static IP until DHCP answers or the lease is applied again
+        ESP_LOGI(TAG, "Retrying DHCP");
+        s_lease_applied = false;
+        s_lease_dhcp_retry = true;
+        esp_netif_dhcpc_start(netif);
+        esp_timer_start_once(s_lease_timer, CONFIG_WL_FAST_BOOT_DHCP_TIMEOUT_MS * 1000);
+        return;
+    }
+    if (!s_lease_dhcp_retry && wifi_connected) {
+        return;
+    }
+    ESP_LOGW(TAG, "No DHCP answer, reusing lease " IPSTR, IP2STR(&s_fast_boot_lease.ip));
+    esp_netif_dhcpc_stop(netif);
+    s_lease_applied = true;
+    // Posts IP_EVENT_STA_GOT_IP
+    esp_netif_set_ip_info(netif, &s_fast_boot_lease);
+    if (s_fast_boot_dns.addr != 0) {
+        esp_netif_dns_info_t dns = { .ip = { .type = ESP_IPADDR_TYPE_V4, .u_addr.ip4 = s_fast_boot_dns } };
+        esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+}
+
+// Tells the application, so the ESP-NOW mesh can move along right away instead of timing out
+static void set_home_channel(uint8_t channel)
+{
+    uint8_t old_channel = s_home_channel;
+    if (channel == 0 || channel == old_channel) {
+        return;
+    }
+    s_home_channel = channel;
+    ESP_LOGI(TAG, "Home channel %u -> %u", old_channel, channel);
+    post_event(&(wl_event_t) {
+        .id = WL_EVENT_HOME_CHANNEL_CHANGED,
+        .home_channel_changed = { .old_channel = old_channel, .new_channel = channel },
+    });
+}
+
+static void on_sta_disconnected(void *event_data)
+{
+    wl_timing_mark(WL_TIMING_DISCONNECTED);
+    uint8_t reason = ((wifi_event_sta_disconnected_t *)event_data)->reason;
+    wifi_connected = false;
+    if (s_lease_applied || s_lease_dhcp_retry) {
+        // The lease only held for that BSS, whatever the STA joins next gets its IP through DHCP again
+        esp_timer_stop(s_lease_timer);
+        memset(&s_fast_boot_lease, 0, sizeof(s_fast_boot_lease));
+        s_lease_dhcp_retry = false;
+    }
+    if (s_lease_applied) {
+        // Clears the static IP, the client starts once the STA is associated
+        s_lease_applied = false;
+        esp_netif_dhcpc_start(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"));
+    }
+    xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    if (reason != WIFI_REASON_ASSOC_LEAVE) {
+        // The page reports the failure, the state machine keeps retrying in the background
+        s_prov_reason = reason;
+        s_prov_state = PROV_STATE_FAILED;
+    }
+    wl_event_t wl_event = { .id = WL_EVENT_STA_DISCONNECTED, .sta_disconnected.reason = reason };
+    if (wl_conn_notify_disconnected(reason) == WL_CONN_FAILED) {
+        ESP_LOGE(TAG, "Failed to connect to WiFi");
+        xEventGroupSetBits(wifi_event_group, WIFI_FAILED_BIT);
+        wl_event.sta_disconnected.gave_up = true;
+    }
+    post_event(&wl_event);
+}
+
+static void on_sta_start(void *event_data)
+{
+    wl_timing_mark(WL_TIMING_STA_START);
+    wifi_config_t sta_config;
+    // Without a network to connect to, the STA is left alone for the provisioning scans
+    if (esp_wifi_get_config(WIFI_IF_STA, &sta_config) == ESP_OK && sta_config.sta.ssid[0] != '\0') {
+        wl_conn_start();
+        s_prov_state = PROV_STATE_AUTHENTICATING;
+    }
+}
+
+static void on_scan_done(void *event_data)
+{
+    wl_scan_notify_done();
+}
+
+static void on_sta_connected(void *event_data)
+{
+    wl_timing_mark(WL_TIMING_ASSOCIATED);
+    // The radio follows the AP, without a home channel change event on every version of the driver
+    set_home_channel(((wifi_event_sta_connected_t *)event_data)->channel);
+    s_prov_state = PROV_STATE_DHCP;
+    if (s_fast_boot_lease.ip.addr != 0) {
+        esp_timer_start_once(s_lease_timer, CONFIG_WL_FAST_BOOT_DHCP_TIMEOUT_MS * 1000);
+    }
+}
+
+static void on_ap_start(void *event_data)
+{
+    wl_timing_mark(WL_TIMING_AP_START);
+}
+
+static void on_home_channel_change(void *event_data)
+{
+    set_home_channel(((wifi_event_home_channel_change_t *)event_data)->new_chan);
+}
+
+#if CONFIG_WL_EVENT_NAMES
+#define WIFI_EVENT_ENTRY(id, str, fn) [id] = { .name = str, .handle = fn }
+#else
+#define WIFI_EVENT_ENTRY(id, str, fn) [id] = { .handle = fn }
+#endif
+
+// Wi-Fi events by ID, those left out are only counted
+static const struct {
+#if CONFIG_WL_EVENT_NAMES
+    const char *name;
+#endif
+    void (*handle)(void *event_data);
+} s_wifi_events[WIFI_EVENT_MAX] = {
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_DISCONNECTED, "Station disconnected from AP", on_sta_disconnected),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_START, "Station start", on_sta_start),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_WIFI_READY, "Wi-Fi ready", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_SCAN_DONE, "Finished scanning AP", on_scan_done),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_STOP, "Station stop", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_CONNECTED, "Station connected to AP", on_sta_connected),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_AUTHMODE_CHANGE, "The auth mode of AP connected by device's station changed", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_WPS_ER_SUCCESS, "Station WPS succeeds in enrollee mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_WPS_ER_FAILED, "Station WPS fails in enrollee mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_WPS_ER_TIMEOUT, "Station WPS timeout in enrollee mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_WPS_ER_PIN, "Station WPS pin code in enrollee mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_WPS_ER_PBC_OVERLAP, "Station WPS overlap in enrollee mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_START, "Soft-AP start", on_ap_start),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_STOP, "Soft-AP stop", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_STACONNECTED, "A station connected to Soft-AP", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_STADISCONNECTED, "A station disconnected from Soft-AP", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_PROBEREQRECVED, "Receive probe request packet in soft-AP interface", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_FTM_REPORT, "Receive report of FTM procedure", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_BSS_RSSI_LOW, "AP's RSSI crossed configured threshold", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_ACTION_TX_STATUS, "Status indication of Action Tx operation", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_ROC_DONE, "Remain-on-Channel operation complete", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_BEACON_TIMEOUT, "Station beacon timeout", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_CONNECTIONLESS_MODULE_WAKE_INTERVAL_START, "Connectionless module wake interval start", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_WPS_RG_SUCCESS, "Soft-AP wps succeeds in registrar mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_WPS_RG_FAILED, "Soft-AP wps fails in registrar mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_WPS_RG_TIMEOUT, "Soft-AP wps timeout in registrar mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_WPS_RG_PIN, "Soft-AP wps pin code in registrar mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_WPS_RG_PBC_OVERLAP, "Soft-AP wps overlap in registrar mode", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_ITWT_SETUP, "iTWT setup", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_ITWT_TEARDOWN, "iTWT teardown", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_ITWT_PROBE, "iTWT probe", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_ITWT_SUSPEND, "iTWT suspend", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_TWT_WAKEUP, "TWT wakeup", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_BTWT_SETUP, "bTWT setup", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_BTWT_TEARDOWN, "bTWT teardown", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NAN_STARTED, "NAN Discovery has started", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NAN_STOPPED, "NAN Discovery has stopped", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NAN_SVC_MATCH, "NAN Service Discovery match found", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NAN_REPLIED, "Replied to a NAN peer with Service Discovery match", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NAN_RECEIVE, "Received a Follow-up message", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NDP_INDICATION, "Received NDP Request from a NAN Peer", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NDP_CONFIRM, "NDP Confirm Indication", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_NDP_TERMINATED, "NAN Datapath terminated indication", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_HOME_CHANNEL_CHANGE, "Wi-Fi home channel change, doesn't occur when scanning", on_home_channel_change),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_STA_NEIGHBOR_REP, "Received Neighbor Report response", NULL),
+    WIFI_EVENT_ENTRY(WIFI_EVENT_AP_WRONG_PASSWORD, "A station tried to connect with wrong password", NULL),
+};
+
+static uint32_t s_wifi_event_counts[WIFI_EVENT_MAX];
+static struct {
+    wl_wifi_event_hook_t hook;
+    void *arg;
+} s_wifi_event_hooks[WIFI_EVENT_MAX];
+// Keeps each hook with its argument, they are set from any task and read by the event loop
+static portMUX_TYPE s_wifi_event_hooks_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
-    switch (event_id) {
-        case WIFI_EVENT_STA_DISCONNECTED:
-            ESP_LOGI("WiFi Event", "Station disconnected from AP");
-            if (s_retry_count < MAX_RETRIES) {
-                esp_wifi_connect();
-                s_retry_count++;
-                ESP_LOGI(TAG, "Retrying WiFi connection (%d/%d)", s_retry_count, MAX_RETRIES);
-            } else {
-                ESP_LOGE(TAG, "Failed to connect to WiFi");
-                wifi_connected = false;
-                xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-            }
-            break;
-        case WIFI_EVENT_STA_START:
-            ESP_LOGI("WiFi Event", "Station start");
-            esp_wifi_connect();
-            break;
-        case WIFI_EVENT_WIFI_READY:
-            ESP_LOGI("WiFi Event", "Wi-Fi ready");
-            break;
-        case WIFI_EVENT_SCAN_DONE:
-            ESP_LOGI("WiFi Event", "Finished scanning AP");
-            break;
-        case WIFI_EVENT_STA_STOP:
-            ESP_LOGI("WiFi Event", "Station stop");
-            break;
-        case WIFI_EVENT_STA_CONNECTED:
-            ESP_LOGI("WiFi Event", "Station connected to AP");
-            break;
-        case WIFI_EVENT_STA_AUTHMODE_CHANGE:
-            ESP_LOGI("WiFi Event", "The auth mode of AP connected by device's station changed");
-            break;
-        case WIFI_EVENT_STA_WPS_ER_SUCCESS:
-            ESP_LOGI("WiFi Event", "Station WPS succeeds in enrollee mode");
-            break;
-        case WIFI_EVENT_STA_WPS_ER_FAILED:
-            ESP_LOGI("WiFi Event", "Station WPS fails in enrollee mode");
-            break;
-        case WIFI_EVENT_STA_WPS_ER_TIMEOUT:
-            ESP_LOGI("WiFi Event", "Station WPS timeout in enrollee mode");
-            break;
-        case WIFI_EVENT_STA_WPS_ER_PIN:
-            ESP_LOGI("WiFi Event", "Station WPS pin code in enrollee mode");
-            break;
-        case WIFI_EVENT_STA_WPS_ER_PBC_OVERLAP:
-            ESP_LOGI("WiFi Event", "Station WPS overlap in enrollee mode");
-            break;
-        case WIFI_EVENT_AP_START:
-            ESP_LOGI("WiFi Event", "Soft-AP start");
-            break;
-        case WIFI_EVENT_AP_STOP:
-            ESP_LOGI("WiFi Event", "Soft-AP stop");
-            break;
-        case WIFI_EVENT_AP_STACONNECTED:
-            ESP_LOGI("WiFi Event", "A station connected to Soft-AP");
-            break;
-        case WIFI_EVENT_AP_STADISCONNECTED:
-            ESP_LOGI("WiFi Event", "A station disconnected from Soft-AP");
-            break;
-        case WIFI_EVENT_AP_PROBEREQRECVED:
-            ESP_LOGI("WiFi Event", "Receive probe request packet in soft-AP interface");
-            break;
-        case WIFI_EVENT_FTM_REPORT:
-            ESP_LOGI("WiFi Event", "Receive report of FTM procedure");
-            break;
-        case WIFI_EVENT_STA_BSS_RSSI_LOW:
-            ESP_LOGI("WiFi Event", "AP's RSSI crossed configured threshold");
-            break;
-        case WIFI_EVENT_ACTION_TX_STATUS:
-            ESP_LOGI("WiFi Event", "Status indication of Action Tx operation");
-            break;
-        case WIFI_EVENT_ROC_DONE:
-            ESP_LOGI("WiFi Event", "Remain-on-Channel operation complete");
-            break;
-        case WIFI_EVENT_STA_BEACON_TIMEOUT:
-            ESP_LOGI("WiFi Event", "Station beacon timeout");
-            break;
-        case WIFI_EVENT_CONNECTIONLESS_MODULE_WAKE_INTERVAL_START:
-            ESP_LOGI("WiFi Event", "Connectionless module wake interval start");
-            break;
-        case WIFI_EVENT_AP_WPS_RG_SUCCESS:
-            ESP_LOGI("WiFi Event", "Soft-AP wps succeeds in registrar mode");
-            break;
-        case WIFI_EVENT_AP_WPS_RG_FAILED:
-            ESP_LOGI("WiFi Event", "Soft-AP wps fails in registrar mode");
-            break;
-        case WIFI_EVENT_AP_WPS_RG_TIMEOUT:
-            ESP_LOGI("WiFi Event", "Soft-AP wps timeout in registrar mode");
-            break;
-        case WIFI_EVENT_AP_WPS_RG_PIN:
-            ESP_LOGI("WiFi Event", "Soft-AP wps pin code in registrar mode");
-            break;
-        case WIFI_EVENT_AP_WPS_RG_PBC_OVERLAP:
-            ESP_LOGI("WiFi Event", "Soft-AP wps overlap in registrar mode");
-            break;
-        case WIFI_EVENT_ITWT_SETUP:
-            ESP_LOGI("WiFi Event", "iTWT setup");
-            break;
-        case WIFI_EVENT_ITWT_TEARDOWN:
-            ESP_LOGI("WiFi Event", "iTWT teardown");
-            break;
-        case WIFI_EVENT_ITWT_PROBE:
-            ESP_LOGI("WiFi Event", "iTWT probe");
-            break;
-        case WIFI_EVENT_ITWT_SUSPEND:
-            ESP_LOGI("WiFi Event", "iTWT suspend");
-            break;
-        case WIFI_EVENT_TWT_WAKEUP:
-            ESP_LOGI("WiFi Event", "TWT wakeup");
-            break;
-        case WIFI_EVENT_BTWT_SETUP:
-            ESP_LOGI("WiFi Event", "bTWT setup");
-            break;
-        case WIFI_EVENT_BTWT_TEARDOWN:
-            ESP_LOGI("WiFi Event", "bTWT teardown");
-            break;
-        case WIFI_EVENT_NAN_STARTED:
-            ESP_LOGI("WiFi Event", "NAN Discovery has started");
-            break;
-        case WIFI_EVENT_NAN_STOPPED:
-            ESP_LOGI("WiFi Event", "NAN Discovery has stopped");
-            break;
-        case WIFI_EVENT_NAN_SVC_MATCH:
-            ESP_LOGI("WiFi Event", "NAN Service Discovery match found");
-            break;
-        case WIFI_EVENT_NAN_REPLIED:
-            ESP_LOGI("WiFi Event", "Replied to a NAN peer with Service Discovery match");
-            break;
-        case WIFI_EVENT_NAN_RECEIVE:
-            ESP_LOGI("WiFi Event", "Received a Follow-up message");
-            break;
-        case WIFI_EVENT_NDP_INDICATION:
-            ESP_LOGI("WiFi Event", "Received NDP Request from a NAN Peer");
-            break;
-        case WIFI_EVENT_NDP_CONFIRM:
-            ESP_LOGI("WiFi Event", "NDP Confirm Indication");
-            break;
-        case WIFI_EVENT_NDP_TERMINATED:
-            ESP_LOGI("WiFi Event", "NAN Datapath terminated indication");
-            break;
-        case WIFI_EVENT_HOME_CHANNEL_CHANGE:
-            ESP_LOGI("WiFi Event", "Wi-Fi home channel change, doesn't occur when scanning");
-            break;
-        case WIFI_EVENT_STA_NEIGHBOR_REP:
-            ESP_LOGI("WiFi Event", "Received Neighbor Report response");
-            break;
-        case WIFI_EVENT_AP_WRONG_PASSWORD:
-            ESP_LOGI("WiFi Event", "A station tried to connect with wrong password");
-            break;
-        case WIFI_EVENT_MAX:
-            ESP_LOGI("WiFi Event", "Invalid Wi-Fi event ID");
-            break;
-        default:
-            ESP_LOGI("WiFi Event", "Unknown event");
-            break;
+    if (event_id < 0 || event_id >= WIFI_EVENT_MAX) {
+        ESP_LOGW("WiFi Event", "Unknown event %" PRId32, event_id);
+        return;
+    }
+
+    // Only the event loop task writes the counters
+    s_wifi_event_counts[event_id]++;
+#if CONFIG_WL_EVENT_NAMES
+    if (s_wifi_events[event_id].name) {
+        ESP_LOGI("WiFi Event", "%s", s_wifi_events[event_id].name);
+    }
+#else
+    ESP_LOGD("WiFi Event", "Event %" PRId32, event_id);
+#endif
+    if (s_wifi_events[event_id].handle) {
+        s_wifi_events[event_id].handle(event_data);
+    }
+    portENTER_CRITICAL(&s_wifi_event_hooks_lock);
+    wl_wifi_event_hook_t hook = s_wifi_event_hooks[event_id].hook;
+    void *hook_arg = s_wifi_event_hooks[event_id].arg;
+    portEXIT_CRITICAL(&s_wifi_event_hooks_lock);
+    if (hook) {
+        hook(event_id, event_data, hook_arg);
+    }
+}
+
+uint8_t wl_wifi_get_home_channel(void)
+{
+    return s_home_channel;
+}
+
+uint32_t wl_wifi_get_event_count(int32_t event_id)
+{
+    return event_id >= 0 && event_id < WIFI_EVENT_MAX ? s_wifi_event_counts[event_id] : 0;
+}
+
+esp_err_t wl_wifi_set_event_hook(int32_t event_id, wl_wifi_event_hook_t hook, void *arg)
+{
+    if (event_id < 0 || event_id >= WIFI_EVENT_MAX) {
+        return ESP_ERR_INVALID_ARG;
     }
+    portENTER_CRITICAL(&s_wifi_event_hooks_lock);
+    s_wifi_event_hooks[event_id].hook = hook;
+    s_wifi_event_hooks[event_id].arg = arg;
+    portEXIT_CRITICAL(&s_wifi_event_hooks_lock);
+    return ESP_OK;
 }
 
 static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) 
 {
     switch (event_id) {
         case IP_EVENT_STA_GOT_IP:
+            if (s_lease_applied) {
+                // On the stored lease, DHCP is retried in the background
+                esp_timer_start_once(s_lease_timer, CONFIG_WL_LEASE_DHCP_RETRY_MS * 1000ULL);
+                if (s_lease_dhcp_retry) {
+                    // Applied again after a retry, the same address as before
+                    s_lease_dhcp_retry = false;
+                    break;
+                }
+            } else {
+                // DHCP answered, no fallback on later connections
+                esp_timer_stop(s_lease_timer);
+                memset(&s_fast_boot_lease, 0, sizeof(s_fast_boot_lease));
+                s_lease_dhcp_retry = false;
+            }
             // Got IP Address, meaning the device has connected to Wifi successfully
             wifi_connected = true;
-            s_retry_count = 0;
+            wl_conn_notify_connected();
+            s_prov_state = PROV_STATE_CONNECTED;
             ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
             ESP_LOGI(TAG, "Got IP Address: " IPSTR, IP2STR(&event->ip_info.ip));
+            wl_timing_mark(WL_TIMING_GOT_IP);
+            wl_timing_log_summary();
             xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+            post_event(&(wl_event_t) { .id = WL_EVENT_STA_CONNECTED, .sta_connected.ip_info = event->ip_info });
             break;
         case IP_EVENT_STA_LOST_IP:
             ESP_LOGI(TAG, "Lost IP Address");
@@ -464,19 +973,232 @@ static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t eve
     }
 }
 
+// Connects the STA to a network and waits for an IP, or for the connection to fail or time out
+static bool connect_network(const wl_network_t *network)
+{
+    wifi_config_t sta_config = { 0 };
+    strlcpy((char *)sta_config.sta.ssid, network->ssid, sizeof(sta_config.sta.ssid));
+    strlcpy((char *)sta_config.sta.password, network->password, sizeof(sta_config.sta.password));
+    memcpy(sta_config.sta.bssid, network->bssid, sizeof(sta_config.sta.bssid));
+    sta_config.sta.bssid_set = true;
+    sta_config.sta.channel = network->channel;
+    sta_config.sta.scan_method = WIFI_FAST_SCAN;
+
+    ESP_LOGI(TAG, "Connecting to %s on channel %d", network->ssid, network->channel);
+    xEventGroupClearBits(wifi_event_group, WIFI_FAILED_BIT);
+    wl_conn_stop();
+    esp_wifi_disconnect();
+    if (esp_wifi_set_config(WIFI_IF_STA, &sta_config) != ESP_OK) {
+        return false;
+    }
+    wl_conn_start();
+    EventBits_t bits = xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAILED_BIT, false, false,
+                                           pdMS_TO_TICKS(CONFIG_WL_CONNECT_TIMEOUT_MS));
+    return bits & WIFI_CONNECTED_BIT;
+}
+
+// Tries the stored networks found by a scan, best ranked first, Wi-Fi keeps running in between
+static bool connect_known_networks(void)
+{
+#if CONFIG_WL_HEAP_BUDGET
+    wl_network_t *ranked = s_ranked;
+#else
+    wl_network_t *ranked = calloc(CONFIG_WL_STORE_MAX_NETWORKS, sizeof(wl_network_t));
+    if (!ranked) {
+        return false;
+    }
+#endif
+    size_t num_ranked = 0;
+    uint16_t count;
+    const wifi_ap_record_t *records = wl_scan_acquire(&count, pdMS_TO_TICKS(FIRST_SCAN_WAIT_MS));
+    if (records) {
+        num_ranked = wl_store_rank(records, count, ranked);
+        wl_scan_release();
+    }
+
+    bool connected = false;
+    for (size_t i = 0; i < num_ranked && !connected; i++) {
+        connected = connect_network(&ranked[i]);
+    }
+#if !CONFIG_WL_HEAP_BUDGET
+    free(ranked);
+#endif
+    return connected;
+}
+
+// Keeps looking for the last network by SSID on all channels while the portal is up, it may have moved to
+// another BSS or channel since it was stored or ranked
+static void search_latest_network(void)
+{
+    wl_network_t network;
+    if (wl_store_get_latest(&network) != ESP_OK) {
+        return;
+    }
+    wifi_config_t sta_config = { 0 };
+    strlcpy((char *)sta_config.sta.ssid, network.ssid, sizeof(sta_config.sta.ssid));
+    strlcpy((char *)sta_config.sta.password, network.password, sizeof(sta_config.sta.password));
+    sta_config.sta.bssid_set = false;
+    sta_config.sta.channel = 0;
+    sta_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+
+    ESP_LOGI(TAG, "Looking for %s on all channels", network.ssid);
+    wl_conn_stop();
+    esp_wifi_disconnect();
+    if (esp_wifi_set_config(WIFI_IF_STA, &sta_config) == ESP_OK) {
+        wl_conn_start();
+    }
+}
+
+// Serves the provisioning portal until the STA gets an IP
+static void run_provisioning_portal(void)
+{
+    // Configure DNS-based captive portal, if configured
+    dhcp_set_captiveportal_url();
+     // Start the server for the first time
+    httpd_handle_t http_server = start_webserver();
+    // Start the DNS server that will redirect all queries to the softAP IP
+    dns_server_config_t config = DNS_SERVER_CONFIG_SINGLE("*" /* all A queries */, "WIFI_AP_DEF" /* softAP netif ID */);
+#if CONFIG_WL_DNS_RATE_LIMIT_QPS
+    config.rate_limit_qps = CONFIG_WL_DNS_RATE_LIMIT_QPS;
+    config.rate_limit_burst = CONFIG_WL_DNS_RATE_LIMIT_BURST;
+#endif
+    s_dns_server = start_dns_server(&config);
+    wl_timing_mark(WL_TIMING_PORTAL);
+    post_event(&(wl_event_t) { .id = WL_EVENT_PROVISIONING_STARTED });
+
+    // Wait for WiFi connection
+    ESP_LOGI(TAG, "Waiting for WiFi connection...");
+    xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true, portMAX_DELAY);
+    ESP_LOGI(TAG, "WiFi connected!");
+    if (s_prov_submitted) {
+        vTaskDelay(pdMS_TO_TICKS(PORTAL_LINGER_MS));
+    }
+
+    ESP_LOGI(TAG, "Stopping DSN and HTTP server");
+    httpd_stop(http_server);
+    stop_dns_server(s_dns_server);
+    s_dns_server = NULL;
+    post_event(&(wl_event_t) { .id = WL_EVENT_PROVISIONING_STOPPED });
+}
+
+// Stores the network the STA is connected to, so the next boot reconnects to it directly
+static void remember_network(void)
+{
+    wifi_config_t sta_config;
+    wifi_ap_record_t ap_info;
+    esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    esp_netif_dns_info_t dns;
+    if (esp_wifi_get_config(WIFI_IF_STA, &sta_config) != ESP_OK || esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to get the connected network");
+        return;
+    }
+
+    wl_network_t network = { 0 };
+    strlcpy(network.ssid, (const char *)sta_config.sta.ssid, sizeof(network.ssid));
+    strlcpy(network.password, (const char *)sta_config.sta.password, sizeof(network.password));
+    memcpy(network.bssid, ap_info.bssid, sizeof(network.bssid));
+    network.channel = ap_info.primary;
+    esp_netif_get_ip_info(netif, &network.lease);
+    if (esp_netif_get_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK && dns.ip.type == ESP_IPADDR_TYPE_V4) {
+        network.dns = dns.ip.u_addr.ip4;
+    }
+    wl_store_save(&network);
+}
+
+// Waits for the STA to connect, serving the provisioning portal if required, then switches to long range
+static void bringup_task(void *arg)
+{
+    bool fast_boot = (uintptr_t)arg;
+
+    // The portal is only needed if the stored network cannot be reached
+    if (!fast_boot || !(xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true,
+                                            pdMS_TO_TICKS(CONFIG_WL_FAST_BOOT_TIMEOUT_MS)) & WIFI_CONNECTED_BIT)) {
+        if (fast_boot) {
+            ESP_LOGW(TAG, "Last network not reachable, trying the other stored networks");
+            esp_timer_stop(s_lease_timer);
+            memset(&s_fast_boot_lease, 0, sizeof(s_fast_boot_lease));
+            // Retrying the unreachable BSS would keep the ranking sweep from scanning
+            wl_conn_stop();
+            esp_wifi_disconnect();
+        }
+        // One scan serves both ranking the stored networks and the provisioning page
+        ESP_ERROR_CHECK_WITHOUT_ABORT(wl_scan_start(s_config.ap_channel));
+        if (!fast_boot || !connect_known_networks()) {
+            if (fast_boot) {
+                search_latest_network();
+            }
+            run_provisioning_portal();
+        }
+        wl_scan_stop();
+    }
+
+    remember_network();
+
+    wl_event_t event = { .id = WL_EVENT_READY };
+    if (s_config.long_range) {
+        // Start use long range protocols is set for both AP and STA interfaces
+        ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR));
+        ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_AP, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR));
+
+        // Check protocol for STA interface
+        uint8_t protocol;
+        ESP_ERROR_CHECK(esp_wifi_get_protocol(ESP_IF_WIFI_STA, &protocol));
+        event.ready.long_range = protocol & WIFI_PROTOCOL_LR;
+        if (!(protocol & WIFI_PROTOCOL_LR)) {
+            ESP_LOGE(TAG, "Long range protocol is NOT set correctly for STA interface");
+        }
+        // Check protocol for AP interface
+        ESP_ERROR_CHECK(esp_wifi_get_protocol(ESP_IF_WIFI_AP, &protocol));
+        event.ready.long_range &= (protocol & WIFI_PROTOCOL_LR) != 0;
+        if (!(protocol & WIFI_PROTOCOL_LR)) {
+            ESP_LOGE(TAG, "Long range protocol is NOT set correctly for AP interface");
+        }
+    }
+
+    ESP_LOGI(TAG, "WiFi initialized");
+    xEventGroupSetBits(wifi_event_group, WIFI_READY_BIT);
+    post_event(&event);
+    vTaskDelete(NULL);
+}
+
 // Initialize Wi-Fi into AP + STA mode ready for provisioning if required
 // If provisioning is not required, it will turn off the AP and reset to station mode
-void wl_wifi_init() 
+esp_err_t wl_wifi_start(const wl_config_t *config, wl_event_cb_t event_cb)
 {
+    if (wifi_event_group) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_config = config ? *config : (wl_config_t)WL_CONFIG_DEFAULT();
+    s_home_channel = s_config.ap_channel;
+    wl_timing_mark(WL_TIMING_START);
+    wl_heap_mark_t mark;
+    wl_heap_phase_begin(&mark);
+
     // Turn of warnings from HTTP server as AP provisioning redirecting traffic will yield
     // lots of invalid requests
     esp_log_level_set("httpd_uri", ESP_LOG_ERROR);
     esp_log_level_set("httpd_txrx", ESP_LOG_ERROR);
     esp_log_level_set("httpd_parse", ESP_LOG_ERROR);
-    
-    esp_wifi_restore();
-    
+
     wifi_event_group = xEventGroupCreate();
+    if (!wifi_event_group) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Without a callback, nothing is queued
+    if (event_cb) {
+        s_event_cb = event_cb;
+        s_event_queue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(wl_event_t));
+        if (!s_event_queue || xTaskCreate(event_task, "wl_events", 3072, NULL, 5, &s_event_task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start the event task");
+            if (s_event_queue) {
+                vQueueDelete(s_event_queue);
+                s_event_queue = NULL;
+            }
+            vEventGroupDelete(wifi_event_group);
+            wifi_event_group = NULL;
+            return ESP_ERR_NO_MEM;
+        }
+    }
 
     ESP_ERROR_CHECK(esp_netif_init());
     // Default loop for system events, e.g., wifi ip events
@@ -485,10 +1207,21 @@ void wl_wifi_init()
     // Initialize both AP and STA interfaces
     esp_netif_create_default_wifi_ap();
     esp_netif_create_default_wifi_sta();
+    wl_timing_mark(WL_TIMING_NETIF);
 
     // Initialize WiFi with default configuration
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    wl_timing_mark(WL_TIMING_WIFI_INIT);
+    // The network to reconnect to is kept in our own store, along with its BSS and lease
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+
+    const esp_timer_create_args_t lease_timer_args = {
+        .callback = lease_fallback_cb,
+        .name = "wl_lease",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&lease_timer_args, &s_lease_timer));
+    ESP_ERROR_CHECK(wl_conn_init());
 
     // Register event handlers
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL, &instance_any_id));
@@ -503,67 +1236,84 @@ void wl_wifi_init()
     // AP interface does not require a password
     wifi_config_t ap_config = {
         .ap = {
-            .channel = CONFIG_ESPNOW_CHANNEL,
-            .ssid = WIFI_AP_SSID,
+            .channel = s_config.ap_channel,
             .password = "",
             .authmode = WIFI_AUTH_OPEN,
-            .max_connection = 1,
+            .max_connection = CONFIG_WL_PROV_MAX_CLIENTS,
         },
     };
+    // Not NUL terminated when 32 characters long
+    ap_config.ap.ssid_len = strnlen(s_config.ap_ssid, sizeof(ap_config.ap.ssid));
+    memcpy(ap_config.ap.ssid, s_config.ap_ssid, ap_config.ap.ssid_len);
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &ap_config));
 
-    wifi_config_t sta_config;
-    sta_config.sta.channel = CONFIG_ESPNOW_CHANNEL;
-    esp_wifi_get_config(ESP_IF_WIFI_STA, &sta_config);
+    wifi_config_t sta_config = { 0 };
+    wl_network_t network;
+    bool fast_boot = wl_store_get_latest(&network) == ESP_OK;
+    if (fast_boot) {
+        // Directed connect to the BSS of the last connection on its channel, without scanning
+        strlcpy((char *)sta_config.sta.ssid, network.ssid, sizeof(sta_config.sta.ssid));
+        strlcpy((char *)sta_config.sta.password, network.password, sizeof(sta_config.sta.password));
+        memcpy(sta_config.sta.bssid, network.bssid, sizeof(sta_config.sta.bssid));
+        sta_config.sta.bssid_set = true;
+        sta_config.sta.channel = network.channel;
+        sta_config.sta.scan_method = WIFI_FAST_SCAN;
+        s_fast_boot_lease = network.lease;
+        s_fast_boot_dns = network.dns;
+        ESP_LOGI(TAG, "Reconnecting to %s on channel %d", network.ssid, network.channel);
+    }
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &sta_config));
     ESP_ERROR_CHECK(esp_wifi_start());
     ESP_LOGI(TAG, "wifi APSTA starting...");
 
-    // Configure DNS-based captive portal, if configured
-    dhcp_set_captiveportal_url();
-     // Start the server for the first time
-    httpd_handle_t http_server = start_webserver();
-    // Start the DNS server that will redirect all queries to the softAP IP
-    dns_server_config_t config = DNS_SERVER_CONFIG_SINGLE("*" /* all A queries */, "WIFI_AP_DEF" /* softAP netif ID */);
-    dns_server_handle_t dns_server = start_dns_server(&config);
-
-    // Wait for WiFi connection
-    ESP_LOGI(TAG, "Waiting for WiFi connection...");
-    xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT, false, true, portMAX_DELAY);
-    ESP_LOGI(TAG, "WiFi connected!");
-    
-    ESP_LOGI(TAG, "Stopping DSN and HTTP server");
-    httpd_stop(http_server);
-    stop_dns_server(dns_server);
-
-    // Start use long range protocols is set for both AP and STA interfaces
-    ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_STA, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR));
-    ESP_ERROR_CHECK(esp_wifi_set_protocol(ESP_IF_WIFI_AP, WIFI_PROTOCOL_11B|WIFI_PROTOCOL_11G|WIFI_PROTOCOL_11N|WIFI_PROTOCOL_LR));
-
-    // Check protocol for STA interface
-    uint8_t protocol;
-    ESP_ERROR_CHECK(esp_wifi_get_protocol(ESP_IF_WIFI_STA, &protocol));
-    if (!(protocol & WIFI_PROTOCOL_LR)) {
-        ESP_LOGE(TAG, "Long range protocol is NOT set correctly for STA interface");
-    }
-    // Check protocol for AP interface
-    ESP_ERROR_CHECK(esp_wifi_get_protocol(ESP_IF_WIFI_AP, &protocol));
-    if (!(protocol & WIFI_PROTOCOL_LR)) {
-        ESP_LOGE(TAG, "Long range protocol is NOT set correctly for AP interface");
+    // Waiting for the connection and serving the portal may take minutes, do it in the background
+    BaseType_t created = xTaskCreate(bringup_task, "wl_bringup", 4096, (void *)(uintptr_t)fast_boot, 5, NULL);
+    wl_heap_phase_end(WL_HEAP_PHASE_INIT, &mark);
+    if (created != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the bring-up task");
+        return ESP_ERR_NO_MEM;
     }
+    return ESP_OK;
+}
 
-    ESP_LOGI(TAG, "WiFi initialized");
+void wl_wifi_init(void)
+{
+    ESP_ERROR_CHECK(wl_wifi_start(NULL, NULL));
+    xEventGroupWaitBits(wifi_event_group, WIFI_READY_BIT, false, true, portMAX_DELAY);
 }
 
 void wl_wifi_shutdown(void) {
     ESP_LOGI(TAG, "WiFi deinit starting...");
-    // Stop WiFi
+    // Stop WiFi, without reconnecting on the disconnection
+    wl_conn_deinit();
     ESP_ERROR_CHECK(esp_wifi_stop());
     ESP_ERROR_CHECK(esp_wifi_deinit());
 
     // Unregister event handlers
     ESP_ERROR_CHECK(esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, instance_any_id));
     ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, instance_got_ip));
+    esp_timer_stop(s_lease_timer);
+    esp_timer_delete(s_lease_timer);
+    s_lease_timer = NULL;
+    memset(&s_fast_boot_lease, 0, sizeof(s_fast_boot_lease));
+    s_lease_dhcp_retry = false;
+    if (s_lease_applied) {
+        s_lease_applied = false;
+        esp_netif_dhcpc_start(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"));
+    }
+
+    // Deliver the events left, then stop the event task
+    if (s_event_task) {
+        s_event_task_stopper = xTaskGetCurrentTaskHandle();
+        xQueueSend(s_event_queue, &(wl_event_t) { .id = WL_EVENT_MAX }, portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        s_event_task = NULL;
+        vQueueDelete(s_event_queue);
+        s_event_queue = NULL;
+        s_event_cb = NULL;
+    }
+
+    s_home_channel = 0;
 
     // Delete the event group
     if (wifi_event_group) {
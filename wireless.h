@@ -1,5 +1,127 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_netif.h"
+
+/**
+ * @brief Events delivered to the wl_event_cb_t of wl_wifi_start()
+ */
+typedef enum {
+    WL_EVENT_STA_CONNECTED,         /**<! The STA got an IP */
+    WL_EVENT_STA_DISCONNECTED,      /**<! The STA lost its connection or an attempt failed */
+    WL_EVENT_PROVISIONING_STARTED,  /**<! No network could be reached, the portal is up */
+    WL_EVENT_PROVISIONING_STOPPED,  /**<! The STA got an IP, the portal is down */
+    WL_EVENT_READY,                 /**<! Bring-up finished, the long range protocol is set */
+    WL_EVENT_HOME_CHANNEL_CHANGED,  /**<! The radio moved to another channel, e.g. the channel of the AP joined */
+    WL_EVENT_MAX,
+} wl_event_id_t;
+
+/**
+ * @brief Event delivered to the wl_event_cb_t of wl_wifi_start()
+ */
+typedef struct {
+    wl_event_id_t id;
+    union {
+        struct {
+            esp_netif_ip_info_t ip_info;
+        } sta_connected;                /**<! WL_EVENT_STA_CONNECTED */
+        struct {
+            uint8_t reason;             /**<! wifi_err_reason_t of the disconnection */
+            bool gave_up;               /**<! No further attempt is made, see wl_conn_notify_disconnected() */
+        } sta_disconnected;             /**<! WL_EVENT_STA_DISCONNECTED */
+        struct {
+            bool long_range;            /**<! The long range protocol is set on both interfaces */
+        } ready;                        /**<! WL_EVENT_READY */
+        struct {
+            uint8_t old_channel;
+            uint8_t new_channel;
+        } home_channel_changed;         /**<! WL_EVENT_HOME_CHANNEL_CHANGED */
+    };
+} wl_event_t;
+
+/**
+ * @brief Callback receiving the events, called from a task of its own, in order
+ *
+ * It should return quickly: further events are queued meanwhile, and dropped once the queue is full.
+ */
+typedef void (*wl_event_cb_t)(const wl_event_t *event);
+
+/**
+ * @brief Hook called on a Wi-Fi event, from the event loop task, after the event was handled
+ *
+ * @param event_id wifi_event_t
+ * @param event_data Data of the event, as for an esp_event handler
+ * @param arg Argument passed to wl_wifi_set_event_hook()
+ */
+typedef void (*wl_wifi_event_hook_t)(int32_t event_id, void *event_data, void *arg);
+
+/**
+ * @brief Wi-Fi configuration
+ */
+typedef struct {
+    const char *ap_ssid;    /**<! SSID of the softAP, also serving the provisioning portal */
+    uint8_t ap_channel;     /**<! Channel of the softAP */
+    bool long_range;        /**<! Enable the long range protocol on both interfaces once connected */
+} wl_config_t;
+
+#define WL_CONFIG_DEFAULT() {                   \
+    .ap_ssid = "Mist",                          \
+    .ap_channel = CONFIG_ESPNOW_CHANNEL,        \
+    .long_range = true,                         \
+}
+
+/**
+ * @brief Starts Wi-Fi in AP + STA mode without waiting for a connection
+ *
+ * The STA reconnects to the stored networks, and the provisioning portal is served if none can be reached.
+ * Bring-up runs in the background and ends with WL_EVENT_READY, once the STA got an IP.
+ *
+ * @param config Configuration, NULL for WL_CONFIG_DEFAULT(). The SSID must outlive Wi-Fi.
+ * @param event_cb Callback receiving the events, NULL if not needed
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE if already started, ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t wl_wifi_start(const wl_config_t *config, wl_event_cb_t event_cb);
+
+/**
+ * @brief Starts Wi-Fi with the default configuration and blocks until bring-up finished
+ */
 void wl_wifi_init(void);
 
-void wl_wifi_shutdown(void);
\ No newline at end of file
+/**
+ * @brief Stops Wi-Fi, must not be called before bring-up finished
+ */
+void wl_wifi_shutdown(void);
+
+/**
+ * @brief Gets the channel the radio is on, which ESP-NOW peers must use
+ *
+ * It starts on the softAP channel, and follows the STA to the channel of the AP it joins. Changes are also
+ * reported by WL_EVENT_HOME_CHANNEL_CHANGED.
+ *
+ * @return Channel, 0 if Wi-Fi is not started
+ */
+uint8_t wl_wifi_get_home_channel(void);
+
+/**
+ * @brief Gets the number of times a Wi-Fi event was received since boot, e.g. WIFI_EVENT_STA_BEACON_TIMEOUT
+ *
+ * @param event_id wifi_event_t
+ * @return Number of events, 0 for an unknown event
+ */
+uint32_t wl_wifi_get_event_count(int32_t event_id);
+
+/**
+ * @brief Sets the hook called on a Wi-Fi event, replacing the previous one
+ *
+ * May be called from any task, the event loop always gets a hook along with its own argument.
+ *
+ * @param event_id wifi_event_t
+ * @param hook Hook, NULL to remove it
+ * @param arg Argument passed to the hook
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unknown event
+ */
+esp_err_t wl_wifi_set_event_hook(int32_t event_id, wl_wifi_event_hook_t hook, void *arg);
@@ -0,0 +1,204 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "wl_conn.h"
+#include "wl_logic.h"
+#include "wl_timing.h"
+
+typedef enum {
+    POLICY_BACKOFF,         // retry with exponential backoff, forever
+    POLICY_RETRY_NOW,       // retry once right away, then like POLICY_BACKOFF
+    POLICY_AUTH,            // retry with backoff, give up after CONFIG_WL_RECONNECT_AUTH_RETRIES
+    POLICY_NONE,            // the device disconnected on purpose, do not retry
+} reconnect_policy_t;
+
+// Reasons not listed get POLICY_BACKOFF
+static const struct {
+    uint8_t reason;
+    reconnect_policy_t policy;
+} s_reason_policies[] = {
+    { WIFI_REASON_ASSOC_LEAVE, POLICY_NONE },
+    // The AP is most likely still there, a single missed beacon window or a roam is common
+    { WIFI_REASON_BEACON_TIMEOUT, POLICY_RETRY_NOW },
+    { WIFI_REASON_AP_TSF_RESET, POLICY_RETRY_NOW },
+    { WIFI_REASON_ROAMING, POLICY_RETRY_NOW },
+    // Wrong password, retrying forever would only lock the AP's client list
+    { WIFI_REASON_AUTH_EXPIRE, POLICY_AUTH },
+    { WIFI_REASON_AUTH_FAIL, POLICY_AUTH },
+    { WIFI_REASON_MIC_FAILURE, POLICY_AUTH },
+    { WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT, POLICY_AUTH },
+    { WIFI_REASON_HANDSHAKE_TIMEOUT, POLICY_AUTH },
+    { WIFI_REASON_802_1X_AUTH_FAILED, POLICY_AUTH },
+};
+
+static const char *TAG = "Wireless conn";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer;
+static wl_conn_status_t s_status;
+static int64_t s_next_attempt_us;
+static bool s_held;
+// An attempt fell due while held
+static bool s_deferred;
+// Authentication failures in a row, any other outcome resets them: a rebooting AP fails both ways
+static uint32_t s_auth_failures;
+
+static reconnect_policy_t reason_policy(uint8_t reason)
+{
+    for (size_t i = 0; i < sizeof(s_reason_policies) / sizeof(s_reason_policies[0]); i++) {
+        if (s_reason_policies[i].reason == reason) {
+            return s_reason_policies[i].policy;
+        }
+    }
+    return POLICY_BACKOFF;
+}
+
+static void connect_now(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_status.state = WL_CONN_CONNECTING;
+    s_status.total_attempts++;
+    portEXIT_CRITICAL(&s_lock);
+
+    wl_timing_mark(WL_TIMING_CONNECTING);
+    esp_err_t err = esp_wifi_connect();
+    if (err != ESP_OK) {
+        // No disconnection event follows, schedule the next attempt here
+        ESP_LOGW(TAG, "Failed to start connecting: %s", esp_err_to_name(err));
+        wl_conn_notify_disconnected(WIFI_REASON_UNSPECIFIED);
+    }
+}
+
+static void reconnect_timer_cb(void *arg)
+{
+    portENTER_CRITICAL(&s_lock);
+    bool due = s_status.state == WL_CONN_BACKOFF && !s_held;
+    s_deferred = s_status.state == WL_CONN_BACKOFF && s_held;
+    portEXIT_CRITICAL(&s_lock);
+    if (due) {
+        connect_now();
+    }
+}
+
+esp_err_t wl_conn_init(void)
+{
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "wl_reconnect",
+    };
+    memset(&s_status, 0, sizeof(s_status));
+    s_held = false;
+    s_deferred = false;
+    s_auth_failures = 0;
+    return esp_timer_create(&timer_args, &s_timer);
+}
+
+void wl_conn_deinit(void)
+{
+    wl_conn_stop();
+    esp_timer_delete(s_timer);
+    s_timer = NULL;
+}
+
+void wl_conn_start(void)
+{
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_status.attempts = 0;
+    s_auth_failures = 0;
+    s_deferred = false;
+    portEXIT_CRITICAL(&s_lock);
+    connect_now();
+}
+
+void wl_conn_stop(void)
+{
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_status.state = WL_CONN_IDLE;
+    s_deferred = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void wl_conn_hold(bool hold)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_held = hold;
+    bool due = !hold && s_deferred && s_status.state == WL_CONN_BACKOFF;
+    s_deferred = false;
+    portEXIT_CRITICAL(&s_lock);
+    if (due) {
+        connect_now();
+    }
+}
+
+void wl_conn_notify_connected(void)
+{
+    esp_timer_stop(s_timer);
+    portENTER_CRITICAL(&s_lock);
+    s_status.state = WL_CONN_CONNECTED;
+    s_status.attempts = 0;
+    s_auth_failures = 0;
+    s_deferred = false;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+wl_conn_state_t wl_conn_notify_disconnected(uint8_t reason)
+{
+    reconnect_policy_t policy = reason_policy(reason);
+    uint32_t delay_ms = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    s_status.disconnects++;
+    s_status.last_reason = reason;
+    // Leaving on purpose, or a stray event while not connecting: nothing to retry
+    if (policy == POLICY_NONE || s_status.state == WL_CONN_IDLE || s_status.state == WL_CONN_FAILED) {
+        wl_conn_state_t state = s_status.state == WL_CONN_CONNECTED ? WL_CONN_IDLE : s_status.state;
+        s_status.state = state;
+        portEXIT_CRITICAL(&s_lock);
+        return state;
+    }
+    s_status.attempts++;
+    s_auth_failures = policy == POLICY_AUTH ? s_auth_failures + 1 : 0;
+    if (s_auth_failures > CONFIG_WL_RECONNECT_AUTH_RETRIES) {
+        s_status.state = WL_CONN_FAILED;
+        uint32_t auth_failures = s_auth_failures;
+        portEXIT_CRITICAL(&s_lock);
+        ESP_LOGE(TAG, "Giving up after %" PRIu32 " authentication failures in a row, reason %d", auth_failures, reason);
+        return WL_CONN_FAILED;
+    }
+    if (!(policy == POLICY_RETRY_NOW && s_status.attempts == 1)) {
+        delay_ms = wl_backoff_delay_ms(s_status.attempts, CONFIG_WL_RECONNECT_BASE_MS, CONFIG_WL_RECONNECT_MAX_MS,
+                                       esp_random());
+    }
+    s_status.state = WL_CONN_BACKOFF;
+    s_next_attempt_us = esp_timer_get_time() + delay_ms * 1000LL;
+    uint32_t attempts = s_status.attempts;
+    portEXIT_CRITICAL(&s_lock);
+
+    ESP_LOGI(TAG, "Disconnected, reason %d, attempt %" PRIu32 " in %" PRIu32 " ms", reason, attempts, delay_ms);
+    esp_timer_stop(s_timer);
+    esp_timer_start_once(s_timer, delay_ms * 1000ULL);
+    return WL_CONN_BACKOFF;
+}
+
+void wl_conn_get_status(wl_conn_status_t *status)
+{
+    portENTER_CRITICAL(&s_lock);
+    *status = s_status;
+    int64_t next_attempt_us = s_next_attempt_us;
+    portEXIT_CRITICAL(&s_lock);
+
+    status->next_attempt_ms = 0;
+    if (status->state == WL_CONN_BACKOFF) {
+        int64_t left_us = next_attempt_us - esp_timer_get_time();
+        status->next_attempt_ms = left_us > 0 ? left_us / 1000 : 0;
+    }
+}
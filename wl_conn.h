@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/**
+ * @brief State of the STA connection
+ */
+typedef enum {
+    WL_CONN_IDLE,           /**<! Not connecting */
+    WL_CONN_CONNECTING,     /**<! An attempt is in progress */
+    WL_CONN_BACKOFF,        /**<! Waiting before the next attempt */
+    WL_CONN_CONNECTED,      /**<! Got an IP */
+    WL_CONN_FAILED,         /**<! Gave up, e.g. on repeated authentication failures, until wl_conn_start() */
+} wl_conn_state_t;
+
+/**
+ * @brief Snapshot of the STA connection state and counters
+ */
+typedef struct {
+    wl_conn_state_t state;
+    uint32_t attempts;          /**<! Failed attempts since the last connection or wl_conn_start() */
+    uint32_t total_attempts;    /**<! Attempts since wl_conn_init() */
+    uint32_t disconnects;       /**<! Disconnections since wl_conn_init(), failed attempts included */
+    uint8_t last_reason;        /**<! wifi_err_reason_t of the last disconnection, 0 if none */
+    uint32_t next_attempt_ms;   /**<! Time left before the next attempt, in the WL_CONN_BACKOFF state */
+} wl_conn_status_t;
+
+/**
+ * @brief Creates the reconnect timer, must be called before any other function of this module
+ */
+esp_err_t wl_conn_init(void);
+
+/**
+ * @brief Stops reconnecting and deletes the reconnect timer
+ */
+void wl_conn_deinit(void);
+
+/**
+ * @brief Connects the STA with its current configuration right away, resetting the attempt counter
+ */
+void wl_conn_start(void);
+
+/**
+ * @brief Stops reconnecting, e.g. before disconnecting on purpose
+ */
+void wl_conn_stop(void);
+
+/**
+ * @brief Holds the attempts off, e.g. while scanning, as the STA cannot scan while it connects
+ *
+ * An attempt falling due meanwhile is made once released. wl_conn_start() still connects right away.
+ *
+ * @param hold Whether to hold the attempts off
+ */
+void wl_conn_hold(bool hold);
+
+/**
+ * @brief Must be called on IP_EVENT_STA_GOT_IP
+ */
+void wl_conn_notify_connected(void);
+
+/**
+ * @brief Must be called on WIFI_EVENT_STA_DISCONNECTED, schedules the next attempt
+ *
+ * The policy depends on the reason: a lost beacon is retried right away, then with exponential backoff
+ * and jitter like an unreachable AP, up to CONFIG_WL_RECONNECT_MAX_MS between attempts. Authentication
+ * failures, most likely a wrong password, are retried CONFIG_WL_RECONNECT_AUTH_RETRIES times in a row before
+ * giving up, any other failure in between starts the count again. A disconnection requested by the device
+ * itself is not retried.
+ *
+ * @param reason wifi_err_reason_t of the disconnection
+ * @return The new state, WL_CONN_FAILED if the connection was given up
+ */
+wl_conn_state_t wl_conn_notify_disconnected(uint8_t reason);
+
+/**
+ * @brief Gets the state and counters of the STA connection
+ *
+ * @param[out] status Status
+ */
+void wl_conn_get_status(wl_conn_status_t *status);
@@ -0,0 +1,38 @@
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_heap_caps.h"
+
+#include "wl_heap.h"
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static wl_heap_stats_t s_stats[WL_HEAP_PHASE_MAX];
+
+void wl_heap_phase_begin(wl_heap_mark_t *mark)
+{
+    mark->free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    mark->min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+}
+
+void wl_heap_phase_end(wl_heap_phase_t phase, const wl_heap_mark_t *mark)
+{
+    size_t free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    // The minimum since boot only moves on a new low, which then was reached during this run
+    size_t low = min_free < mark->min_free ? min_free : MIN(free, mark->free);
+    size_t used = mark->free > low ? mark->free - low : 0;
+
+    portENTER_CRITICAL(&s_lock);
+    s_stats[phase].min_free = s_stats[phase].runs == 0 ? low : MIN(s_stats[phase].min_free, low);
+    s_stats[phase].runs++;
+    s_stats[phase].peak_used = MAX(s_stats[phase].peak_used, used);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void wl_heap_get_stats(wl_heap_phase_t phase, wl_heap_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *stats = s_stats[phase];
+    portEXIT_CRITICAL(&s_lock);
+}
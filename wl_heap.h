@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Phases of the provisioning path whose heap usage is recorded
+ */
+typedef enum {
+    WL_HEAP_PHASE_INIT,     /**<! wl_wifi_start(), up to the background bring-up */
+    WL_HEAP_PHASE_SCAN,     /**<! A scan, from its start to the collection of its results */
+    WL_HEAP_PHASE_RENDER,   /**<! Generating the network list of the provisioning page */
+    WL_HEAP_PHASE_SUBMIT,   /**<! Handling the credentials submitted through the portal */
+    WL_HEAP_PHASE_MAX,
+} wl_heap_phase_t;
+
+/**
+ * @brief Heap usage of a phase, over all its runs since boot
+ *
+ * The heap is shared, so allocations made by other tasks while a phase runs are accounted to it too.
+ */
+typedef struct {
+    uint32_t runs;          /**<! Number of times the phase ran */
+    size_t peak_used;       /**<! Largest drop of the free heap below its size at the start of a run */
+    size_t min_free;        /**<! Lowest free heap during a run, 0 if the phase never ran */
+} wl_heap_stats_t;
+
+/**
+ * @brief State of the heap at the start of a run, see wl_heap_phase_begin()
+ */
+typedef struct {
+    size_t free;
+    size_t min_free;
+} wl_heap_mark_t;
+
+/**
+ * @brief Records the state of the heap at the start of a run of a phase
+ *
+ * @param[out] mark State to pass to wl_heap_phase_end()
+ */
+void wl_heap_phase_begin(wl_heap_mark_t *mark);
+
+/**
+ * @brief Accounts the heap usage of a run of a phase
+ *
+ * The lowest point of the run is exact when it is the lowest since boot, which is what bounds the worst-case
+ * footprint. Otherwise, transient allocations freed before the end of the run are not seen.
+ *
+ * @param phase Phase
+ * @param mark State recorded by wl_heap_phase_begin() at the start of the run
+ */
+void wl_heap_phase_end(wl_heap_phase_t phase, const wl_heap_mark_t *mark);
+
+/**
+ * @brief Gets the heap usage of a phase
+ *
+ * @param phase Phase
+ * @param[out] stats Heap usage
+ */
+void wl_heap_get_stats(wl_heap_phase_t phase, wl_heap_stats_t *stats);
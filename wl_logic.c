@@ -0,0 +1,75 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wl_logic.h"
+
+static const char *const s_phase_names[WL_TIMING_MAX] = {
+    [WL_TIMING_START] = "start",
+    [WL_TIMING_NETIF] = "netif",
+    [WL_TIMING_WIFI_INIT] = "wifi",
+    [WL_TIMING_AP_START] = "ap",
+    [WL_TIMING_STA_START] = "sta",
+    [WL_TIMING_SCAN_DONE] = "scan",
+    [WL_TIMING_PORTAL] = "portal",
+    [WL_TIMING_CONNECTING] = "connect",
+    [WL_TIMING_ASSOCIATED] = "assoc",
+    [WL_TIMING_DISCONNECTED] = "disconnect",
+    [WL_TIMING_GOT_IP] = "ip",
+};
+
+uint32_t wl_backoff_delay_ms(uint32_t attempts, uint32_t base_ms, uint32_t max_ms, uint32_t random)
+{
+    uint32_t shift = attempts - 1 < 16 ? attempts - 1 : 16;
+    uint64_t delay_ms = (uint64_t)base_ms << shift;
+    if (delay_ms > max_ms) {
+        delay_ms = max_ms;
+    }
+    return delay_ms / 2 + random % (delay_ms / 2 + 1);
+}
+
+size_t wl_json_escape(char *out, size_t out_size, const char *str)
+{
+    size_t len = 0;
+    for (; *str; str++) {
+        unsigned char c = *str;
+        char escaped[8];
+        size_t n;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            escaped[0] = c;
+            n = 1;
+        } else if (c == '"' || c == '\\') {
+            n = snprintf(escaped, sizeof(escaped), "\\%c", c);
+        } else {
+            n = snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        }
+        // Never split an escape sequence
+        if (len + n >= out_size) {
+            break;
+        }
+        memcpy(out + len, escaped, n);
+        len += n;
+    }
+    if (out_size > 0) {
+        out[len] = '\0';
+    }
+    return len;
+}
+
+size_t wl_timing_format(char *line, size_t size, const wl_timing_entry_t *entries, size_t count)
+{
+    size_t first = count - 1;
+    while (first > 0 && entries[first - 1].phase != WL_TIMING_GOT_IP && entries[first].phase != WL_TIMING_START) {
+        first--;
+    }
+
+    int len = snprintf(line, size, "%s", s_phase_names[entries[first].phase]);
+    for (size_t i = first + 1; i < count && len < (int)size; i++) {
+        len += snprintf(line + len, size - len, ", %s +%" PRIu32, s_phase_names[entries[i].phase],
+                        entries[i].time_ms - entries[i - 1].time_ms);
+    }
+    if (len < (int)size) {
+        len += snprintf(line + len, size - len, ": %" PRIu32 " ms", entries[count - 1].time_ms - entries[first].time_ms);
+    }
+    return len < (int)size ? (size_t)len : size - 1;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/*
+ * Decision and formatting logic of the provisioning path: reconnect backoff, JSON escaping of SSIDs and the
+ * timing summary.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wl_timing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Room for a JSON escaped SSID: 32 bytes, each escaped as \u00XX at worst, and the terminator
+#define WL_JSON_SSID_MAX_LEN (32 * 6 + 1)
+
+/**
+ * @brief Delay before a reconnection attempt: exponential backoff with "equal jitter"
+ *
+ * Half the delay is fixed, the other half random, so devices losing the same AP at the same time spread their
+ * attempts.
+ *
+ * @param attempts Failed attempts so far, at least 1
+ * @param base_ms Delay after the first failed attempt, doubled after each further one
+ * @param max_ms Cap of the delay
+ * @param random Uniformly distributed random number
+ * @return Delay in milliseconds, between half and all of the capped delay
+ */
+uint32_t wl_backoff_delay_ms(uint32_t attempts, uint32_t base_ms, uint32_t max_ms, uint32_t random);
+
+/**
+ * @brief Escapes a string, e.g. an SSID which can hold arbitrary bytes, so it forms a valid JSON string
+ *
+ * @param[out] out Escaped string, NUL terminated, truncated if it does not fit
+ * @param out_size Size of `out`, WL_JSON_SSID_MAX_LEN for any SSID
+ * @param str String, without the quotes
+ * @return Length of the escaped string
+ */
+size_t wl_json_escape(char *out, size_t out_size, const char *str);
+
+/**
+ * @brief Formats the time between the milestones of the last connection
+ *
+ * The last connection starts after the previous WL_TIMING_GOT_IP, or at WL_TIMING_START.
+ * e.g. "start, netif +4, wifi +61, ap +9, sta +1, connect +0, assoc +312, ip +1183: 1570 ms"
+ *
+ * @param[out] line Summary, NUL terminated, truncated if it does not fit
+ * @param size Size of `line`
+ * @param entries Milestones, oldest first
+ * @param count Number of milestones, at least 1
+ * @return Length of the summary, possibly truncated
+ */
+size_t wl_timing_format(char *line, size_t size, const wl_timing_entry_t *entries, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+
+#include "wl_scan.h"
+#include "wl_conn.h"
+#include "wl_heap.h"
+#include "wl_timing.h"
+
+#define SCAN_REFRESH_BIT   BIT0    // a refresh was requested
+#define SCAN_DONE_BIT      BIT1    // WIFI_EVENT_SCAN_DONE was received
+#define SCAN_STOP_BIT      BIT2    // the scan task should exit
+#define SCAN_EXITED_BIT    BIT3    // the scan task has exited
+#define SCAN_READY_BIT     BIT4    // the cache holds the results of at least one scan
+
+// A sweep scans all channels in steps of a few channels, merging the results of each step into the cache,
+// so the first networks show up long before the sweep completes. The usual 1, 6 and 11 come first.
+// Bit n stands for channel n, as in wifi_2g_channel_bit_t
+#define CH(n) (1 << (n))
+static const uint16_t s_scan_steps[] = {
+    CH(1) | CH(6) | CH(11),
+    CH(2) | CH(3) | CH(4),
+    CH(5) | CH(7) | CH(8),
+    CH(9) | CH(10) | CH(12),
+    CH(13) | CH(14),
+};
+#define NUM_OF_SCAN_STEPS (sizeof(s_scan_steps) / sizeof(s_scan_steps[0]))
+
+// An active scan of 3 channels takes up to 3 * 300 ms
+#define SCAN_STEP_TIMEOUT_MS   2000
+// Delay before retrying a scan that could not be started, e.g. while the STA is connecting
+#define SCAN_RETRY_DELAY_MS    1000
+#define SCAN_STOP_TIMEOUT_MS   (SCAN_STEP_TIMEOUT_MS + 1000)
+
+static const char *TAG = "Wireless scan";
+
+static const wifi_scan_config_t s_scan_config = {
+    .ssid = NULL,
+    .bssid = NULL,
+    .channel = 0, // Use channel_bitmap instead, set for each step
+    .show_hidden = false,
+    .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+    .scan_time = {
+        .active = {
+            .min = 100,
+            .max = 300
+        }
+    },
+};
+
+static struct {
+    EventGroupHandle_t events;
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    wifi_ap_record_t *records;
+    uint8_t fresh[CONFIG_WL_SCAN_LIST_SIZE];  // the record was found by the current sweep
+    uint16_t count;
+    uint32_t version;       // incremented whenever the records change
+    uint8_t preferred_channel;
+    bool sweeping;
+    bool swept;             // the last sweep scanned all channels
+    int64_t updated_us;     // completion of the last sweep
+} s_scan;
+
+#if CONFIG_WL_HEAP_BUDGET
+static wifi_ap_record_t s_records[CONFIG_WL_SCAN_LIST_SIZE];
+
+static wifi_ap_record_t *records_alloc(void)
+{
+    return s_records;
+}
+
+static void records_free(wifi_ap_record_t *records)
+{
+}
+#else
+static wifi_ap_record_t *records_alloc(void)
+{
+    return calloc(CONFIG_WL_SCAN_LIST_SIZE, sizeof(wifi_ap_record_t));
+}
+
+static void records_free(wifi_ap_record_t *records)
+{
+    free(records);
+}
+#endif
+
+static void cache_swap(uint16_t a, uint16_t b)
+{
+    wifi_ap_record_t record = s_scan.records[a];
+    s_scan.records[a] = s_scan.records[b];
+    s_scan.records[b] = record;
+    uint8_t fresh = s_scan.fresh[a];
+    s_scan.fresh[a] = s_scan.fresh[b];
+    s_scan.fresh[b] = fresh;
+}
+
+// Worth of a BSS against the other BSSs of its SSID. Staying on the preferred channel spares the ESP-NOW mesh
+// from following the STA to another channel, which is worth a few dB.
+static int bss_score(const wifi_ap_record_t *record)
+{
+    int bonus = record->primary == s_scan.preferred_channel ? CONFIG_WL_MESH_CHANNEL_RSSI_MARGIN : 0;
+    return record->rssi + bonus;
+}
+
+// Merges a record found by the current sweep into the cache, which is sorted by RSSI (strongest first) and holds
+// only the best BSS of each SSID, see bss_score(). A record of an earlier sweep is replaced even by a worse one,
+// as the better BSS may be gone. Hidden networks (empty SSID) are dropped as they cannot be selected anyway.
+// Must be called with the lock held.
+static void cache_merge(const wifi_ap_record_t *record)
+{
+    if (record->ssid[0] == '\0') {
+        return;
+    }
+
+    uint16_t i = 0;
+    while (i < s_scan.count && strcmp((const char *)s_scan.records[i].ssid, (const char *)record->ssid) != 0) {
+        i++;
+    }
+    if (i < s_scan.count) {
+        if (s_scan.fresh[i] && bss_score(&s_scan.records[i]) >= bss_score(record)) {
+            return;
+        }
+    } else if (s_scan.count < CONFIG_WL_SCAN_LIST_SIZE) {
+        s_scan.count++;
+    } else if (!s_scan.fresh[i - 1] || s_scan.records[i - 1].rssi < record->rssi) {
+        // Full, the weakest entry makes room
+        i--;
+    } else {
+        return;
+    }
+    s_scan.records[i] = *record;
+    s_scan.fresh[i] = true;
+
+    // Only this entry may be out of order
+    while (i > 0 && s_scan.records[i - 1].rssi < s_scan.records[i].rssi) {
+        cache_swap(i - 1, i);
+        i--;
+    }
+    while (i + 1 < s_scan.count && s_scan.records[i + 1].rssi > s_scan.records[i].rssi) {
+        cache_swap(i, i + 1);
+        i++;
+    }
+}
+
+static void scan_begin_sweep(void)
+{
+    xSemaphoreTake(s_scan.lock, portMAX_DELAY);
+    memset(s_scan.fresh, 0, sizeof(s_scan.fresh));
+    s_scan.sweeping = true;
+    s_scan.swept = false;
+    s_scan.version++;
+    xSemaphoreGive(s_scan.lock);
+}
+
+static void scan_collect_step(void)
+{
+    uint16_t number = 0;
+    esp_wifi_scan_get_ap_num(&number);
+
+    // One record at a time, straight into the cache
+    wifi_ap_record_t record;
+    xSemaphoreTake(s_scan.lock, portMAX_DELAY);
+    for (uint16_t i = 0; i < number && esp_wifi_scan_get_ap_record(&record) == ESP_OK; i++) {
+        cache_merge(&record);
+    }
+    s_scan.version++;
+    xSemaphoreGive(s_scan.lock);
+
+    // Frees the records left in the driver's list, so it must be called after every scan
+    esp_wifi_clear_ap_list();
+}
+
+// Ends the sweep, the networks it did not find are dropped if it scanned all channels
+static void scan_end_sweep(bool complete)
+{
+    xSemaphoreTake(s_scan.lock, portMAX_DELAY);
+    bool first = complete && s_scan.updated_us == 0;
+    if (complete) {
+        uint16_t kept = 0;
+        for (uint16_t i = 0; i < s_scan.count; i++) {
+            if (s_scan.fresh[i]) {
+                s_scan.records[kept++] = s_scan.records[i];
+            }
+        }
+        s_scan.count = kept;
+        s_scan.updated_us = esp_timer_get_time();
+    }
+    s_scan.sweeping = false;
+    s_scan.swept = complete;
+    s_scan.version++;
+    uint16_t count = s_scan.count;
+    xSemaphoreGive(s_scan.lock);
+
+    if (first) {
+        // Only the first one, a portal left open refreshes the cache over and over
+        wl_timing_mark(WL_TIMING_SCAN_DONE);
+    }
+    if (complete) {
+        // Requests that arrived while scanning are satisfied by these results
+        xEventGroupClearBits(s_scan.events, SCAN_REFRESH_BIT);
+        xEventGroupSetBits(s_scan.events, SCAN_READY_BIT);
+        ESP_LOGI(TAG, "Sweep complete, unique SSIDs = %u", count);
+    }
+}
+
+// Scans a step of the sweep, returns ESP_OK once its results are in the cache
+static esp_err_t scan_step(size_t step)
+{
+    wifi_scan_config_t config = s_scan_config;
+    config.channel_bitmap.ghz_2_channels = s_scan_steps[step];
+
+    xEventGroupClearBits(s_scan.events, SCAN_DONE_BIT);
+    esp_err_t err = esp_wifi_scan_start(&config, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start scan: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(s_scan.events, SCAN_DONE_BIT | SCAN_STOP_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(SCAN_STEP_TIMEOUT_MS));
+    if (!(bits & SCAN_DONE_BIT)) {
+        if (!(bits & SCAN_STOP_BIT)) {
+            ESP_LOGW(TAG, "Scan did not complete");
+        }
+        esp_wifi_scan_stop();
+        return ESP_ERR_TIMEOUT;
+    }
+    scan_collect_step();
+    return ESP_OK;
+}
+
+// The only place scans are started from, so concurrent requests never overlap scans
+static void scan_task(void *pvParameters)
+{
+    while (true) {
+        EventBits_t bits = xEventGroupWaitBits(s_scan.events, SCAN_REFRESH_BIT | SCAN_STOP_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+        if (bits & SCAN_STOP_BIT) {
+            break;
+        }
+
+        // Reconnect attempts make the scans fail, and the sweep is what finds the networks to connect to
+        wl_conn_hold(true);
+        wl_heap_mark_t mark;
+        wl_heap_phase_begin(&mark);
+        scan_begin_sweep();
+        esp_err_t err = ESP_OK;
+        for (size_t step = 0; step < NUM_OF_SCAN_STEPS && err == ESP_OK; step++) {
+            err = scan_step(step);
+        }
+        scan_end_sweep(err == ESP_OK);
+        if (err == ESP_OK) {
+            wl_heap_phase_end(WL_HEAP_PHASE_SCAN, &mark);
+        }
+        if (err == ESP_OK || err == ESP_ERR_TIMEOUT) {
+            wl_conn_hold(false);
+        } else {
+            // Most likely an attempt was in progress, the attempts stay held until the sweep gets through.
+            // Keep the refresh request pending and try again later
+            xEventGroupWaitBits(s_scan.events, SCAN_STOP_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(SCAN_RETRY_DELAY_MS));
+        }
+    }
+
+    wl_conn_hold(false);
+    xEventGroupSetBits(s_scan.events, SCAN_EXITED_BIT);
+    vTaskDelete(NULL);
+}
+
+esp_err_t wl_scan_start(uint8_t preferred_channel)
+{
+    if (s_scan.task) {
+        return ESP_OK;
+    }
+
+    s_scan.records = records_alloc();
+    s_scan.events = xEventGroupCreate();
+    s_scan.lock = xSemaphoreCreateMutex();
+    if (!s_scan.records || !s_scan.events || !s_scan.lock) {
+        ESP_LOGE(TAG, "Failed to allocate scan cache");
+        goto fail;
+    }
+    s_scan.count = 0;
+    s_scan.version = 0;
+    s_scan.sweeping = false;
+    s_scan.swept = false;
+    s_scan.preferred_channel = preferred_channel;
+    s_scan.updated_us = 0;
+
+    // Scan right away so the first page load does not have to wait for it
+    xEventGroupSetBits(s_scan.events, SCAN_REFRESH_BIT);
+    if (xTaskCreate(scan_task, "wl_scan", 3072, NULL, 4, &s_scan.task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create scan task");
+        s_scan.task = NULL;
+        goto fail;
+    }
+    return ESP_OK;
+
+fail:
+    if (s_scan.lock) {
+        vSemaphoreDelete(s_scan.lock);
+    }
+    if (s_scan.events) {
+        vEventGroupDelete(s_scan.events);
+    }
+    records_free(s_scan.records);
+    memset(&s_scan, 0, sizeof(s_scan));
+    return ESP_ERR_NO_MEM;
+}
+
+void wl_scan_stop(void)
+{
+    if (!s_scan.task) {
+        return;
+    }
+
+    xEventGroupSetBits(s_scan.events, SCAN_STOP_BIT);
+    if (!(xEventGroupWaitBits(s_scan.events, SCAN_EXITED_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(SCAN_STOP_TIMEOUT_MS)) & SCAN_EXITED_BIT)) {
+        ESP_LOGE(TAG, "Scan task did not exit, deleting it");
+        vTaskDelete(s_scan.task);
+        esp_wifi_scan_stop();
+    }
+
+    EventGroupHandle_t events = s_scan.events;
+    s_scan.events = NULL;
+    vEventGroupDelete(events);
+    vSemaphoreDelete(s_scan.lock);
+    records_free(s_scan.records);
+    memset(&s_scan, 0, sizeof(s_scan));
+}
+
+void wl_scan_notify_done(void)
+{
+    EventGroupHandle_t events = s_scan.events;
+    if (events) {
+        xEventGroupSetBits(events, SCAN_DONE_BIT);
+    }
+}
+
+const wifi_ap_record_t *wl_scan_acquire(uint16_t *count, TickType_t wait)
+{
+    *count = 0;
+    if (!s_scan.task) {
+        return NULL;
+    }
+
+    EventBits_t bits = xEventGroupGetBits(s_scan.events);
+    if (!(bits & SCAN_READY_BIT) && wait > 0) {
+        xEventGroupWaitBits(s_scan.events, SCAN_READY_BIT, pdFALSE, pdFALSE, wait);
+    }
+
+    xSemaphoreTake(s_scan.lock, portMAX_DELAY);
+    int64_t age_ms = (esp_timer_get_time() - s_scan.updated_us) / 1000;
+    if (s_scan.updated_us == 0 || age_ms > CONFIG_WL_SCAN_CACHE_MAX_AGE_MS) {
+        // Coalesces with any refresh already pending or running
+        xEventGroupSetBits(s_scan.events, SCAN_REFRESH_BIT);
+    }
+    *count = s_scan.count;
+    return s_scan.records;
+}
+
+uint32_t wl_scan_get_version(bool *complete)
+{
+    *complete = s_scan.swept;
+    return s_scan.version;
+}
+
+void wl_scan_release(void)
+{
+    xSemaphoreGive(s_scan.lock);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_wifi.h"
+
+/**
+ * @brief Allocates the scan cache and starts the background scan task
+ *
+ * A first scan is kicked off immediately, so results are usually available by the
+ * time the first client loads the provisioning page. Wi-Fi must already be started.
+ *
+ * @param preferred_channel Channel whose BSSs are kept over stronger ones of the same SSID, up to
+ *                          CONFIG_WL_MESH_CHANNEL_RSSI_MARGIN dB, e.g. the ESP-NOW channel. 0 for none.
+ */
+esp_err_t wl_scan_start(uint8_t preferred_channel);
+
+/**
+ * @brief Stops the background scan task and frees the cache
+ */
+void wl_scan_stop(void);
+
+/**
+ * @brief Must be called on WIFI_EVENT_SCAN_DONE, wakes up the scan task to collect the results
+ */
+void wl_scan_notify_done(void);
+
+/**
+ * @brief Locks the cache and returns the cached AP records
+ *
+ * The records are sorted by RSSI (strongest first) and hold only one BSS of each SSID: the
+ * strongest, or one on the preferred channel that is not much weaker. Hidden networks are
+ * left out.
+ * A sweep scans a few channels at a time, the records are updated after each step. Until a
+ * sweep completes, they still hold the networks of the previous one on the channels not
+ * scanned yet.
+ * If the last sweep completed more than CONFIG_WL_SCAN_CACHE_MAX_AGE_MS ago a background
+ * refresh is requested, the stale records are returned anyway. If no sweep has completed
+ * yet, waits up to `wait` ticks for the first one.
+ * Every call must be paired with wl_scan_release(), keep the cache locked only briefly.
+ *
+ * @param[out] count Number of records returned
+ * @param wait Ticks to wait for the first sweep to complete
+ * @return Pointer to the records (valid until wl_scan_release()), NULL if the cache is not running
+ */
+const wifi_ap_record_t *wl_scan_acquire(uint16_t *count, TickType_t wait);
+
+/**
+ * @brief Gets the version of the cached records, must be called while the cache is locked by wl_scan_acquire()
+ *
+ * @param[out] complete Whether the last sweep scanned all channels, false before the first one, while one is in
+ *                      progress and after one was aborted, until it is retried
+ * @return Version, changes whenever the records do
+ */
+uint32_t wl_scan_get_version(bool *complete);
+
+/**
+ * @brief Unlocks the cache locked by wl_scan_acquire()
+ */
+void wl_scan_release(void);
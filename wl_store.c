@@ -0,0 +1,195 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "wl_store.h"
+
+#define STORE_NAMESPACE "wl_store"
+#define STORE_KEY_NETWORKS "networks"
+// Worth of each place in the recency order when ranking, so a recently used network wins over one
+// slightly stronger but rarely used
+#define RECENCY_BONUS_DB 3
+
+static const char *TAG = "Wireless store";
+
+#if CONFIG_WL_HEAP_BUDGET
+// The store is only used by the bring-up, one call at a time
+static wl_network_t s_networks[CONFIG_WL_STORE_MAX_NETWORKS];
+
+static wl_network_t *networks_alloc(void)
+{
+    memset(s_networks, 0, sizeof(s_networks));
+    return s_networks;
+}
+
+static void networks_free(wl_network_t *networks)
+{
+}
+#else
+static wl_network_t *networks_alloc(void)
+{
+    return calloc(CONFIG_WL_STORE_MAX_NETWORKS, sizeof(wl_network_t));
+}
+
+static void networks_free(wl_network_t *networks)
+{
+    free(networks);
+}
+#endif
+
+size_t wl_store_load(wl_network_t *networks)
+{
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(STORE_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        }
+        return 0;
+    }
+
+    size_t len = CONFIG_WL_STORE_MAX_NETWORKS * sizeof(wl_network_t);
+    err = nvs_get_blob(nvs, STORE_KEY_NETWORKS, networks, &len);
+    nvs_close(nvs);
+    // A blob of another size was stored by a firmware with another layout, or more networks
+    if (err != ESP_OK || len % sizeof(wl_network_t) != 0) {
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGW(TAG, "Ignoring stored networks: %s", esp_err_to_name(err));
+        }
+        return 0;
+    }
+    return len / sizeof(wl_network_t);
+}
+
+// Index of the network connected to most recently, the networks must not be empty
+static size_t find_latest(const wl_network_t *networks, size_t count)
+{
+    size_t latest = 0;
+    for (size_t i = 1; i < count; i++) {
+        if (networks[i].last_success > networks[latest].last_success) {
+            latest = i;
+        }
+    }
+    return latest;
+}
+
+esp_err_t wl_store_get_latest(wl_network_t *network)
+{
+    wl_network_t *networks = networks_alloc();
+    if (!networks) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t count = wl_store_load(networks);
+    if (count > 0) {
+        *network = networks[find_latest(networks, count)];
+    }
+    networks_free(networks);
+    return count > 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static bool network_equals(const wl_network_t *a, const wl_network_t *b)
+{
+    // Field by field, the padding is not necessarily initialized
+    return strcmp(a->ssid, b->ssid) == 0 && strcmp(a->password, b->password) == 0 &&
+           memcmp(a->bssid, b->bssid, sizeof(a->bssid)) == 0 && a->channel == b->channel &&
+           memcmp(&a->lease, &b->lease, sizeof(a->lease)) == 0 && a->dns.addr == b->dns.addr;
+}
+
+esp_err_t wl_store_save(const wl_network_t *network)
+{
+    wl_network_t *networks = networks_alloc();
+    if (!networks) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t count = wl_store_load(networks);
+    size_t latest = count > 0 ? find_latest(networks, count) : 0;
+    uint32_t last_success = count > 0 ? networks[latest].last_success + 1 : 1;
+
+    size_t slot = count;
+    size_t oldest = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(networks[i].ssid, network->ssid) == 0) {
+            slot = i;
+        }
+        if (networks[i].last_success < networks[oldest].last_success) {
+            oldest = i;
+        }
+    }
+    // Spare the flash the write when nothing changed, which is the case on most boots
+    if (slot < count && slot == latest && network_equals(&networks[slot], network)) {
+        networks_free(networks);
+        return ESP_OK;
+    }
+    if (slot == CONFIG_WL_STORE_MAX_NETWORKS) {
+        ESP_LOGI(TAG, "Store full, forgetting %s", networks[oldest].ssid);
+        slot = oldest;
+    } else if (slot == count) {
+        count++;
+    }
+    networks[slot] = *network;
+    networks[slot].last_success = last_success;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(STORE_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, STORE_KEY_NETWORKS, networks, count * sizeof(wl_network_t));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    networks_free(networks);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store network: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+typedef struct {
+    int score;
+    size_t index;
+} rank_entry_t;
+
+static int rank_entry_cmp(const void *a, const void *b)
+{
+    return ((const rank_entry_t *)b)->score - ((const rank_entry_t *)a)->score;
+}
+
+size_t wl_store_rank(const wifi_ap_record_t *records, uint16_t count, wl_network_t *ranked)
+{
+    wl_network_t *networks = networks_alloc();
+    if (!networks) {
+        return 0;
+    }
+    size_t num_of_networks = wl_store_load(networks);
+
+    rank_entry_t rank[CONFIG_WL_STORE_MAX_NETWORKS];
+    size_t num_ranked = 0;
+    for (size_t i = 0; i < num_of_networks; i++) {
+        for (uint16_t j = 0; j < count; j++) {
+            if (strcmp((const char *)records[j].ssid, networks[i].ssid) != 0) {
+                continue;
+            }
+            int recency = 0;
+            for (size_t k = 0; k < num_of_networks; k++) {
+                recency += networks[k].last_success < networks[i].last_success;
+            }
+            memcpy(networks[i].bssid, records[j].bssid, sizeof(networks[i].bssid));
+            networks[i].channel = records[j].primary;
+            // The RSSI of the BSS to join, not the mesh channel bonus it may have been kept for
+            rank[num_ranked++] = (rank_entry_t) { .score = records[j].rssi + recency * RECENCY_BONUS_DB, .index = i };
+            break;
+        }
+    }
+
+    qsort(rank, num_ranked, sizeof(rank_entry_t), rank_entry_cmp);
+    for (size_t i = 0; i < num_ranked; i++) {
+        ranked[i] = networks[rank[i].index];
+        ESP_LOGI(TAG, "Candidate %u: %s, score %d", (unsigned)i, ranked[i].ssid, rank[i].score);
+    }
+    networks_free(networks);
+    return num_ranked;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+
+/**
+ * @brief A network the STA connected to, persisted so later boots can reconnect without provisioning
+ */
+typedef struct {
+    char ssid[33];
+    char password[65];
+    uint8_t bssid[6];
+    uint8_t channel;
+    esp_netif_ip_info_t lease;  /**<! Last IP configuration obtained by DHCP, all zero if none */
+    esp_ip4_addr_t dns;         /**<! DNS server of the lease */
+    uint32_t last_success;      /**<! Order of the last successful connection, the higher the more recent */
+} wl_network_t;
+
+/**
+ * @brief Loads the stored networks from NVS
+ *
+ * @param[out] networks Networks, room for CONFIG_WL_STORE_MAX_NETWORKS
+ * @return Number of networks loaded, 0 if none is stored or NVS could not be read
+ */
+size_t wl_store_load(wl_network_t *networks);
+
+/**
+ * @brief Loads the network the STA last connected to
+ *
+ * @param[out] network Network
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no network is stored
+ */
+esp_err_t wl_store_get_latest(wl_network_t *network);
+
+/**
+ * @brief Records a successful connection to a network in NVS
+ *
+ * The entry with the same SSID is updated, otherwise the network is added, replacing the least recently
+ * connected one if the store is full. Nothing is written if the network already is the latest one, unchanged.
+ *
+ * @param network Network, `last_success` is ignored
+ * @return ESP_OK on success, an error if NVS could not be written
+ */
+esp_err_t wl_store_save(const wl_network_t *network);
+
+/**
+ * @brief Ranks the stored networks found by a scan, best first
+ *
+ * A network ranks by the RSSI of the BSS the scan kept for it, plus a bonus for each stored network it was
+ * connected to more recently than. The ranked networks take the BSSID and channel of that BSS. It may be a weaker
+ * BSS on the mesh channel rather than the strongest one: the network ranks by the BSS the STA is going to join.
+ *
+ * @param records Scan results, holding one BSS of each SSID, see wl_scan_acquire()
+ * @param count Number of scan results
+ * @param[out] ranked Ranked networks, room for CONFIG_WL_STORE_MAX_NETWORKS
+ * @return Number of ranked networks
+ */
+size_t wl_store_rank(const wifi_ap_record_t *records, uint16_t count, wl_network_t *ranked);
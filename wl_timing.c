@@ -0,0 +1,70 @@
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "wl_timing.h"
+#include "wl_logic.h"
+
+// Milestones of the summary at most, about as many as fit in its line
+#define SUMMARY_MAX_ENTRIES 16
+
+static const char *TAG = "Wireless timing";
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static wl_timing_entry_t s_history[CONFIG_WL_TIMING_HISTORY_SIZE];
+// Total number of milestones recorded, the next one goes to s_history[s_recorded % size]
+static uint32_t s_recorded;
+
+void wl_timing_mark(wl_timing_phase_t phase)
+{
+    uint32_t now_ms = esp_timer_get_time() / 1000;
+
+    portENTER_CRITICAL(&s_lock);
+    s_history[s_recorded % CONFIG_WL_TIMING_HISTORY_SIZE] = (wl_timing_entry_t) { .time_ms = now_ms, .phase = phase };
+    s_recorded++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+size_t wl_get_timing(wl_timing_entry_t *entries, size_t max_entries)
+{
+    portENTER_CRITICAL(&s_lock);
+    size_t count = MIN(s_recorded, CONFIG_WL_TIMING_HISTORY_SIZE);
+    // The most recent milestones when they do not all fit
+    size_t skip = count > max_entries ? count - max_entries : 0;
+    for (size_t i = skip; i < count; i++) {
+        entries[i - skip] = s_history[(s_recorded - count + i) % CONFIG_WL_TIMING_HISTORY_SIZE];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return count - skip;
+}
+
+void wl_timing_log_summary(void)
+{
+    // Called on the event loop task, whose stack is small: only the tail back to the previous connection is copied
+    wl_timing_entry_t entries[SUMMARY_MAX_ENTRIES];
+    portENTER_CRITICAL(&s_lock);
+    size_t recorded = MIN(s_recorded, CONFIG_WL_TIMING_HISTORY_SIZE);
+    size_t count = 0;
+    while (count < MIN(recorded, SUMMARY_MAX_ENTRIES)) {
+        count++;
+        uint8_t phase = s_history[(s_recorded - count) % CONFIG_WL_TIMING_HISTORY_SIZE].phase;
+        if (count > 1 && (phase == WL_TIMING_GOT_IP || phase == WL_TIMING_START)) {
+            break;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        entries[i] = s_history[(s_recorded - count + i) % CONFIG_WL_TIMING_HISTORY_SIZE];
+    }
+    portEXIT_CRITICAL(&s_lock);
+    if (count == 0) {
+        return;
+    }
+
+    char line[192];
+    wl_timing_format(line, sizeof(line), entries, count);
+    ESP_LOGI(TAG, "%s, online %" PRIu32 " ms after boot", line, entries[count - 1].time_ms);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Milestones of the Wi-Fi bring-up and of each connection
+ */
+typedef enum {
+    WL_TIMING_START,            /**<! wl_wifi_start() called */
+    WL_TIMING_NETIF,            /**<! netif and default event loop created */
+    WL_TIMING_WIFI_INIT,        /**<! Wi-Fi driver initialized */
+    WL_TIMING_AP_START,         /**<! softAP started */
+    WL_TIMING_STA_START,        /**<! STA started */
+    WL_TIMING_SCAN_DONE,        /**<! The first sweep of the scan cache completed, the one networks are ranked from */
+    WL_TIMING_PORTAL,           /**<! Provisioning HTTP and DNS servers started */
+    WL_TIMING_CONNECTING,       /**<! A connection attempt started */
+    WL_TIMING_ASSOCIATED,       /**<! Authenticated and associated with the AP */
+    WL_TIMING_DISCONNECTED,     /**<! Disconnected, or an attempt failed */
+    WL_TIMING_GOT_IP,           /**<! Got an IP */
+    WL_TIMING_MAX,
+} wl_timing_phase_t;
+
+/**
+ * @brief Time a milestone was reached
+ */
+typedef struct {
+    uint32_t time_ms;           /**<! Time since boot */
+    uint8_t phase;              /**<! wl_timing_phase_t */
+} wl_timing_entry_t;
+
+/**
+ * @brief Records that a milestone was reached, the oldest record is overwritten once the history is full
+ *
+ * @param phase Milestone
+ */
+void wl_timing_mark(wl_timing_phase_t phase);
+
+/**
+ * @brief Logs the time between the milestones of the last connection on one line, called on IP_EVENT_STA_GOT_IP
+ */
+void wl_timing_log_summary(void);
+
+/**
+ * @brief Gets the history of milestones, kept across reconnections
+ *
+ * @param[out] entries Milestones, oldest first
+ * @param max_entries Room in `entries`, the history holds up to CONFIG_WL_TIMING_HISTORY_SIZE milestones
+ * @return Number of milestones returned
+ */
+size_t wl_get_timing(wl_timing_entry_t *entries, size_t max_entries);